@@ -0,0 +1,476 @@
+// BatchMain.cpp : Command line front end for BatchRunner, no window or DirectX so it builds on Linux as well.
+//
+// Not part of the Visual Studio project (it has its own main), build it on its own, eg:
+//     g++ -std=c++20 -O2 -fpermissive -pthread -o nesx-batch Source/BatchMain.cpp Source/BatchRunner.cpp Source/CPU.cpp
+//         Source/ChrCache.cpp Source/ChrRomCache.cpp Source/ConsoleChecks.cpp Source/Dynarec.cpp
+//         Source/DynarecCodeCache.cpp Source/EmulationThread.cpp Source/FrameConverter.cpp Source/GameCartridge.cpp
+//         Source/LaneCpu.cpp Source/Mapper.cpp Source/NES.cpp Source/PPU.cpp Source/RomFile.cpp Source/RomHash.cpp
+//         Source/RomLibrary.cpp Source/TileDecoder.cpp
+//
+// nesx-batch <rom> [-instances N] [-frames K] [-steps S] [-threads T] [-no-frames] [-scaling] [-lanes] [-memory-report]
+//                  [-idle-loops]
+//     Runs N consoles for S steps of K frames each, with random controller input per console and step, and reports
+//     the frames per second of all consoles together. -scaling repeats the run on 1, 2, 4, ... threads up to T.
+//     -lanes runs everything a second time with BatchRunner::SetLaneExecution and reports how full the lanes were.
+//     It first runs the built in CPU check programs in lanes against lockstep (see RunLaneCheck), and exits with 1
+//     if those or the RAM hash of the second run don't match.
+//     -memory-report lists what the first console holds after the first run (see NES::GetMemoryReport) and what all
+//     N take together, with everything the cartridge shares between them counted once.
+//     -idle-loops lists the idle loops found by the first run (see NES::GetIdleLoopAddresses) and how many passes and
+//     CPU cycles of them were skipped, over all N consoles.
+//
+// Anywhere a <rom> goes, -sha1 <hex> <index> loads the ROM with that SHA-1 from an index written by -index instead,
+// with the header from the index (see RomLibrary).
+//
+// nesx-batch -index <directory> <index>
+//     Hashes every .nes file under directory, writes the index and lists what went into it.
+//
+// nesx-batch <rom> -emulation-thread [-frames K]
+//     Runs one console on an EmulationThread for K frames, once paced to 60 fps and once as fast as it can, against a
+//     stand in for the window that sends input and stalls on every present, and reports what got through.
+//
+// nesx-batch <rom> -renderer-check [-frames K]
+//     Runs K frames drawing whole scanlines and drawing every dot and compares every frame (see RunRendererCheck).
+//     Exits with 1 if any frame differs.
+//
+// nesx-batch -cpu-check
+//     Runs the built in CPU check programs through the interpreter and the threaded core an instruction at a time and
+//     compares them (see RunCpuTraceCheck). Exits with 1 on the first difference. Build it once more with
+//     -DCPU_TEMPLATE_DISPATCH=1 to check the template core as well.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchRunner.h"
+#include "ConsoleChecks.h"
+#include "EmulationThread.h"
+#include "FrameConverter.h"
+#include "GameCartridge.h"
+#include "RomHash.h"
+#include "RomLibrary.h"
+
+struct BatchOptions
+{
+	std::string romPath;
+	int instances = 64;
+	int frames = 60;
+	int steps = 10;
+	int threads = 0;
+	bool captureFrames = true;
+	bool scaling = false;
+	bool lanes = false;
+	bool memoryReport = false;
+	bool idleLoops = false;
+	bool emulationThread = false;
+	bool rendererCheck = false;
+	bool cpuCheck = false;
+
+	// -index
+	std::string indexDirectory;
+	std::string indexPath;
+
+	// -sha1
+	std::string sha1;
+	std::string sha1IndexPath;
+};
+
+struct BatchResult
+{
+	double framesPerSecond = 0.0;
+	uint64_t steals = 0;
+	uint64_t ramHash = 0;
+	double laneUtilization = 0.0; // Lanes running an instruction, out of the lanes still running
+	double laneWidth = 0.0; // Lanes running an instruction, out of LaneCpu::kLanes
+	double peeledShare = 0.0; // Instructions run by the scalar CPU after their lane was peeled off
+
+	// Only filled in with -memory-report
+	std::vector<NES::MemoryReportEntry> memoryReport; // The first console
+	size_t instanceBytes = 0; // Every console's own memory, added up
+	size_t sharedBytes = 0; // What they share, once
+
+	// Only filled in with -idle-loops, over every console
+	std::set<uint16_t> idleLoopAddresses;
+	NES::IdleLoopStats idleLoopStats;
+};
+
+// FNV-1a over everyone's RAM at the end, the same options have to give the same hash on any thread count
+uint64_t HashRam(const uint8_t* data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001B3;
+	}
+	return hash;
+}
+
+BatchResult RunBatch(const GameCartridge& game, const BatchOptions& options, int threads, bool lanes)
+{
+	BatchRunner runner(game, options.instances, threads);
+	runner.SetFrameCapture(options.captureFrames);
+	runner.SetLaneExecution(lanes);
+
+	// Same sequence for every run, so results can be compared
+	uint32_t random = 0x2545F491;
+	std::vector<BatchRunner::Input> inputs(options.instances);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int step = 0; step < options.steps; step++)
+	{
+		for (BatchRunner::Input& input : inputs)
+		{
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			input.firstController = (uint8_t)random;
+		}
+		runner.Step(options.frames, inputs);
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	BatchResult result;
+	double seconds = std::chrono::duration<double>(end - start).count();
+	result.framesPerSecond = runner.GetStats().frames / seconds;
+	result.steals = runner.GetStats().steals;
+	result.ramHash = HashRam(runner.GetRam(), (size_t)options.instances * BatchRunner::kRamSize);
+
+	if (options.memoryReport)
+	{
+		result.memoryReport = runner.GetInstance(0).GetMemoryReport();
+		for (int instance = 0; instance < runner.GetInstanceCount(); instance++)
+		{
+			for (const NES::MemoryReportEntry& entry : runner.GetInstance(instance).GetMemoryReport())
+			{
+				// Indented entries are already part of the one above
+				if (entry.name[0] == ' ') continue;
+
+				if (!entry.shared) result.instanceBytes += entry.bytes;
+				else if (instance == 0) result.sharedBytes += entry.bytes;
+			}
+		}
+	}
+
+	if (options.idleLoops)
+	{
+		for (int instance = 0; instance < runner.GetInstanceCount(); instance++)
+		{
+			NES& nes = runner.GetInstance(instance);
+			result.idleLoopAddresses.insert(nes.GetIdleLoopAddresses().begin(), nes.GetIdleLoopAddresses().end());
+			result.idleLoopStats.skips += nes.GetIdleLoopStats().skips;
+			result.idleLoopStats.skippedCycles += nes.GetIdleLoopStats().skippedCycles;
+		}
+	}
+
+#if CPU_THREADED_DISPATCH
+	const LaneCpu::Stats& laneStats = runner.GetStats().lanes;
+	if (laneStats.steps != 0)
+	{
+		uint64_t instructions = laneStats.laneInstructions + laneStats.peeledInstructions;
+		result.laneUtilization = (double)laneStats.laneInstructions / laneStats.runningLanes;
+		result.laneWidth = (double)laneStats.laneInstructions / (laneStats.steps * LaneCpu::kLanes);
+		result.peeledShare = (double)laneStats.peeledInstructions / instructions;
+	}
+#endif
+	return result;
+}
+
+struct PresenterResult
+{
+	double seconds = 0.0;
+	uint64_t framesEmulated = 0;
+	uint64_t framesPresented = 0;
+	uint64_t framesSkipped = 0; // Published, but a newer one was there by the time the presenter looked
+	uint64_t inputsSent = 0;
+	bool inOrder = true;
+};
+
+// Stands in for WinMain's loop: sends a new controller state now and then, takes the newest frame, converts it and
+// then stalls like a Present waiting on vsync would, longer every so often
+PresenterResult RunPresenter(const GameCartridge& game, int frames, std::chrono::nanoseconds frameInterval)
+{
+	NES nes;
+	nes.PowerOn();
+	nes.LoadGameCartridge(game);
+	nes.CPU.Reset();
+
+	FrameConverter frameConverter(FrameConverter::PixelFormat::RGBA8);
+	std::vector<uint32_t> pixels(PPU::kScreenWidth * PPU::kScreenHeight);
+
+	PresenterResult result;
+	uint32_t random = 0x2545F491;
+	uint64_t lastNumber = 0;
+
+	std::unique_ptr<EmulationThread> emulation(new EmulationThread(nes));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	emulation->Start(frameInterval);
+
+	while (emulation->GetFramesEmulated() < (uint64_t)frames)
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		if ((random & 0x0300) == 0 && emulation->PushInput((uint8_t)random, 0x00))
+		{
+			result.inputsSent++;
+		}
+
+		if (const EmulationThread::Frame* newest = emulation->TakeNewestFrame())
+		{
+			result.inOrder &= newest->number > lastNumber;
+			result.framesSkipped += newest->number - lastNumber - 1;
+			lastNumber = newest->number;
+			result.framesPresented++;
+
+			frameConverter.Convert(newest->pixels.data(), (int)pixels.size(), pixels.data());
+			std::this_thread::sleep_for(std::chrono::milliseconds((random & 0xF000) == 0 ? 40 : 10));
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	emulation->Stop();
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.framesEmulated = emulation->GetFramesEmulated();
+	return result;
+}
+
+void RunEmulationThreadCheck(const GameCartridge& game, int frames)
+{
+	const char* names[] = { "Paced", "Unpaced" };
+	const std::chrono::nanoseconds intervals[] = { EmulationThread::kNtscFrameInterval, std::chrono::nanoseconds(0) };
+
+	for (int i = 0; i < 2; i++)
+	{
+		PresenterResult result = RunPresenter(game, frames, intervals[i]);
+		printf("%-8s %6llu frames emulated in %6.2fs (%8.1f fps), %6llu presented, %6llu skipped, %4llu inputs, %s\n",
+			names[i], (unsigned long long)result.framesEmulated, result.seconds, result.framesEmulated / result.seconds,
+			(unsigned long long)result.framesPresented, (unsigned long long)result.framesSkipped,
+			(unsigned long long)result.inputsSent, result.inOrder ? "in order" : "OUT OF ORDER");
+	}
+}
+
+bool RunIndex(const std::string& directory, const std::string& indexPath)
+{
+	RomLibrary library;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t count = library.Scan(directory);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (const RomLibrary::Entry& entry : library.GetEntries())
+	{
+		printf("%s  %08x  mapper %3d%s  %s\n", Sha1::ToHex(entry.sha1).c_str(), entry.crc32, entry.GetMapperId(),
+			entry.fixups != RomLibrary::kFixupNone ? " (header fixed)" : "", entry.path.c_str());
+	}
+	printf("%zu ROMs indexed in %.2fs\n", count, seconds);
+
+	if (!library.Save(indexPath))
+	{
+		fprintf(stderr, "Couldn't write %s\n", indexPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool LoadFromIndex(const std::string& sha1, const std::string& indexPath, GameCartridge& game)
+{
+	Sha1Digest digest;
+	if (!Sha1::FromHex(sha1, digest))
+	{
+		fprintf(stderr, "%s isn't a SHA-1\n", sha1.c_str());
+		return false;
+	}
+
+	RomLibrary library;
+	if (!library.Load(indexPath))
+	{
+		fprintf(stderr, "Couldn't read %s\n", indexPath.c_str());
+		return false;
+	}
+
+	const RomLibrary::Entry* entry = library.Find(digest);
+	if (!entry)
+	{
+		fprintf(stderr, "%s isn't in %s\n", sha1.c_str(), indexPath.c_str());
+		return false;
+	}
+
+	if (!library.LoadCartridge(*entry, game))
+	{
+		fprintf(stderr, "Couldn't load %s\n", entry->path.c_str());
+		return false;
+	}
+
+	printf("%s: %s\n", sha1.c_str(), entry->path.c_str());
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BatchOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "-instances") == 0 && hasValue) options.instances = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-frames") == 0 && hasValue) options.frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-steps") == 0 && hasValue) options.steps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-threads") == 0 && hasValue) options.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-no-frames") == 0) options.captureFrames = false;
+		else if (strcmp(argv[i], "-scaling") == 0) options.scaling = true;
+		else if (strcmp(argv[i], "-lanes") == 0) options.lanes = true;
+		else if (strcmp(argv[i], "-memory-report") == 0) options.memoryReport = true;
+		else if (strcmp(argv[i], "-idle-loops") == 0) options.idleLoops = true;
+		else if (strcmp(argv[i], "-emulation-thread") == 0) options.emulationThread = true;
+		else if (strcmp(argv[i], "-renderer-check") == 0) options.rendererCheck = true;
+		else if (strcmp(argv[i], "-cpu-check") == 0) options.cpuCheck = true;
+		else if (strcmp(argv[i], "-index") == 0 && i + 2 < argc)
+		{
+			options.indexDirectory = argv[++i];
+			options.indexPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-sha1") == 0 && i + 2 < argc)
+		{
+			options.sha1 = argv[++i];
+			options.sha1IndexPath = argv[++i];
+		}
+		else if (argv[i][0] != '-') options.romPath = argv[i];
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (options.cpuCheck)
+	{
+		std::string report;
+		bool passed = RunCpuTraceCheck(report);
+		printf("%s", report.c_str());
+		return passed ? 0 : 1;
+	}
+
+	if (!options.indexPath.empty())
+	{
+		return RunIndex(options.indexDirectory, options.indexPath) ? 0 : 1;
+	}
+
+	if ((options.romPath.empty() && options.sha1.empty()) || options.instances <= 0 || options.frames <= 0 || options.steps <= 0)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-instances N] [-frames K] [-steps S] [-threads T] [-no-frames] [-scaling] [-lanes] [-memory-report] [-idle-loops]\n", argv[0]);
+		fprintf(stderr, "       %s <rom> -emulation-thread [-frames K]\n", argv[0]);
+		fprintf(stderr, "       %s <rom> -renderer-check [-frames K]\n", argv[0]);
+		fprintf(stderr, "       %s -cpu-check\n", argv[0]);
+		fprintf(stderr, "       %s -index <directory> <index>\n", argv[0]);
+		fprintf(stderr, "       <rom> can be -sha1 <hex> <index> in place of a path\n");
+		return 1;
+	}
+
+	GameCartridge game;
+	if (!options.sha1.empty())
+	{
+		if (!LoadFromIndex(options.sha1, options.sha1IndexPath, game))
+			return 1;
+	}
+	else
+	{
+		game.LoadRomFromFile(options.romPath);
+		if (!game.IsLoaded())
+		{
+			fprintf(stderr, "Couldn't load %s\n", options.romPath.c_str());
+			return 1;
+		}
+	}
+
+	if (options.emulationThread)
+	{
+		RunEmulationThreadCheck(game, options.frames);
+		return 0;
+	}
+
+	if (options.rendererCheck)
+	{
+		std::string report;
+		bool passed = RunRendererCheck(game, options.frames, report);
+		printf("%s", report.c_str());
+		return passed ? 0 : 1;
+	}
+
+	int maxThreads = options.threads > 0 ? options.threads : std::max(1, (int)std::thread::hardware_concurrency());
+	std::vector<int> threadCounts;
+	if (options.scaling)
+	{
+		for (int threads = 1; threads < maxThreads; threads *= 2)
+		{
+			threadCounts.push_back(threads);
+		}
+	}
+	threadCounts.push_back(maxThreads);
+
+	bool lanesMatch = true;
+	if (options.lanes)
+	{
+		std::string report;
+		lanesMatch = RunLaneCheck(options.instances, options.frames, report);
+		printf("%s", report.c_str());
+	}
+
+	printf("%d instances, %d steps of %d frames, frames %s\n", options.instances, options.steps, options.frames,
+		options.captureFrames ? "captured" : "not captured");
+
+	double baseline = 0.0;
+	for (int threads : threadCounts)
+	{
+		BatchResult result = RunBatch(game, options, threads, false);
+		if (baseline == 0.0) baseline = result.framesPerSecond;
+
+		printf("%3d threads: %10.1f fps  %5.2fx  steals %-6llu ram %016llx\n", threads, result.framesPerSecond,
+			result.framesPerSecond / baseline, (unsigned long long)result.steals, (unsigned long long)result.ramHash);
+
+		if (!result.memoryReport.empty())
+		{
+			for (const NES::MemoryReportEntry& entry : result.memoryReport)
+			{
+				printf("    %-36s %10zu%s\n", entry.name.c_str(), entry.bytes, entry.shared ? " (shared)" : "");
+			}
+			printf("    %d instances: %zu bytes each on average, %zu shared, %zu in total\n", options.instances,
+				result.instanceBytes / options.instances, result.sharedBytes, result.instanceBytes + result.sharedBytes);
+			options.memoryReport = false;
+		}
+
+		if (options.idleLoops)
+		{
+			printf("    %zu idle loops, %llu skipped, %llu CPU cycles\n", result.idleLoopAddresses.size(),
+				(unsigned long long)result.idleLoopStats.skips, (unsigned long long)result.idleLoopStats.skippedCycles);
+			for (uint16_t address : result.idleLoopAddresses)
+			{
+				printf("    $%04X\n", address);
+			}
+			options.idleLoops = false;
+		}
+
+		if (options.lanes)
+		{
+			BatchResult lanes = RunBatch(game, options, threads, true);
+			printf("      lanes: %10.1f fps  %5.2fx  steals %-6llu ram %016llx%s\n", lanes.framesPerSecond,
+				lanes.framesPerSecond / result.framesPerSecond, (unsigned long long)lanes.steals,
+				(unsigned long long)lanes.ramHash, lanes.ramHash == result.ramHash ? "" : "  MISMATCH");
+			lanesMatch &= lanes.ramHash == result.ramHash;
+#if CPU_THREADED_DISPATCH
+			printf("             lane utilization %.1f%%, %.1f%% of %d lanes, %.1f%% of instructions peeled off\n",
+				lanes.laneUtilization * 100.0, lanes.laneWidth * 100.0, LaneCpu::kLanes, lanes.peeledShare * 100.0);
+#endif
+		}
+	}
+
+	return lanesMatch ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+#include "BatchRunner.h"
+
+#include <algorithm>
+#include <cstring>
+
+BatchRunner::BatchRunner(const GameCartridge& game, int instanceCount, int threadCount)
+{
+	for (int i = 0; i < instanceCount; i++)
+	{
+		std::unique_ptr<NES> nes(new NES());
+		nes->PowerOn();
+		nes->LoadGameCartridge(game);
+		nes->CPU.Reset();
+		m_instances.push_back(std::move(nes));
+	}
+
+	m_frames.assign((size_t)instanceCount * kFramePixels, 0x000F);
+	m_ram.assign((size_t)instanceCount * kRamSize, 0x00);
+
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, std::max(1, instanceCount));
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		m_workers.emplace_back(new Worker());
+	}
+
+	for (int i = 1; i < threadCount; i++)
+	{
+		m_threads.emplace_back(&BatchRunner::WorkerThread, this, i);
+	}
+}
+
+BatchRunner::~BatchRunner()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void BatchRunner::SetLaneExecution(bool enabled)
+{
+#if CPU_THREADED_DISPATCH
+	m_laneExecution = enabled;
+#endif
+}
+
+void BatchRunner::Step(int frames, std::span<const Input> inputs)
+{
+	m_stepFrames = frames;
+	m_stepInputs = inputs;
+
+	// Contiguous ranges, so neighbouring consoles (and their slots in the output arrays) share a worker
+	int instanceCount = (int)m_instances.size();
+	int workerCount = (int)m_workers.size();
+	int taskCount = m_laneExecution ? (instanceCount + kLaneGroupSize - 1) / kLaneGroupSize : instanceCount;
+	for (int i = 0; i < workerCount; i++)
+	{
+		Worker& worker = *m_workers[i];
+		worker.first = (int)((int64_t)taskCount * i / workerCount);
+		worker.last = (int)((int64_t)taskCount * (i + 1) / workerCount);
+		worker.front = worker.first;
+		worker.back = worker.last;
+		worker.steals = 0;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_busyThreads = (int)m_threads.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	RunWorker(0);
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_busyThreads == 0; });
+	}
+
+	m_stats.steps++;
+	m_stats.frames += (uint64_t)frames * m_instances.size();
+#if CPU_THREADED_DISPATCH
+	m_stats.lanes = LaneCpu::Stats();
+#endif
+	for (std::unique_ptr<Worker>& worker : m_workers)
+	{
+		m_stats.steals += worker->steals;
+#if CPU_THREADED_DISPATCH
+		const LaneCpu::Stats& lanes = worker->laneCpu.GetStats();
+		m_stats.lanes.steps += lanes.steps;
+		m_stats.lanes.laneInstructions += lanes.laneInstructions;
+		m_stats.lanes.runningLanes += lanes.runningLanes;
+		m_stats.lanes.peeledLanes += lanes.peeledLanes;
+		m_stats.lanes.peeledInstructions += lanes.peeledInstructions;
+#endif
+	}
+}
+
+void BatchRunner::WorkerThread(int worker)
+{
+	uint64_t generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&]() { return m_quit || m_generation != generation; });
+			if (m_quit)
+				return;
+			generation = m_generation;
+		}
+
+		RunWorker(worker);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busyThreads--;
+		}
+		m_done.notify_one();
+	}
+}
+
+void BatchRunner::RunWorker(int worker)
+{
+	int task = 0;
+	while (TakeOwn(*m_workers[worker], task) || Steal(worker, task))
+	{
+		if (m_laneExecution)
+		{
+			int first = task * kLaneGroupSize;
+			RunLaneGroup(*m_workers[worker], first, std::min(kLaneGroupSize, (int)m_instances.size() - first));
+		}
+		else
+		{
+			RunInstance(task);
+		}
+	}
+}
+
+bool BatchRunner::TakeOwn(Worker& worker, int& task)
+{
+	std::lock_guard<std::mutex> lock(worker.mutex);
+	if (worker.front == worker.back)
+		return false;
+
+	task = worker.front++;
+	return true;
+}
+
+bool BatchRunner::Steal(int thief, int& task)
+{
+	// Start with the next worker over so thieves spread out instead of all hitting worker 0
+	int count = (int)m_workers.size();
+	for (int i = 1; i < count; i++)
+	{
+		Worker& victim = *m_workers[(thief + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.front == victim.back)
+			continue;
+
+		task = --victim.back;
+		m_workers[thief]->steals++;
+		return true;
+	}
+	return false;
+}
+
+void BatchRunner::RunInstance(int instance)
+{
+	NES& nes = *m_instances[instance];
+	if (!m_stepInputs.empty())
+	{
+		nes.SetFirstControllerState(m_stepInputs[instance].firstController);
+		nes.SetSecondControllerState(m_stepInputs[instance].secondController);
+	}
+
+	for (int frame = 0; frame < m_stepFrames; frame++)
+	{
+		// Only the frame that gets copied out has to be drawn
+		nes.PPU.SetHeadless(!m_captureFrames || frame != m_stepFrames - 1);
+		nes.ClockFullFrame();
+	}
+
+	CaptureInstance(instance);
+}
+
+void BatchRunner::RunLaneGroup(Worker& worker, int first, int count)
+{
+#if CPU_THREADED_DISPATCH
+	bool running[LaneCpu::kLanes];
+	for (int i = 0; i < count; i++)
+	{
+		NES& nes = *m_instances[first + i];
+		if (!m_stepInputs.empty())
+		{
+			nes.SetFirstControllerState(m_stepInputs[first + i].firstController);
+			nes.SetSecondControllerState(m_stepInputs[first + i].secondController);
+		}
+	}
+
+	for (int frame = 0; frame < m_stepFrames; frame++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			m_instances[first + i]->PPU.SetHeadless(!m_captureFrames || frame != m_stepFrames - 1);
+			running[i] = true;
+		}
+
+		// Every console goes as far as it can on its own, then the ones that can run ahead do it together
+		while (true)
+		{
+			NES* group[LaneCpu::kLanes];
+			int budgets[LaneCpu::kLanes];
+			int cycles[LaneCpu::kLanes];
+			int groupSize = 0;
+			for (int i = 0; i < count; i++)
+			{
+				if (!running[i])
+					continue;
+
+				NES* nes = m_instances[first + i].get();
+				int budget = nes->ResumeCatchUpFrame();
+				if (budget == 0)
+				{
+					running[i] = false;
+					continue;
+				}
+
+				group[groupSize] = nes;
+				budgets[groupSize] = budget;
+				groupSize++;
+			}
+
+			if (groupSize == 0)
+				break;
+
+			worker.laneCpu.Run(group, budgets, cycles, groupSize);
+			for (int i = 0; i < groupSize; i++)
+			{
+				group[i]->EndRunAhead(cycles[i]);
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		CaptureInstance(first + i);
+	}
+#endif
+}
+
+void BatchRunner::CaptureInstance(int instance)
+{
+	NES& nes = *m_instances[instance];
+	if (m_captureFrames)
+	{
+		std::memcpy(m_frames.data() + (size_t)instance * kFramePixels, nes.PPU.GetScreenBuffer(), kFramePixels * sizeof(uint16_t));
+	}
+	std::memcpy(m_ram.data() + (size_t)instance * kRamSize, nes.GetCpuRam().data(), kRamSize);
+}
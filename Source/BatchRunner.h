@@ -0,0 +1,132 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "GameCartridge.h"
+#include "LaneCpu.h"
+#include "NES.h"
+#include "PPU.h"
+
+/*
+	Runs many independent consoles on the same cartridge across all cores, for regression runs and agent training.
+
+	Step runs every console a number of frames with its own controller input, then copies the last frame and the CPU
+	RAM of each into two contiguous arrays, console i at i * kFramePixels / i * kRamSize.
+
+	The worker threads stay alive between steps. Each owns a fixed range of consoles, so a console keeps being stepped
+	on the same core and its state stays in that core's cache. A worker that runs out of its own consoles steals from
+	the back of another worker's range, so one slow console (a game stuck in a heavier scene) doesn't hold everyone up.
+*/
+class BatchRunner
+{
+public:
+	static constexpr int kFramePixels = PPU::kScreenWidth * PPU::kScreenHeight;
+	static constexpr int kRamSize = 2 * 1024;
+
+	struct Input
+	{
+		uint8_t firstController = 0x00;
+		uint8_t secondController = 0x00;
+	};
+
+	struct Stats
+	{
+		uint64_t steps = 0;
+		uint64_t frames = 0; // Summed over every console
+		uint64_t steals = 0; // Consoles (or lane groups) run by a worker that doesn't own them
+#if CPU_THREADED_DISPATCH
+		LaneCpu::Stats lanes; // Summed over every worker's LaneCpu
+#endif
+	};
+
+	// threadCount 0 is one per core, the calling thread counts as one of them
+	BatchRunner(const GameCartridge& game, int instanceCount, int threadCount = 0);
+	~BatchRunner();
+
+	// Frames are only drawn when they are captured, the rest of the time the PPU runs headless (see PPU::SetHeadless)
+	void SetFrameCapture(bool enabled) { m_captureFrames = enabled; }
+
+	// Experimental: run the CPUs of LaneCpu::kLanes consoles at a time side by side in a LaneCpu instead of one by one.
+	// Gives the exact same results, GCC / Clang builds only (see CPU_THREADED_DISPATCH).
+	void SetLaneExecution(bool enabled);
+	bool GetLaneExecution() const { return m_laneExecution; }
+
+	// Runs every console frames frames, holding inputs[i] on console i's controllers the whole time.
+	// inputs is either one per console or empty for nothing pressed.
+	void Step(int frames, std::span<const Input> inputs = {});
+
+	int GetInstanceCount() const { return (int)m_instances.size(); }
+	int GetThreadCount() const { return (int)m_workers.size(); }
+	NES& GetInstance(int index) { return *m_instances[index]; }
+
+	// As of the end of the last Step. Frames are PPU pixels, see FrameConverter, and stay as they were with capture off.
+	const uint16_t* GetFrames() const { return m_frames.data(); }
+	const uint8_t* GetRam() const { return m_ram.data(); }
+	const uint16_t* GetFrame(int index) const { return m_frames.data() + (size_t)index * kFramePixels; }
+	const uint8_t* GetRam(int index) const { return m_ram.data() + (size_t)index * kRamSize; }
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	BatchRunner(const BatchRunner&) = delete;
+	BatchRunner& operator=(const BatchRunner&) = delete;
+
+	// Consoles per task with lane execution on, it's never on without LaneCpu
+#if CPU_THREADED_DISPATCH
+	static constexpr int kLaneGroupSize = LaneCpu::kLanes;
+#else
+	static constexpr int kLaneGroupSize = 1;
+#endif
+
+	// A worker's tasks still to run this step, [front, back). The owner takes from the front, thieves the back.
+	// A task is one console, or a lane group of consecutive consoles with lane execution on.
+	struct Worker
+	{
+		std::mutex mutex;
+		int first = 0; // The range it owns
+		int last = 0;
+		int front = 0;
+		int back = 0;
+		uint64_t steals = 0;
+#if CPU_THREADED_DISPATCH
+		LaneCpu laneCpu;
+#endif
+	};
+
+	void WorkerThread(int worker);
+	void RunWorker(int worker);
+	bool TakeOwn(Worker& worker, int& task);
+	bool Steal(int thief, int& task);
+	void RunInstance(int instance);
+	void RunLaneGroup(Worker& worker, int first, int count);
+	void CaptureInstance(int instance);
+
+	std::vector<std::unique_ptr<NES>> m_instances;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads; // Workers 1 and up, Step runs worker 0 itself
+
+	std::vector<uint16_t> m_frames;
+	std::vector<uint8_t> m_ram;
+	bool m_captureFrames = true;
+	bool m_laneExecution = false;
+
+	// The step being run
+	int m_stepFrames = 0;
+	std::span<const Input> m_stepInputs;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	uint64_t m_generation = 0;
+	int m_busyThreads = 0;
+	bool m_quit = false;
+
+	Stats m_stats;
+};
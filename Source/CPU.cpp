@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "CPU.h"
+#include "Dynarec.h"
 #include "NES.h"
 
 CPU::CPU()
@@ -18,7 +19,20 @@ void CPU::Initialize(NES* console)
 	m_NES = console;
 
 	ClearRegisters();
-	BuildOpCodeLookup();
+
+	// Banks get allocated as they're used
+	for (int bank = 0; bank < kDecodeCacheBanks; bank++)
+	{
+		m_decodeCache[bank].reset();
+		m_idleLoopCache[bank].reset();
+	}
+	m_decodeCacheBankUsed.fill(false);
+	m_decodeCacheStats = DecodeCacheStats();
+
+#if CPU_DYNAREC
+	// Blocks translated so far stay valid, they only depend on the ROM
+	m_dynarec = std::make_unique<Dynarec>(m_dynarec ? m_dynarec->GetCodeCache() : nullptr);
+#endif
 }
 
 // http://archive.6502.org/datasheets/rockwell_r650x_r651x.pdf
@@ -26,165 +40,461 @@ void CPU::Initialize(NES* console)
 // https://www.masswerk.at/6502/6502_instruction_set.html
 // https://www.nesdev.org/wiki/Status_flags
 // https://en.wikipedia.org/wiki/MOS_Technology_6502#Bugs_and_quirks
-void CPU::BuildOpCodeLookup()
+/*
+	Reading memory can have side effects, eg if you touch the PPU registers.
+	Only these operations actually use m_instructionData, everything else must not touch memory when decoding.
+*/
+constexpr bool CPU::OperationNeedsData(Mnemonic mnemonic)
+{
+	switch (mnemonic)
+	{
+	case Mnemonic::ORA:
+	case Mnemonic::AND:
+	case Mnemonic::BIT:
+	case Mnemonic::EOR:
+	case Mnemonic::LSR:
+	case Mnemonic::ADC:
+	case Mnemonic::ROR:
+	case Mnemonic::LDY:
+	case Mnemonic::LDX:
+	case Mnemonic::LDA:
+	case Mnemonic::CPY:
+	case Mnemonic::CMP:
+	case Mnemonic::DEC:
+	case Mnemonic::CPX:
+	case Mnemonic::INC:
+	case Mnemonic::SBC:
+	case Mnemonic::ASL:
+	case Mnemonic::ROL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+constexpr CPU::Instruction CPU::MakeInstruction(Mnemonic mnemonic, AddressMode addressMode, int clockCycles, bool pageBoundaryCycle, bool branchPageCycle)
 {
+	uint8_t flags = 0;
+	if (OperationNeedsData(mnemonic)) flags |= kNeedsDataFlag;
+	if (pageBoundaryCycle) flags |= kPageBoundaryCycleFlag;
+	if (branchPageCycle) flags |= kBranchPageCycleFlag;
+
+	return { mnemonic, addressMode, (uint8_t)clockCycles, flags };
+}
+
+constexpr std::array<CPU::Instruction, 256> CPU::BuildOpCodeLookup()
+{
+	std::array<Instruction, 256> lookup = {};
+
 	for (int i = 0; i < 256; i++)
 	{
 		// Unused opcodes. Is this actually zero clock cycles? My guess is no, but ideally no rom is calling this anyways.
-		m_opCodeLookup[i] = { "NUL", nullptr, AddressMode::UNDEFINED, 2, false, false };
+		lookup[i] = MakeInstruction(Mnemonic::NUL, AddressMode::UNDEFINED, 2, false, false);
+	}
+
+	lookup[0] = MakeInstruction(Mnemonic::BRK, AddressMode::Implied, 7, false, false);
+	lookup[1] = MakeInstruction(Mnemonic::ORA, AddressMode::INDX, 6, false, false);
+	lookup[5] = MakeInstruction(Mnemonic::ORA, AddressMode::ZP, 3, false, false);
+	lookup[6] = MakeInstruction(Mnemonic::ASL, AddressMode::ZP, 5, false, false);
+	lookup[8] = MakeInstruction(Mnemonic::PHP, AddressMode::Implied, 3, false, false);
+	lookup[9] = MakeInstruction(Mnemonic::ORA, AddressMode::IMM, 2, false, false);
+	lookup[10] = MakeInstruction(Mnemonic::ASL, AddressMode::Accum, 2, false, false);
+	lookup[13] = MakeInstruction(Mnemonic::ORA, AddressMode::Absolute, 4, false, false);
+	lookup[14] = MakeInstruction(Mnemonic::ASL, AddressMode::Absolute, 6, false, false);
+	lookup[16] = MakeInstruction(Mnemonic::BPL, AddressMode::Relative, 2, true, true);
+	lookup[17] = MakeInstruction(Mnemonic::ORA, AddressMode::INDY, 5, true, false);
+	lookup[21] = MakeInstruction(Mnemonic::ORA, AddressMode::ZPX, 4, false, false);
+	lookup[22] = MakeInstruction(Mnemonic::ASL, AddressMode::ZPX, 6, false, false);
+	lookup[24] = MakeInstruction(Mnemonic::CLC, AddressMode::Implied, 2, false, false);
+	lookup[25] = MakeInstruction(Mnemonic::ORA, AddressMode::ABSY, 3, true, false);
+	lookup[29] = MakeInstruction(Mnemonic::ORA, AddressMode::ABSX, 3, true, false);
+	lookup[30] = MakeInstruction(Mnemonic::ASL, AddressMode::ABSX, 7, false, false);
+	lookup[32] = MakeInstruction(Mnemonic::JSR, AddressMode::Absolute, 6, false, false);
+	lookup[33] = MakeInstruction(Mnemonic::AND, AddressMode::INDX, 6, false, false);
+	lookup[36] = MakeInstruction(Mnemonic::BIT, AddressMode::ZP, 3, false, false);
+	lookup[37] = MakeInstruction(Mnemonic::AND, AddressMode::ZP, 3, false, false);
+	lookup[38] = MakeInstruction(Mnemonic::ROL, AddressMode::ZP, 5, false, false);
+	lookup[40] = MakeInstruction(Mnemonic::PLP, AddressMode::Implied, 4, false, false);
+	lookup[41] = MakeInstruction(Mnemonic::AND, AddressMode::IMM, 4, false, false);
+	lookup[42] = MakeInstruction(Mnemonic::ROL, AddressMode::Accum, 2, false, false);
+	lookup[44] = MakeInstruction(Mnemonic::BIT, AddressMode::Absolute, 4, false, false);
+	lookup[45] = MakeInstruction(Mnemonic::AND, AddressMode::Absolute, 4, false, false);
+	lookup[46] = MakeInstruction(Mnemonic::ROL, AddressMode::Absolute, 6, false, false);
+	lookup[48] = MakeInstruction(Mnemonic::BMI, AddressMode::Relative, 2, true, true);
+	lookup[49] = MakeInstruction(Mnemonic::AND, AddressMode::INDY, 5, true, false);
+	lookup[53] = MakeInstruction(Mnemonic::AND, AddressMode::ZPX, 4, false, false);
+	lookup[54] = MakeInstruction(Mnemonic::ROL, AddressMode::ZPX, 6, false, false);
+	lookup[56] = MakeInstruction(Mnemonic::SEC, AddressMode::Implied, 2, false, false);
+	lookup[57] = MakeInstruction(Mnemonic::AND, AddressMode::ABSY, 4, true, false);
+	lookup[61] = MakeInstruction(Mnemonic::AND, AddressMode::ABSX, 4, true, false);
+	lookup[62] = MakeInstruction(Mnemonic::ROL, AddressMode::ABSX, 7, false, false);
+	lookup[64] = MakeInstruction(Mnemonic::RTI, AddressMode::Implied, 6, false, false);
+	lookup[65] = MakeInstruction(Mnemonic::EOR, AddressMode::INDX, 6, false, false);
+	lookup[69] = MakeInstruction(Mnemonic::EOR, AddressMode::ZP, 3, false, false);
+	lookup[70] = MakeInstruction(Mnemonic::LSR, AddressMode::ZP, 5, false, false);
+	lookup[72] = MakeInstruction(Mnemonic::PHA, AddressMode::Implied, 3, false, false);
+	lookup[73] = MakeInstruction(Mnemonic::EOR, AddressMode::IMM, 2, false, false);
+	lookup[74] = MakeInstruction(Mnemonic::LSR, AddressMode::Accum, 2, false, false);
+	lookup[76] = MakeInstruction(Mnemonic::JMP, AddressMode::Absolute, 3, false, false);
+	lookup[77] = MakeInstruction(Mnemonic::EOR, AddressMode::Absolute, 4, false, false);
+	lookup[78] = MakeInstruction(Mnemonic::LSR, AddressMode::Absolute, 6, false, false);
+	lookup[80] = MakeInstruction(Mnemonic::BVC, AddressMode::Relative, 2, true, true);
+	lookup[81] = MakeInstruction(Mnemonic::EOR, AddressMode::INDY, 5, true, false);
+	lookup[85] = MakeInstruction(Mnemonic::EOR, AddressMode::ZPX, 4, false, false);
+	lookup[86] = MakeInstruction(Mnemonic::LSR, AddressMode::ZPX, 5, false, false);
+	lookup[88] = MakeInstruction(Mnemonic::CLI, AddressMode::Implied, 2, false, false);
+	lookup[89] = MakeInstruction(Mnemonic::EOR, AddressMode::ABSY, 4, true, false);
+	lookup[93] = MakeInstruction(Mnemonic::EOR, AddressMode::ABSX, 4, true, false);
+	lookup[94] = MakeInstruction(Mnemonic::LSR, AddressMode::ABSX, 7, false, false);
+	lookup[96] = MakeInstruction(Mnemonic::RTS, AddressMode::Implied, 6, false, false);
+	lookup[97] = MakeInstruction(Mnemonic::ADC, AddressMode::INDX, 6, false, false);
+	lookup[101] = MakeInstruction(Mnemonic::ADC, AddressMode::ZP, 3, false, false);
+	lookup[102] = MakeInstruction(Mnemonic::ROR, AddressMode::ZP, 5, false, false);
+	lookup[104] = MakeInstruction(Mnemonic::PLA, AddressMode::Implied, 4, false, false);
+	lookup[105] = MakeInstruction(Mnemonic::ADC, AddressMode::IMM, 2, false, false);
+	lookup[106] = MakeInstruction(Mnemonic::ROR, AddressMode::Accum, 2, false, false);
+	lookup[108] = MakeInstruction(Mnemonic::JMP, AddressMode::Indirect, 5, false, false);
+	lookup[109] = MakeInstruction(Mnemonic::ADC, AddressMode::Absolute, 4, false, false);
+	lookup[110] = MakeInstruction(Mnemonic::ROR, AddressMode::Absolute, 6, false, false);
+	lookup[112] = MakeInstruction(Mnemonic::BVS, AddressMode::Relative, 2, true, true);
+	lookup[113] = MakeInstruction(Mnemonic::ADC, AddressMode::INDY, 5, true, true);
+	lookup[117] = MakeInstruction(Mnemonic::ADC, AddressMode::ZPX, 4, false, false);
+	lookup[118] = MakeInstruction(Mnemonic::ROR, AddressMode::ZPX, 6, false, false);
+	lookup[120] = MakeInstruction(Mnemonic::SEI, AddressMode::Implied, 2, false, false);
+	lookup[121] = MakeInstruction(Mnemonic::ADC, AddressMode::ABSY, 4, true, false);
+	lookup[125] = MakeInstruction(Mnemonic::ADC, AddressMode::ABSX, 4, true, false);
+	lookup[126] = MakeInstruction(Mnemonic::ROR, AddressMode::ABSX, 7, false, false);
+	lookup[129] = MakeInstruction(Mnemonic::STA, AddressMode::INDX, 6, false, false);
+	lookup[132] = MakeInstruction(Mnemonic::STY, AddressMode::ZP, 3, false, false);
+	lookup[133] = MakeInstruction(Mnemonic::STA, AddressMode::ZP, 3, false, false);
+	lookup[134] = MakeInstruction(Mnemonic::STX, AddressMode::ZP, 3, false, false);
+	lookup[136] = MakeInstruction(Mnemonic::DEY, AddressMode::Implied, 2, false, false);
+	lookup[138] = MakeInstruction(Mnemonic::TXA, AddressMode::Implied, 2, false, false);
+	lookup[140] = MakeInstruction(Mnemonic::STY, AddressMode::Absolute, 4, false, false);
+	lookup[141] = MakeInstruction(Mnemonic::STA, AddressMode::Absolute, 4, false, false);
+	lookup[142] = MakeInstruction(Mnemonic::STX, AddressMode::Absolute, 4, false, false);
+	lookup[144] = MakeInstruction(Mnemonic::BCC, AddressMode::Relative, 2, true, true);
+	lookup[145] = MakeInstruction(Mnemonic::STA, AddressMode::INDY, 6, false, false);
+	lookup[148] = MakeInstruction(Mnemonic::STY, AddressMode::ZPX, 4, false, false);
+	lookup[149] = MakeInstruction(Mnemonic::STA, AddressMode::ZPX, 4, false, false);
+	lookup[150] = MakeInstruction(Mnemonic::STX, AddressMode::ZPY, 4, false, false);
+	lookup[152] = MakeInstruction(Mnemonic::TYA, AddressMode::Implied, 2, false, false);
+	lookup[153] = MakeInstruction(Mnemonic::STA, AddressMode::ABSY, 5, false, false);
+	lookup[154] = MakeInstruction(Mnemonic::TXS, AddressMode::Implied, 2, false, false);
+	lookup[157] = MakeInstruction(Mnemonic::STA, AddressMode::ABSX, 5, false, false);
+	lookup[160] = MakeInstruction(Mnemonic::LDY, AddressMode::IMM, 2, false, false);
+	lookup[161] = MakeInstruction(Mnemonic::LDA, AddressMode::INDX, 6, false, false);
+	lookup[162] = MakeInstruction(Mnemonic::LDX, AddressMode::IMM, 2, false, false);
+	lookup[164] = MakeInstruction(Mnemonic::LDY, AddressMode::ZP, 3, false, false);
+	lookup[165] = MakeInstruction(Mnemonic::LDA, AddressMode::ZP, 3, false, false);
+	lookup[166] = MakeInstruction(Mnemonic::LDX, AddressMode::ZP, 3, false, false);
+	lookup[168] = MakeInstruction(Mnemonic::TAY, AddressMode::Implied, 2, false, false);
+	lookup[169] = MakeInstruction(Mnemonic::LDA, AddressMode::IMM, 2, false, false);
+	lookup[170] = MakeInstruction(Mnemonic::TAX, AddressMode::Implied, 3, false, false);
+	lookup[172] = MakeInstruction(Mnemonic::LDY, AddressMode::Absolute, 4, false, false);
+	lookup[173] = MakeInstruction(Mnemonic::LDA, AddressMode::Absolute, 4, false, false);
+	lookup[174] = MakeInstruction(Mnemonic::LDX, AddressMode::Absolute, 4, false, false);
+	lookup[176] = MakeInstruction(Mnemonic::BCS, AddressMode::Relative, 2, true, true);
+	lookup[177] = MakeInstruction(Mnemonic::LDA, AddressMode::INDY, 5, true, false);
+	lookup[180] = MakeInstruction(Mnemonic::LDY, AddressMode::ZPX, 4, false, false);
+	lookup[181] = MakeInstruction(Mnemonic::LDA, AddressMode::ZPX, 4, false, false);
+	lookup[182] = MakeInstruction(Mnemonic::LDX, AddressMode::ZPY, 4, false, false);
+	lookup[184] = MakeInstruction(Mnemonic::CLV, AddressMode::Implied, 2, false, false);
+	lookup[185] = MakeInstruction(Mnemonic::LDA, AddressMode::ABSY, 4, true, false);
+	lookup[186] = MakeInstruction(Mnemonic::TSX, AddressMode::Implied, 2, false, false);
+	lookup[188] = MakeInstruction(Mnemonic::LDY, AddressMode::ABSX, 4, true, false);
+	lookup[189] = MakeInstruction(Mnemonic::LDA, AddressMode::ABSX, 4, true, false);
+	lookup[190] = MakeInstruction(Mnemonic::LDX, AddressMode::ABSY, 4, true, false);
+	lookup[192] = MakeInstruction(Mnemonic::CPY, AddressMode::IMM, 2, false, false);
+	lookup[193] = MakeInstruction(Mnemonic::CMP, AddressMode::INDX, 6, false, false);
+	lookup[196] = MakeInstruction(Mnemonic::CPY, AddressMode::ZP, 3, false, false);
+	lookup[197] = MakeInstruction(Mnemonic::CMP, AddressMode::ZP, 3, false, false);
+	lookup[198] = MakeInstruction(Mnemonic::DEC, AddressMode::ZP, 5, false, false);
+	lookup[200] = MakeInstruction(Mnemonic::INY, AddressMode::Implied, 2, false, false);
+	lookup[201] = MakeInstruction(Mnemonic::CMP, AddressMode::IMM, 2, false, false);
+	lookup[202] = MakeInstruction(Mnemonic::DEX, AddressMode::Implied, 2, false, false);
+	lookup[204] = MakeInstruction(Mnemonic::CPY, AddressMode::Absolute, 4, false, false);
+	lookup[205] = MakeInstruction(Mnemonic::CMP, AddressMode::Absolute, 4, false, false);
+	lookup[206] = MakeInstruction(Mnemonic::DEC, AddressMode::Absolute, 6, false, false);
+	lookup[208] = MakeInstruction(Mnemonic::BNE, AddressMode::Relative, 2, true, true);
+	lookup[209] = MakeInstruction(Mnemonic::CMP, AddressMode::INDY, 5, true, false);
+	lookup[213] = MakeInstruction(Mnemonic::CMP, AddressMode::ZPX, 4, false, false);
+	lookup[214] = MakeInstruction(Mnemonic::DEC, AddressMode::ZPX, 6, false, false);
+	lookup[216] = MakeInstruction(Mnemonic::CLD, AddressMode::Implied, 2, false, false);
+	lookup[217] = MakeInstruction(Mnemonic::CMP, AddressMode::ABSY, 4, true, false);
+	lookup[221] = MakeInstruction(Mnemonic::CMP, AddressMode::ABSX, 4, true, false);
+	lookup[222] = MakeInstruction(Mnemonic::DEC, AddressMode::ABSX, 7, true, false);
+	lookup[224] = MakeInstruction(Mnemonic::CPX, AddressMode::IMM, 2, false, false);
+	lookup[225] = MakeInstruction(Mnemonic::SBC, AddressMode::INDX, 6, false, false);
+	lookup[228] = MakeInstruction(Mnemonic::CPX, AddressMode::ZP, 3, false, false);
+	lookup[229] = MakeInstruction(Mnemonic::SBC, AddressMode::ZP, 3, false, false);
+	lookup[230] = MakeInstruction(Mnemonic::INC, AddressMode::ZP, 5, false, false);
+	lookup[232] = MakeInstruction(Mnemonic::INX, AddressMode::Implied, 2, false, false);
+	lookup[233] = MakeInstruction(Mnemonic::SBC, AddressMode::IMM, 2, false, false);
+	lookup[234] = MakeInstruction(Mnemonic::NOP, AddressMode::Implied, 2, false, false);
+	lookup[236] = MakeInstruction(Mnemonic::CPX, AddressMode::Absolute, 4, false, false);
+	lookup[237] = MakeInstruction(Mnemonic::SBC, AddressMode::Absolute, 4, false, false);
+	lookup[238] = MakeInstruction(Mnemonic::INC, AddressMode::Absolute, 6, false, false);
+	lookup[240] = MakeInstruction(Mnemonic::BEQ, AddressMode::Relative, 4, true, true);
+	lookup[241] = MakeInstruction(Mnemonic::SBC, AddressMode::INDY, 5, true, false);
+	lookup[245] = MakeInstruction(Mnemonic::SBC, AddressMode::ZPX, 4, false, false);
+	lookup[246] = MakeInstruction(Mnemonic::INC, AddressMode::ZPX, 6, false, false);
+	lookup[248] = MakeInstruction(Mnemonic::SED, AddressMode::Implied, 4, false, false);
+	lookup[249] = MakeInstruction(Mnemonic::SBC, AddressMode::ABSY, 4, true, false);
+	lookup[253] = MakeInstruction(Mnemonic::SBC, AddressMode::ABSX, 4, true, false);
+	lookup[254] = MakeInstruction(Mnemonic::INC, AddressMode::ABSX, 7, false, false);
+
+	return lookup;
+}
+
+// Built entirely at compile time, the hot path only ever indexes into it
+constexpr std::array<CPU::Instruction, 256> CPU::s_opCodeLookup = CPU::BuildOpCodeLookup();
+
+// Indexed by Mnemonic, must stay in the same order as the enum
+constexpr std::array<CPU::OpFunction, (size_t)CPU::Mnemonic::Count> CPU::s_opFunctions =
+{
+	nullptr,
+	&CPU::ADC, &CPU::AND, &CPU::ASL, &CPU::BCC, &CPU::BCS, &CPU::BEQ, &CPU::BIT, &CPU::BMI,
+	&CPU::BNE, &CPU::BPL, &CPU::BRK, &CPU::BVC, &CPU::BVS, &CPU::CLC, &CPU::CLD, &CPU::CLI,
+	&CPU::CLV, &CPU::CMP, &CPU::CPX, &CPU::CPY, &CPU::DEC, &CPU::DEX, &CPU::DEY, &CPU::EOR,
+	&CPU::INC, &CPU::INX, &CPU::INY, &CPU::JMP, &CPU::JSR, &CPU::LDA, &CPU::LDX, &CPU::LDY,
+	&CPU::LSR, &CPU::NOP, &CPU::ORA, &CPU::PHA, &CPU::PHP, &CPU::PLA, &CPU::PLP, &CPU::ROL,
+	&CPU::ROR, &CPU::RTI, &CPU::RTS, &CPU::SBC, &CPU::SEC, &CPU::SED, &CPU::SEI, &CPU::STA,
+	&CPU::STX, &CPU::STY, &CPU::TAX, &CPU::TAY, &CPU::TSX, &CPU::TXA, &CPU::TXS, &CPU::TYA
+};
+
+// Debug only, the emulation never looks at these. Used by the disassembler
+const std::array<const char*, (size_t)CPU::Mnemonic::Count> CPU::s_mnemonicNames =
+{
+	"NUL",
+	"ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI",
+	"BNE", "BPL", "BRK", "BVC", "BVS", "CLC", "CLD", "CLI",
+	"CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR",
+	"INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX", "LDY",
+	"LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL",
+	"ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA",
+	"STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA"
+};
+
+// Reads the op code and however many operand bytes its address mode uses, the same reads EvaluatePC used to do
+void CPU::DecodeInto(uint16_t address, DecodedInstruction& decoded)
+{
+	uint8_t opCode = m_NES->ReadCpuMemory(address);
+	const Instruction instruction = s_opCodeLookup[opCode];
+
+	uint8_t operandBytes = 0;
+	switch (instruction.addressMode)
+	{
+	case AddressMode::IMM:
+		operandBytes = instruction.NeedsData() ? 1 : 0;
+		break;
+	case AddressMode::ZP:
+	case AddressMode::ZPX:
+	case AddressMode::ZPY:
+	case AddressMode::Relative:
+	case AddressMode::INDX:
+	case AddressMode::INDY:
+		operandBytes = 1;
+		break;
+	case AddressMode::Absolute:
+	case AddressMode::ABSX:
+	case AddressMode::ABSY:
+	case AddressMode::Indirect:
+		operandBytes = 2;
+		break;
+	default:
+		break;
 	}
 
-	m_opCodeLookup[0] = { "BRK", &CPU::BRK, AddressMode::Implied, 7, false, false };
-	m_opCodeLookup[1] = { "ORA", &CPU::ORA, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[5] = { "ORA", &CPU::ORA, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[6] = { "ASL", &CPU::ASL, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[8] = { "PHP", &CPU::PHP, AddressMode::Implied, 3, false, false };
-	m_opCodeLookup[9] = { "ORA", &CPU::ORA, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[10] = { "ASL", &CPU::ASL, AddressMode::Accum, 2, false, false };
-	m_opCodeLookup[13] = { "ORA", &CPU::ORA, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[14] = { "ASL", &CPU::ASL, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[16] = { "BPL", &CPU::BPL, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[17] = { "ORA", &CPU::ORA, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[21] = { "ORA", &CPU::ORA, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[22] = { "ASL", &CPU::ASL, AddressMode::ZPX, 6, false, false };
-	m_opCodeLookup[24] = { "CLC", &CPU::CLC, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[25] = { "ORA", &CPU::ORA, AddressMode::ABSY, 3, true, false };
-	m_opCodeLookup[29] = { "ORA", &CPU::ORA, AddressMode::ABSX, 3, true, false };
-	m_opCodeLookup[30] = { "ASL", &CPU::ASL, AddressMode::ABSX, 7, false, false };
-	m_opCodeLookup[32] = { "JSR", &CPU::JSR, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[33] = { "AND", &CPU::AND, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[36] = { "BIT", &CPU::BIT, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[37] = { "AND", &CPU::AND, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[38] = { "ROL", &CPU::ROL, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[40] = { "PLP", &CPU::PLP, AddressMode::Implied, 4, false, false };
-	m_opCodeLookup[41] = { "AND", &CPU::AND, AddressMode::IMM, 4, false, false };
-	m_opCodeLookup[42] = { "ROL", &CPU::ROL, AddressMode::Accum, 2, false, false };
-	m_opCodeLookup[44] = { "BIT", &CPU::BIT, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[45] = { "AND", &CPU::AND, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[46] = { "ROL", &CPU::ROL, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[48] = { "BMI", &CPU::BMI, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[49] = { "AND", &CPU::AND, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[53] = { "AND", &CPU::AND, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[54] = { "ROL", &CPU::ROL, AddressMode::ZPX, 6, false, false };
-	m_opCodeLookup[56] = { "SEC", &CPU::SEC, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[57] = { "AND", &CPU::AND, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[61] = { "AND", &CPU::AND, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[62] = { "ROL", &CPU::ROL, AddressMode::ABSX, 7, false, false };
-	m_opCodeLookup[64] = { "RTI", &CPU::RTI, AddressMode::Implied, 6, false, false };
-	m_opCodeLookup[65] = { "EOR", &CPU::EOR, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[69] = { "EOR", &CPU::EOR, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[70] = { "LSR", &CPU::LSR, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[72] = { "PHA", &CPU::PHA, AddressMode::Implied, 3, false, false };
-	m_opCodeLookup[73] = { "EOR", &CPU::EOR, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[74] = { "LSR", &CPU::LSR, AddressMode::Accum, 2, false, false };
-	m_opCodeLookup[76] = { "JMP", &CPU::JMP, AddressMode::Absolute, 3, false, false };
-	m_opCodeLookup[77] = { "EOR", &CPU::EOR, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[78] = { "LSR", &CPU::LSR, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[80] = { "BVC", &CPU::BVC, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[81] = { "EOR", &CPU::EOR, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[85] = { "EOR", &CPU::EOR, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[86] = { "LSR", &CPU::LSR, AddressMode::ZPX, 5, false, false };
-	m_opCodeLookup[88] = { "CLI", &CPU::CLI, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[89] = { "EOR", &CPU::EOR, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[93] = { "EOR", &CPU::EOR, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[94] = { "LSR", &CPU::LSR, AddressMode::ABSX, 7, false, false };
-	m_opCodeLookup[96] = { "RTS", &CPU::RTS, AddressMode::Implied, 6, false, false };
-	m_opCodeLookup[97] = { "ADC", &CPU::ADC, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[101] = { "ADC", &CPU::ADC, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[102] = { "ROR", &CPU::ROR, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[104] = { "PLA", &CPU::PLA, AddressMode::Implied, 4, false, false };
-	m_opCodeLookup[105] = { "ADC", &CPU::ADC, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[106] = { "ROR", &CPU::ROR, AddressMode::Accum, 2, false, false };
-	m_opCodeLookup[108] = { "JMP", &CPU::JMP, AddressMode::Indirect, 5, false, false };
-	m_opCodeLookup[109] = { "ADC", &CPU::ADC, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[110] = { "ROR", &CPU::ROR, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[112] = { "BVS", &CPU::BVS, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[113] = { "ADC", &CPU::ADC, AddressMode::INDY, 5, true, true };
-	m_opCodeLookup[117] = { "ADC", &CPU::ADC, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[118] = { "ROR", &CPU::ROR, AddressMode::ZPX, 6, false, false };
-	m_opCodeLookup[120] = { "SEI", &CPU::SEI, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[121] = { "ADC", &CPU::ADC, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[125] = { "ADC", &CPU::ADC, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[126] = { "ROR", &CPU::ROR, AddressMode::ABSX, 7, false, false };
-	m_opCodeLookup[129] = { "STA", &CPU::STA, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[132] = { "STY", &CPU::STY, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[133] = { "STA", &CPU::STA, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[134] = { "STX", &CPU::STX, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[136] = { "DEY", &CPU::DEY, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[138] = { "TXA", &CPU::TXA, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[140] = { "STY", &CPU::STY, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[141] = { "STA", &CPU::STA, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[142] = { "STX", &CPU::STX, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[144] = { "BCC", &CPU::BCC, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[145] = { "STA", &CPU::STA, AddressMode::INDY, 6, false, false };
-	m_opCodeLookup[148] = { "STY", &CPU::STY, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[149] = { "STA", &CPU::STA, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[150] = { "STX", &CPU::STX, AddressMode::ZPY, 4, false, false };
-	m_opCodeLookup[152] = { "TYA", &CPU::TYA, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[153] = { "STA", &CPU::STA, AddressMode::ABSY, 5, false, false };
-	m_opCodeLookup[154] = { "TXS", &CPU::TXS, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[157] = { "STA", &CPU::STA, AddressMode::ABSX, 5, false, false };
-	m_opCodeLookup[160] = { "LDY", &CPU::LDY, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[161] = { "LDA", &CPU::LDA, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[162] = { "LDX", &CPU::LDX, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[164] = { "LDY", &CPU::LDY, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[165] = { "LDA", &CPU::LDA, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[166] = { "LDX", &CPU::LDX, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[168] = { "TAY", &CPU::TAY, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[169] = { "LDA", &CPU::LDA, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[170] = { "TAX", &CPU::TAX, AddressMode::Implied, 3, false, false };
-	m_opCodeLookup[172] = { "LDY", &CPU::LDY, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[173] = { "LDA", &CPU::LDA, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[174] = { "LDX", &CPU::LDX, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[176] = { "BCS", &CPU::BCS, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[177] = { "LDA", &CPU::LDA, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[180] = { "LDY", &CPU::LDY, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[181] = { "LDA", &CPU::LDA, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[182] = { "LDX", &CPU::LDX, AddressMode::ZPY, 4, false, false };
-	m_opCodeLookup[184] = { "CLV", &CPU::CLV, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[185] = { "LDA", &CPU::LDA, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[186] = { "TSX", &CPU::TSX, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[188] = { "LDY", &CPU::LDY, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[189] = { "LDA", &CPU::LDA, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[190] = { "LDX", &CPU::LDX, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[192] = { "CPY", &CPU::CPY, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[193] = { "CMP", &CPU::CMP, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[196] = { "CPY", &CPU::CPY, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[197] = { "CMP", &CPU::CMP, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[198] = { "DEC", &CPU::DEC, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[200] = { "INY", &CPU::INY, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[201] = { "CMP", &CPU::CMP, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[202] = { "DEX", &CPU::DEX, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[204] = { "CPY", &CPU::CPY, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[205] = { "CMP", &CPU::CMP, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[206] = { "DEC", &CPU::DEC, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[208] = { "BNE", &CPU::BNE, AddressMode::Relative, 2, true, true };
-	m_opCodeLookup[209] = { "CMP", &CPU::CMP, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[213] = { "CMP", &CPU::CMP, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[214] = { "DEC", &CPU::DEC, AddressMode::ZPX, 6, false, false };
-	m_opCodeLookup[216] = { "CLD", &CPU::CLD, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[217] = { "CMP", &CPU::CMP, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[221] = { "CMP", &CPU::CMP, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[222] = { "DEC", &CPU::DEC, AddressMode::ABSX, 7, true, false };
-	m_opCodeLookup[224] = { "CPX", &CPU::CPX, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[225] = { "SBC", &CPU::SBC, AddressMode::INDX, 6, false, false };
-	m_opCodeLookup[228] = { "CPX", &CPU::CPX, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[229] = { "SBC", &CPU::SBC, AddressMode::ZP, 3, false, false };
-	m_opCodeLookup[230] = { "INC", &CPU::INC, AddressMode::ZP, 5, false, false };
-	m_opCodeLookup[232] = { "INX", &CPU::INX, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[233] = { "SBC", &CPU::SBC, AddressMode::IMM, 2, false, false };
-	m_opCodeLookup[234] = { "NOP", &CPU::NOP, AddressMode::Implied, 2, false, false };
-	m_opCodeLookup[236] = { "CPX", &CPU::CPX, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[237] = { "SBC", &CPU::SBC, AddressMode::Absolute, 4, false, false };
-	m_opCodeLookup[238] = { "INC", &CPU::INC, AddressMode::Absolute, 6, false, false };
-	m_opCodeLookup[240] = { "BEQ", &CPU::BEQ, AddressMode::Relative, 4, true, true };
-	m_opCodeLookup[241] = { "SBC", &CPU::SBC, AddressMode::INDY, 5, true, false };
-	m_opCodeLookup[245] = { "SBC", &CPU::SBC, AddressMode::ZPX, 4, false, false };
-	m_opCodeLookup[246] = { "INC", &CPU::INC, AddressMode::ZPX, 6, false, false };
-	m_opCodeLookup[248] = { "SED", &CPU::SED, AddressMode::Implied, 4, false, false };
-	m_opCodeLookup[249] = { "SBC", &CPU::SBC, AddressMode::ABSY, 4, true, false };
-	m_opCodeLookup[253] = { "SBC", &CPU::SBC, AddressMode::ABSX, 4, true, false };
-	m_opCodeLookup[254] = { "INC", &CPU::INC, AddressMode::ABSX, 7, false, false };
+	decoded.instruction = instruction;
+	decoded.opCode = opCode;
+	decoded.operandLow = operandBytes > 0 ? m_NES->ReadCpuMemory(address + 1) : 0x00;
+	decoded.operandHigh = operandBytes > 1 ? m_NES->ReadCpuMemory(address + 2) : 0x00;
+	decoded.length = 1 + operandBytes;
+}
+
+const CPU::DecodedInstruction& CPU::DecodeInstruction(uint16_t address)
+{
+	// PRG ROM doesn't change under us (until a bank switch), so decode each address once.
+	// Stop short of $FFFF so operands never wrap around into RAM.
+	if (address >= kDecodeCacheStart && address <= 0xFFFD)
+	{
+		int bank = (address - kDecodeCacheStart) / kDecodeCacheBankSize;
+		if (!m_decodeCache[bank])
+		{
+			m_decodeCache[bank].reset(new DecodedInstruction[kDecodeCacheBankSize]());
+		}
+
+		DecodedInstruction& cached = m_decodeCache[bank][address % kDecodeCacheBankSize];
+		if (cached.length != 0)
+		{
+			m_decodeCacheStats.hits++;
+			return cached;
+		}
+
+		m_decodeCacheStats.misses++;
+		m_decodeCacheBankUsed[bank] = true;
+		DecodeInto(address, cached);
+		return cached;
+	}
+
+	// Running out of RAM (or somewhere else that can change), always decode
+	m_decodeCacheStats.uncached++;
+	DecodeInto(address, m_uncachedInstruction);
+	return m_uncachedInstruction;
+}
+
+void CPU::InvalidateDecodeCache(uint16_t address)
+{
+	if (address < kDecodeCacheStart)
+		return;
+
+#if CPU_DYNAREC
+	if (m_dynarec) m_dynarec->Invalidate(address);
+#endif
+
+	// The bank keeps its memory, whatever gets switched in next most likely runs from here too
+	int bank = (address - kDecodeCacheStart) / kDecodeCacheBankSize;
+	if (m_decodeCacheBankUsed[bank])
+	{
+		std::fill_n(m_decodeCache[bank].get(), kDecodeCacheBankSize, DecodedInstruction());
+		m_decodeCacheBankUsed[bank] = false;
+
+		// Idle loops are only ever analyzed through the decode cache so they can't be stale in an unused bank
+		if (m_idleLoopCache[bank]) m_idleLoopCache[bank]->analyzed.reset();
+		m_decodeCacheStats.invalidations++;
+	}
+
+	// The last couple instructions of the previous bank can have their operands in this one
+	if (bank > 0 && m_decodeCache[bank - 1])
+	{
+		m_decodeCache[bank - 1][kDecodeCacheBankSize - 1] = DecodedInstruction();
+		m_decodeCache[bank - 1][kDecodeCacheBankSize - 2] = DecodedInstruction();
+	}
+
+	// Same for idle loops running into this bank
+	if (bank > 0 && m_idleLoopCache[bank - 1])
+	{
+		for (int i = 1; i <= kMaxIdleLoopInstructions * 3; i++)
+		{
+			m_idleLoopCache[bank - 1]->analyzed[kDecodeCacheBankSize - i] = false;
+		}
+	}
+}
+
+size_t CPU::GetCacheMemoryUsage()
+{
+	size_t usage = 0;
+	for (int bank = 0; bank < kDecodeCacheBanks; bank++)
+	{
+		if (m_decodeCache[bank]) usage += kDecodeCacheBankSize * sizeof(DecodedInstruction);
+		if (m_idleLoopCache[bank]) usage += sizeof(IdleLoopBank);
+	}
+	return usage;
+}
+
+CPU::IdleLoop CPU::GetIdleLoopAtPC()
+{
+	if (m_PC < kDecodeCacheStart)
+		return IdleLoop();
+
+	int bank = (m_PC - kDecodeCacheStart) / kDecodeCacheBankSize;
+	if (!m_idleLoopCache[bank])
+	{
+		m_idleLoopCache[bank].reset(new IdleLoopBank());
+	}
+
+	IdleLoopBank& loops = *m_idleLoopCache[bank];
+	int index = m_PC % kDecodeCacheBankSize;
+	if (!loops.analyzed[index])
+	{
+		loops.loops[index] = AnalyzeIdleLoop(m_PC);
+		loops.analyzed[index] = true;
+	}
+
+	return loops.loops[index];
+}
+
+CPU::IdleLoop CPU::AnalyzeIdleLoop(uint16_t address)
+{
+	// Reading these can't change anything, $2002 only clears flags that are already clear while we spin
+	auto isQuietRead = [](uint16_t readAddress)
+	{
+		return !IsIoAddress(readAddress) || (readAddress < 0x4000 && (readAddress & 0x0007) == 0x0002);
+	};
+
+	uint16_t pc = address;
+	int cycles = 0;
+
+	for (int i = 0; i < kMaxIdleLoopInstructions; i++)
+	{
+		if (pc < kDecodeCacheStart)
+			break;
+
+		const DecodedInstruction decoded = DecodeInstruction(pc);
+		const Instruction instruction = decoded.instruction;
+		const uint16_t ogPc = pc;
+		const uint16_t operand = (decoded.operandHigh << 8) | decoded.operandLow;
+		pc += decoded.length;
+
+		cycles += instruction.clockCycles;
+
+		switch (instruction.mnemonic)
+		{
+		case Mnemonic::LDA: case Mnemonic::LDX: case Mnemonic::LDY:
+		case Mnemonic::CMP: case Mnemonic::CPX: case Mnemonic::CPY:
+		case Mnemonic::BIT: case Mnemonic::NOP:
+			// Loads and compares only, every pass overwrites the same registers / flags from the same memory
+			switch (instruction.addressMode)
+			{
+			case AddressMode::Implied:
+			case AddressMode::IMM:
+			case AddressMode::ZP:
+			case AddressMode::ZPX:
+			case AddressMode::ZPY:
+				break;
+			case AddressMode::Absolute:
+				if (!isQuietRead(operand)) return IdleLoop();
+				break;
+			case AddressMode::ABSX:
+			case AddressMode::ABSY:
+				for (int offset = 0; offset < 256; offset++)
+				{
+					if (!isQuietRead((uint16_t)(operand + offset))) return IdleLoop();
+				}
+				// (address && 0xFF00) >> 8 is always 0, see EvaluatePC
+				if (instruction.HasPageBoundaryCycle() && decoded.operandHigh != 0) cycles += 1;
+				break;
+			default:
+				return IdleLoop();
+			}
+			break;
+		case Mnemonic::JMP:
+			if (instruction.addressMode != AddressMode::Absolute || operand != address)
+				return IdleLoop();
+			return { (uint8_t)cycles, (uint8_t)(i + 1) };
+		case Mnemonic::BCC: case Mnemonic::BCS: case Mnemonic::BEQ: case Mnemonic::BNE:
+		case Mnemonic::BMI: case Mnemonic::BPL: case Mnemonic::BVC: case Mnemonic::BVS:
+		{
+			uint16_t branchLocation = pc + (int8_t)decoded.operandLow;
+			if (branchLocation != address)
+				return IdleLoop();
+
+			// Taken branch, same rules as EvaluatePC
+			cycles += OnSamePage(pc, branchLocation) ? 1 : 2;
+			if (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle())
+			{
+				cycles += 1;
+				if (!AreAddrsOnSamePage(ogPc, branchLocation)) cycles += 1;
+			}
+			return { (uint8_t)cycles, (uint8_t)(i + 1) };
+		}
+		default:
+			return IdleLoop();
+		}
+	}
+
+	return IdleLoop();
 }
 
 bool CPU::OnSamePage(uint16_t addr1, uint16_t addr2)
@@ -233,12 +543,12 @@ void CPU::DoInterrupt(uint16_t lo, uint16_t high)
 	m_NES->WriteCpuMemory(m_StackLocation + m_SP, pcLow);
 	m_SP--;
 
-	// Push status register to stack
+	// Push status register to stack, with the I flag as it was so RTI lets the next IRQ through
 	SetUnusedFlag(true);
-	SetIRQFlag(true);
 	SetBrkCommandFlag(false);
 	m_NES->WriteCpuMemory(m_StackLocation + m_SP, m_Status);
 	m_SP--;
+	SetIRQFlag(true);
 
 	// Get address to set program counter to
 	uint16_t newPcLo = m_NES->ReadCpuMemory(lo);
@@ -270,52 +580,45 @@ void CPU::Cycle()
 	}
 	else
 	{
+		m_instructionCount++;
 		EvaluatePC();
+
+		m_clockCycles += m_stallCycles;
+		m_stallCycles = 0;
 	}
 
 	m_clockCycles -= 1;
 }
 
-bool CPU::DoesInstructionNeedData(Instruction instruction)
-{
-	if (instruction.name.compare("ORA") == 0) return true;
-	if (instruction.name.compare("ASC") == 0) return true;
-	if (instruction.name.compare("AND") == 0) return true;
-	if (instruction.name.compare("BIT") == 0) return true;
-	if (instruction.name.compare("ROC") == 0) return true;
-	if (instruction.name.compare("EOR") == 0) return true;
-	if (instruction.name.compare("LSR") == 0) return true;
-	if (instruction.name.compare("ADC") == 0) return true;
-	if (instruction.name.compare("ROR") == 0) return true;
-	if (instruction.name.compare("LDY") == 0) return true;
-	if (instruction.name.compare("LDX") == 0) return true;
-	if (instruction.name.compare("LDA") == 0) return true;
-	if (instruction.name.compare("CPY") == 0) return true;
-	if (instruction.name.compare("CMP") == 0) return true;
-	if (instruction.name.compare("DEC") == 0) return true;
-	if (instruction.name.compare("CPX") == 0) return true;
-	if (instruction.name.compare("INC") == 0) return true;
-	if (instruction.name.compare("SBC") == 0) return true;
-	if (instruction.name.compare("ASL") == 0) return true;
-	if (instruction.name.compare("ROL") == 0) return true;
-	return false;
+int CPU::Step()
+{
+	m_instructionCount++;
+	EvaluatePC();
+
+	int cycles = m_clockCycles;
+	m_clockCycles = m_stallCycles;
+	m_stallCycles = 0;
+	return cycles;
 }
+
 void CPU::EvaluatePC()
 {
+#if CPU_TEMPLATE_DISPATCH
+	const DecodedInstruction& decoded = DecodeInstruction(m_PC);
+	(this->*(s_execLookup[decoded.opCode]))(decoded);
+#else
 	uint16_t ogPc = m_PC;
-	uint8_t operation = m_NES->ReadCpuMemory(m_PC++);
-	Instruction instruction = m_opCodeLookup[operation];
+	const DecodedInstruction& decoded = DecodeInstruction(m_PC);
+	const Instruction instruction = decoded.instruction;
+	m_PC += decoded.length;
 
 	m_instructionData = 0x00;
 	m_instructionAddress = 0x00;
 	m_branchLocation = 0x0000;
 	m_clockCycles += instruction.clockCycles;
 
-	/*
-		Reading memory can have side effects, eg if you touch the PPU registers
-		Check if our instruction actually needs to use the m_instructionData value, otherwise don't touch memory.
-	*/
-	bool needsInstructionData = DoesInstructionNeedData(instruction);
+	// Precomputed in the lookup, see CPU::OperationNeedsData
+	bool needsInstructionData = instruction.NeedsData();
 
 	bool pageBoundaryCrossed = false;
 
@@ -333,20 +636,20 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::IMM:
 		// Immediate, the data is just the next byte in the program
-		m_instructionAddress = m_PC;
-		if (needsInstructionData) m_instructionData = m_NES->ReadCpuMemory(m_PC++);
+		m_instructionAddress = ogPc + 1;
+		if (needsInstructionData) m_instructionData = decoded.operandLow;
 		break;
 	case AddressMode::Absolute:
 		// Absolute, next two bytes specify a 16 memory address (so anywhere in the memory), its in little endian though
-		low = m_NES->ReadCpuMemory(m_PC++);
-		high = m_NES->ReadCpuMemory(m_PC++);
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
 		address = ((high << 8) | (uint16_t)low);
 		m_instructionAddress = address;
 		if (needsInstructionData) m_instructionData = m_NES->ReadCpuMemory(address);
 		break;
 	case AddressMode::ZP:
 		// Zero page, memory is on the zero page. The next byte is the 8 least significant bits
-		low = m_NES->ReadCpuMemory(m_PC++);
+		low = decoded.operandLow;
 		high = 0;
 		address = ((high << 8) | (uint16_t)low);
 		m_instructionAddress = address;
@@ -354,7 +657,7 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::ZPX:
 		// Same as zero page but offset by the value in the x register
-		low = m_NES->ReadCpuMemory(m_PC++) + m_RegX;
+		low = decoded.operandLow + m_RegX;
 		high = 0;
 		address = ((high << 8) | (uint16_t)low);
 		m_instructionAddress = address;
@@ -362,7 +665,7 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::ZPY:
 		// Same as zero page but offset by the value in the y register
-		low = m_NES->ReadCpuMemory(m_PC++) + m_RegY;
+		low = decoded.operandLow + m_RegY;
 		high = 0;
 		address = ((high << 8) | (uint16_t)low);
 		m_instructionAddress = address;
@@ -370,8 +673,8 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::ABSX:
 		// Same as absolute but offset by the value in the x register
-		low = m_NES->ReadCpuMemory(m_PC++);
-		high = m_NES->ReadCpuMemory(m_PC++);
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
 		address = ((high << 8) | (uint16_t)low) + m_RegX;
 		if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
 		m_instructionAddress = address;
@@ -379,8 +682,8 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::ABSY:
 		// Same as absolute but offset by the value in the y register
-		low = m_NES->ReadCpuMemory(m_PC++);
-		high = m_NES->ReadCpuMemory(m_PC++);
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
 		address = ((high << 8) | (uint16_t)low) + m_RegY;
 		m_instructionAddress = address;
 		if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
@@ -391,7 +694,7 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::Relative:
 		// The next byte is an offset to the program counter, which specifies a destination for the next instruction
-		offset = m_NES->ReadCpuMemory(m_PC++);
+		offset = decoded.operandLow;
 
 		// offset is a signed value in this case
 		signedOffset = (int8_t)offset;
@@ -403,7 +706,7 @@ void CPU::EvaluatePC()
 		// that address on the zero page contains two bytes that specify the absolute address of the data we are looking for
 
 		// This may also overflow, where the first part of the address is read at FF and the second part at 00
-		offset = m_NES->ReadCpuMemory(m_PC++);
+		offset = decoded.operandLow;
 		address = (offset + m_RegX) & 0x00FF;
 		low = m_NES->ReadCpuMemory(address);
 		address = (address + 1) & 0x00FF;
@@ -416,7 +719,7 @@ void CPU::EvaluatePC()
 		// Indirect indexed, the next byte is a zero page address which contains a 16 bit address, with the y register added to that address
 		
 		// Like indirect X, the zero page address may overflow and wrap around
-		zeroPageAddress = ((uint16_t)m_NES->ReadCpuMemory(m_PC++) & 0x00FF);
+		zeroPageAddress = ((uint16_t)decoded.operandLow & 0x00FF);
 		low = m_NES->ReadCpuMemory(zeroPageAddress);
 		zeroPageAddress = (zeroPageAddress + 1) & 0x00FF;
 		high = m_NES->ReadCpuMemory(zeroPageAddress);
@@ -427,8 +730,8 @@ void CPU::EvaluatePC()
 		break;
 	case AddressMode::Indirect:
 		// The next two bytes are a memory address to another memory address (like a pointer I guess), that address is where the program counter will jump to
-		low = m_NES->ReadCpuMemory(m_PC++);
-		high = m_NES->ReadCpuMemory(m_PC++);
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
 		address = ((high << 8) | (uint16_t)low);
 		if (low == 0xFF)
 		{
@@ -447,12 +750,12 @@ void CPU::EvaluatePC()
 	}
 
 	// Got the data! Run the instruction
-	(this->*(instruction.opCode))(instruction);
+	(this->*(s_opFunctions[(size_t)instruction.mnemonic]))(instruction);
 
 	// Add variable clock cycles
 	bool branched = (m_PC == m_branchLocation);
 
-	if (instruction.pageBoundaryCycle && instruction.branchPageCycle)
+	if (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle())
 	{
 		if (branched)
 		{
@@ -461,12 +764,565 @@ void CPU::EvaluatePC()
 		}
 	}
 
-	if (instruction.pageBoundaryCycle && !instruction.branchPageCycle)
+	if (instruction.HasPageBoundaryCycle() && !instruction.HasBranchPageCycle())
 	{
 		if (pageBoundaryCrossed) m_clockCycles += 1;
 	}
+#endif
+}
+
+#if CPU_TEMPLATE_DISPATCH
+/*
+	Same behaviour as the address mode switch in CPU::EvaluatePC, but the mode is known at compile time so only
+	one case survives per opcode. Returns true if a page boundary was crossed.
+*/
+template<CPU::AddressMode Mode, bool NeedsData>
+inline bool CPU::FetchOperand(const DecodedInstruction& decoded, uint16_t ogPc)
+{
+	bool pageBoundaryCrossed = false;
+
+	uint8_t low, high, offset;
+	uint16_t address, zeroPageAddress, newAddress, newAddressLow, newAddressHigh;
+
+	if constexpr (Mode == AddressMode::Accum)
+	{
+		m_instructionData = m_RegA;
+		m_instructionAddress = UINT16_MAX;
+	}
+	else if constexpr (Mode == AddressMode::IMM)
+	{
+		m_instructionAddress = ogPc + 1;
+		if constexpr (NeedsData) m_instructionData = decoded.operandLow;
+	}
+	else if constexpr (Mode == AddressMode::Absolute)
+	{
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
+		address = ((high << 8) | (uint16_t)low);
+		m_instructionAddress = address;
+		if constexpr (NeedsData) m_instructionData = m_NES->ReadCpuMemory(address);
+	}
+	else if constexpr (Mode == AddressMode::ZP || Mode == AddressMode::ZPX || Mode == AddressMode::ZPY)
+	{
+		low = decoded.operandLow;
+		if constexpr (Mode == AddressMode::ZPX) low += m_RegX;
+		if constexpr (Mode == AddressMode::ZPY) low += m_RegY;
+		address = (uint16_t)low;
+		m_instructionAddress = address;
+		if constexpr (NeedsData) m_instructionData = m_NES->ReadCpuMemory(address);
+	}
+	else if constexpr (Mode == AddressMode::ABSX || Mode == AddressMode::ABSY)
+	{
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
+		address = ((high << 8) | (uint16_t)low) + (Mode == AddressMode::ABSX ? m_RegX : m_RegY);
+		if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
+		m_instructionAddress = address;
+		if constexpr (NeedsData) m_instructionData = m_NES->ReadCpuMemory(address);
+	}
+	else if constexpr (Mode == AddressMode::Relative)
+	{
+		offset = decoded.operandLow;
+		m_branchLocation = m_PC + (int8_t)offset;
+	}
+	else if constexpr (Mode == AddressMode::INDX)
+	{
+		offset = decoded.operandLow;
+		address = (offset + m_RegX) & 0x00FF;
+		low = m_NES->ReadCpuMemory(address);
+		address = (address + 1) & 0x00FF;
+		high = m_NES->ReadCpuMemory(address);
+		newAddress = ((high << 8) | (uint16_t)low);
+		m_instructionAddress = newAddress;
+		if constexpr (NeedsData) m_instructionData = m_NES->ReadCpuMemory(newAddress);
+	}
+	else if constexpr (Mode == AddressMode::INDY)
+	{
+		zeroPageAddress = ((uint16_t)decoded.operandLow & 0x00FF);
+		low = m_NES->ReadCpuMemory(zeroPageAddress);
+		zeroPageAddress = (zeroPageAddress + 1) & 0x00FF;
+		high = m_NES->ReadCpuMemory(zeroPageAddress);
+		address = ((high << 8) | (uint16_t)low) + m_RegY;
+		if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
+		m_instructionAddress = address;
+		if constexpr (NeedsData) m_instructionData = m_NES->ReadCpuMemory(address);
+	}
+	else if constexpr (Mode == AddressMode::Indirect)
+	{
+		low = decoded.operandLow;
+		high = decoded.operandHigh;
+		address = ((high << 8) | (uint16_t)low);
+		if (low == 0xFF)
+		{
+			// Hardware bug
+			newAddressLow = m_NES->ReadCpuMemory(address);
+			newAddressHigh = m_NES->ReadCpuMemory(address & m_highMask);
+		}
+		else
+		{
+			newAddressLow = m_NES->ReadCpuMemory(address++);
+			newAddressHigh = m_NES->ReadCpuMemory(address);
+		}
+		newAddress = ((newAddressHigh << 8) | (uint16_t)newAddressLow);
+		m_branchLocation = newAddress;
+	}
+
+	return pageBoundaryCrossed;
 }
 
+// One instantiation per opcode, the operand fetch, the operation and the extra cycle bookkeeping are all fused together
+template<uint8_t OpCode>
+void CPU::Exec(const DecodedInstruction& decoded)
+{
+	constexpr Instruction instruction = s_opCodeLookup[OpCode];
+	constexpr OpFunction operation = s_opFunctions[(size_t)instruction.mnemonic];
+
+	uint16_t ogPc = m_PC;
+	m_PC += decoded.length;
+
+	// Same as EvaluatePC, the page cycle check below must not see the last branch's target
+	m_instructionData = 0x00;
+	m_instructionAddress = 0x00;
+	m_branchLocation = 0x0000;
+
+	if constexpr (operation == nullptr)
+	{
+		// Unused opcode
+		m_clockCycles += instruction.clockCycles;
+		return;
+	}
+	else
+	{
+		m_clockCycles += instruction.clockCycles;
+
+		bool pageBoundaryCrossed = FetchOperand<instruction.addressMode, instruction.NeedsData()>(decoded, ogPc);
+
+		(this->*operation)(instruction);
+
+		if constexpr (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle())
+		{
+			if (m_PC == m_branchLocation)
+			{
+				m_clockCycles += 1;
+				if (!AreAddrsOnSamePage(ogPc, m_PC)) m_clockCycles += 1;
+			}
+		}
+
+		if constexpr (instruction.HasPageBoundaryCycle() && !instruction.HasBranchPageCycle())
+		{
+			if (pageBoundaryCrossed) m_clockCycles += 1;
+		}
+	}
+}
+
+template<size_t... OpCodes>
+constexpr std::array<CPU::ExecFunction, 256> CPU::BuildExecLookup(std::index_sequence<OpCodes...>)
+{
+	return { &CPU::Exec<(uint8_t)OpCodes>... };
+}
+
+constexpr std::array<CPU::ExecFunction, 256> CPU::s_execLookup = CPU::BuildExecLookup(std::make_index_sequence<256>());
+#endif
+
+#if CPU_THREADED_DISPATCH
+inline void CPU::SetStatusFlag(uint8_t& status, uint8_t mask, bool on)
+{
+	status = on ? status | mask : status & ~mask;
+}
+
+/*
+	Runs one instruction on the local register copy in ThreadedState. Mirrors EvaluatePC + the op code handlers exactly,
+	quirks included, so the two can be traced against each other.
+	Returns false without touching the state if the instruction would access the PPU / IO registers or write to the
+	mapper, in which case it has to run through EvaluatePC with the rest of the console caught up.
+*/
+template<uint8_t OpCode>
+inline bool CPU::ThreadedStep(ThreadedState& s, const DecodedInstruction& decoded)
+{
+	constexpr Instruction instruction = s_opCodeLookup[OpCode];
+	constexpr Mnemonic op = instruction.mnemonic;
+	constexpr AddressMode mode = instruction.addressMode;
+
+	if constexpr (op == Mnemonic::NUL)
+	{
+		// Let the regular path deal with unused opcodes
+		return false;
+	}
+	else
+	{
+		const uint16_t ogPc = s.pc;
+		uint16_t pc = s.pc + decoded.length;
+		uint8_t a = s.a, x = s.x, y = s.y, sp = s.sp, status = s.status;
+		int cycles = s.cycles + instruction.clockCycles;
+
+		uint16_t address = 0x0000;
+		uint16_t branchLocation = 0x0000;
+		uint8_t data = 0x00;
+		bool pageBoundaryCrossed = false;
+
+		uint8_t low, high;
+
+		/* Operand fetch */
+		if constexpr (mode == AddressMode::Accum)
+		{
+			data = a;
+		}
+		else if constexpr (mode == AddressMode::IMM)
+		{
+			address = ogPc + 1;
+			if constexpr (instruction.NeedsData()) data = decoded.operandLow;
+		}
+		else if constexpr (mode == AddressMode::Absolute)
+		{
+			low = decoded.operandLow;
+			high = decoded.operandHigh;
+			address = (high << 8) | low;
+			if constexpr (op != Mnemonic::JMP && op != Mnemonic::JSR)
+			{
+				if (IsIoAddress(address)) return false;
+			}
+		}
+		else if constexpr (mode == AddressMode::ZP || mode == AddressMode::ZPX || mode == AddressMode::ZPY)
+		{
+			low = decoded.operandLow;
+			if constexpr (mode == AddressMode::ZPX) low += x;
+			if constexpr (mode == AddressMode::ZPY) low += y;
+			address = low;
+		}
+		else if constexpr (mode == AddressMode::ABSX || mode == AddressMode::ABSY)
+		{
+			low = decoded.operandLow;
+			high = decoded.operandHigh;
+			address = ((high << 8) | low) + (mode == AddressMode::ABSX ? x : y);
+			if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
+			if (IsIoAddress(address)) return false;
+		}
+		else if constexpr (mode == AddressMode::Relative)
+		{
+			int8_t offset = (int8_t)decoded.operandLow;
+			branchLocation = pc + offset;
+		}
+		else if constexpr (mode == AddressMode::INDX)
+		{
+			uint8_t zeroPageAddress = decoded.operandLow + x;
+			low = m_NES->ReadCpuMemory(zeroPageAddress);
+			high = m_NES->ReadCpuMemory((uint8_t)(zeroPageAddress + 1));
+			address = (high << 8) | low;
+			if (IsIoAddress(address)) return false;
+		}
+		else if constexpr (mode == AddressMode::INDY)
+		{
+			uint8_t zeroPageAddress = decoded.operandLow;
+			low = m_NES->ReadCpuMemory(zeroPageAddress);
+			high = m_NES->ReadCpuMemory((uint8_t)(zeroPageAddress + 1));
+			address = ((high << 8) | low) + y;
+			if (((address && 0xFF00) >> 8) != high) pageBoundaryCrossed = true;
+			if (IsIoAddress(address)) return false;
+		}
+		else if constexpr (mode == AddressMode::Indirect)
+		{
+			low = decoded.operandLow;
+			high = decoded.operandHigh;
+			address = (high << 8) | low;
+			uint16_t highAddress = (low == 0xFF) ? (address & m_highMask) : (uint16_t)(address + 1);
+			if (IsIoAddress(address) || IsIoAddress(highAddress)) return false;
+
+			// Hardware bug for the $xxFF case is handled by highAddress
+			branchLocation = (m_NES->ReadCpuMemory(highAddress) << 8) | m_NES->ReadCpuMemory(address);
+		}
+
+		// Writes into cartridge space go to the mapper, which needs the PPU caught up first
+		constexpr bool writesMemory = op == Mnemonic::STA || op == Mnemonic::STX || op == Mnemonic::STY
+			|| op == Mnemonic::INC || op == Mnemonic::DEC || ((op == Mnemonic::ASL || op == Mnemonic::LSR
+			|| op == Mnemonic::ROL || op == Mnemonic::ROR) && mode != AddressMode::Accum);
+		if constexpr (writesMemory && mode != AddressMode::ZP && mode != AddressMode::ZPX && mode != AddressMode::ZPY)
+		{
+			if (address >= kDecodeCacheStart) return false;
+		}
+
+		if constexpr (instruction.NeedsData() && mode != AddressMode::Accum && mode != AddressMode::IMM)
+		{
+			data = m_NES->ReadCpuMemory(address);
+		}
+
+		/* Operation */
+		auto storeResult = [&](uint8_t result)
+		{
+			if constexpr (mode == AddressMode::Accum) a = result;
+			else m_NES->WriteCpuMemory(address, result);
+		};
+		auto push = [&](uint8_t value)
+		{
+			m_NES->WriteCpuMemory(m_StackLocation + sp, value);
+			sp--;
+		};
+		auto pull = [&]()
+		{
+			sp++;
+			return m_NES->ReadCpuMemory(m_StackLocation + sp);
+		};
+		auto setZeroNegative = [&](uint8_t value)
+		{
+			SetStatusFlag(status, m_zeroMask, value == 0x00);
+			SetStatusFlag(status, m_negativeMask, (value & 0x80) != 0);
+		};
+		auto branch = [&](bool condition)
+		{
+			if (condition)
+			{
+				cycles += OnSamePage(pc, branchLocation) ? 1 : 2;
+				pc = branchLocation;
+			}
+		};
+
+		if constexpr (op == Mnemonic::ADC)
+		{
+			uint16_t sum = (uint16_t)a + data + (status & m_carryMask);
+			uint8_t result = (uint8_t)(sum & m_lowMask);
+			uint8_t signA = a & 0x80, signM = data & 0x80, signR = result & 0x80;
+			bool arithmeticOverflow = (((signA ^ signR) & ~(signA ^ signM)) & 0x80);
+			a = result;
+			SetStatusFlag(status, m_carryMask, (sum & m_highMask) != 0x0000);
+			SetStatusFlag(status, m_zeroMask, result == 0x00);
+			SetStatusFlag(status, m_negativeMask, result & 0x80);
+			SetStatusFlag(status, m_overflowMask, arithmeticOverflow);
+		}
+		else if constexpr (op == Mnemonic::SBC)
+		{
+			uint16_t result = a + (data ^ 0x00FF) + (status & m_carryMask);
+			SetStatusFlag(status, m_zeroMask, (result & 0x00FF) == 0x000);
+			SetStatusFlag(status, m_overflowMask, (result ^ a) & (result ^ (data ^ 0x00FF)) & 0x0080);
+			SetStatusFlag(status, m_negativeMask, (result & 0x0080) != 0);
+			SetStatusFlag(status, m_carryMask, (result & 0xFF00) != 0);
+			a = (uint8_t)(result & 0x00FF);
+		}
+		else if constexpr (op == Mnemonic::AND) { a &= data; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::ORA) { a |= data; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::EOR) { a ^= data; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::ASL)
+		{
+			SetStatusFlag(status, m_carryMask, (data & 0x80) != 0);
+			uint8_t result = (uint8_t)(data << 1);
+			storeResult(result);
+			setZeroNegative(result);
+		}
+		else if constexpr (op == Mnemonic::LSR)
+		{
+			SetStatusFlag(status, m_carryMask, data & 0x01);
+			uint8_t result = data >> 1;
+			SetStatusFlag(status, m_zeroMask, result == 0x00);
+			SetStatusFlag(status, m_negativeMask, false);
+			storeResult(result);
+		}
+		else if constexpr (op == Mnemonic::ROL)
+		{
+			bool setCarry = (data & 0x80) != 0x00;
+			uint8_t result = (uint8_t)(data << 1) | (status & m_carryMask);
+			storeResult(result);
+			SetStatusFlag(status, m_carryMask, setCarry);
+			SetStatusFlag(status, m_zeroMask, (result & a) == 0x00);
+			SetStatusFlag(status, m_negativeMask, (result & 0x80) != 0x00);
+		}
+		else if constexpr (op == Mnemonic::ROR)
+		{
+			uint8_t ogCarry = status & m_carryMask;
+			SetStatusFlag(status, m_carryMask, data & 0x01);
+			uint8_t result = (data >> 1) | (ogCarry ? 0x80 : 0x00);
+			storeResult(result);
+			setZeroNegative(result);
+		}
+		else if constexpr (op == Mnemonic::BIT)
+		{
+			SetStatusFlag(status, m_zeroMask, (data & a) == 0x00);
+			SetStatusFlag(status, m_negativeMask, (data & 0x80) != 0x00);
+			SetStatusFlag(status, m_overflowMask, (data & 0x40) != 0x00);
+		}
+		else if constexpr (op == Mnemonic::BCC) { branch((status & m_carryMask) == 0); }
+		else if constexpr (op == Mnemonic::BCS) { branch((status & m_carryMask) != 0); }
+		else if constexpr (op == Mnemonic::BEQ) { branch((status & m_zeroMask) != 0); }
+		else if constexpr (op == Mnemonic::BNE) { branch((status & m_zeroMask) == 0); }
+		else if constexpr (op == Mnemonic::BMI) { branch((status & m_negativeMask) != 0); }
+		else if constexpr (op == Mnemonic::BPL) { branch((status & m_negativeMask) == 0); }
+		else if constexpr (op == Mnemonic::BVC) { branch((status & m_overflowMask) == 0); }
+		else if constexpr (op == Mnemonic::BVS) { branch((status & m_overflowMask) != 0); }
+		else if constexpr (op == Mnemonic::BRK)
+		{
+			pc++;
+			push(pc >> 8);
+			push((uint8_t)(pc & 0x00FF));
+			// Pushed with the I flag as it was, like DoInterrupt
+			SetStatusFlag(status, m_unusedMask, true);
+			SetStatusFlag(status, m_brkMask, false);
+			push(status);
+			SetStatusFlag(status, m_irqMask, true);
+			uint16_t newPcLo = m_NES->ReadCpuMemory(0xFFFE);
+			uint16_t newPcHigh = m_NES->ReadCpuMemory(0xFFFF);
+			pc = (newPcHigh << 8) | newPcLo;
+		}
+		else if constexpr (op == Mnemonic::RTI)
+		{
+			status = pull();
+			uint16_t lo = pull();
+			uint16_t hi = pull();
+			pc = (hi << 8) | lo;
+		}
+		else if constexpr (op == Mnemonic::JMP)
+		{
+			pc = (mode == AddressMode::Indirect) ? branchLocation : address;
+		}
+		else if constexpr (op == Mnemonic::JSR)
+		{
+			pc--;
+			push(pc >> 8);
+			push((uint8_t)(pc & 0x00FF));
+			pc = address;
+		}
+		else if constexpr (op == Mnemonic::RTS)
+		{
+			uint16_t lo = pull();
+			uint16_t hi = pull();
+			pc = ((hi << 8) | lo) + 1;
+		}
+		else if constexpr (op == Mnemonic::PHA) { push(a); }
+		else if constexpr (op == Mnemonic::PHP) { push(status | m_unusedMask | m_brkMask); }
+		else if constexpr (op == Mnemonic::PLA) { a = pull(); setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::PLP) { status = pull(); }
+		else if constexpr (op == Mnemonic::CLC) { SetStatusFlag(status, m_carryMask, false); }
+		else if constexpr (op == Mnemonic::CLD) { SetStatusFlag(status, m_decimalMask, false); }
+		else if constexpr (op == Mnemonic::CLI) { SetStatusFlag(status, m_irqMask, false); }
+		else if constexpr (op == Mnemonic::CLV) { SetStatusFlag(status, m_overflowMask, false); }
+		else if constexpr (op == Mnemonic::SEC) { SetStatusFlag(status, m_carryMask, true); }
+		else if constexpr (op == Mnemonic::SED) { SetStatusFlag(status, m_decimalMask, true); }
+		else if constexpr (op == Mnemonic::SEI) { SetStatusFlag(status, m_irqMask, true); }
+		else if constexpr (op == Mnemonic::CMP || op == Mnemonic::CPX || op == Mnemonic::CPY)
+		{
+			uint8_t reg = (op == Mnemonic::CMP) ? a : (op == Mnemonic::CPX) ? x : y;
+			SetStatusFlag(status, m_carryMask, reg >= data);
+			SetStatusFlag(status, m_zeroMask, reg == data);
+			SetStatusFlag(status, m_negativeMask, ((reg - data) & 0x80) != 0);
+		}
+		else if constexpr (op == Mnemonic::DEC) { uint8_t result = data - 0x01; m_NES->WriteCpuMemory(address, result); setZeroNegative(result); }
+		else if constexpr (op == Mnemonic::INC) { uint8_t result = data + 0x01; m_NES->WriteCpuMemory(address, result); setZeroNegative(result); }
+		else if constexpr (op == Mnemonic::DEX) { x -= 1; setZeroNegative(x); }
+		else if constexpr (op == Mnemonic::DEY) { y -= 1; setZeroNegative(y); }
+		else if constexpr (op == Mnemonic::INX) { x += 1; setZeroNegative(x); }
+		else if constexpr (op == Mnemonic::INY) { y += 1; setZeroNegative(y); }
+		else if constexpr (op == Mnemonic::LDA) { a = data; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::LDX) { x = data; setZeroNegative(x); }
+		else if constexpr (op == Mnemonic::LDY) { y = data; setZeroNegative(y); }
+		else if constexpr (op == Mnemonic::STA) { m_NES->WriteCpuMemory(address, a); }
+		else if constexpr (op == Mnemonic::STX) { m_NES->WriteCpuMemory(address, x); }
+		else if constexpr (op == Mnemonic::STY) { m_NES->WriteCpuMemory(address, y); }
+		else if constexpr (op == Mnemonic::TAX) { x = a; setZeroNegative(x); }
+		else if constexpr (op == Mnemonic::TAY) { y = a; setZeroNegative(y); }
+		else if constexpr (op == Mnemonic::TSX) { x = sp; setZeroNegative(x); }
+		else if constexpr (op == Mnemonic::TXA) { a = x; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::TXS) { sp = x; }
+		else if constexpr (op == Mnemonic::TYA) { a = y; setZeroNegative(a); }
+		else if constexpr (op == Mnemonic::NOP) { }
+
+		/* Variable clock cycles, same rules as EvaluatePC */
+		if constexpr (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle())
+		{
+			if (pc == branchLocation)
+			{
+				cycles += 1;
+				if (!AreAddrsOnSamePage(ogPc, pc)) cycles += 1;
+			}
+		}
+
+		if constexpr (instruction.HasPageBoundaryCycle() && !instruction.HasBranchPageCycle())
+		{
+			if (pageBoundaryCrossed) cycles += 1;
+		}
+
+		s = { pc, a, x, y, sp, status, cycles, s.instructions + 1 };
+		return true;
+	}
+}
+
+#define CPU_OPCODE_LIST(X) \
+	X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+	X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+	X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+	X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+	X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+	X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+	X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+	X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+	X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+	X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+	X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+	X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+	X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+	X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+	X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+	X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+/*
+	Direct threaded interpreter (labels as values, GCC / Clang only). Every opcode ends with its own indirect jump to the
+	next handler instead of returning to one shared dispatch, which the branch predictor likes a lot more.
+	Registers live in locals for the whole run and are only written back to the members when we stop.
+
+	Stops before starting an instruction once cycleBudget is used up, or before any instruction that would touch the
+	PPU / IO registers, so the caller can catch the rest of the console up and run that one through EvaluatePC.
+	With CPU_DYNAREC hot PRG ROM blocks run as native code instead, see Dynarec.h.
+	Returns the number of cpu cycles executed. Only call this between instructions.
+*/
+int CPU::RunThreaded(int cycleBudget)
+{
+#define CPU_THREADED_LABEL(n) &&op_##n,
+	static void* const kDispatch[256] = { CPU_OPCODE_LIST(CPU_THREADED_LABEL) };
+#undef CPU_THREADED_LABEL
+
+	ThreadedState s = { m_PC, m_RegA, m_RegX, m_RegY, m_SP, m_Status, 0, 0 };
+	const DecodedInstruction* decoded = nullptr;
+
+#if CPU_DYNAREC
+	// Translated blocks all come back through one label, they are long enough that it doesn't matter
+	Dynarec* dynarec = (m_dynarec && m_dynarec->IsEnabled()) ? m_dynarec.get() : nullptr;
+#define CPU_THREADED_RUN_BLOCK() \
+	if (dynarec && s.pc >= kDecodeCacheStart && dynarec->Run(*this, s, cycleBudget)) goto block_done;
+#else
+#define CPU_THREADED_RUN_BLOCK()
+#endif
+
+#define CPU_THREADED_NEXT() \
+	if (s.cycles >= cycleBudget || IsIoAddress(s.pc) || IsIoAddress((uint16_t)(s.pc + 2))) goto done; \
+	CPU_THREADED_RUN_BLOCK() \
+	decoded = &DecodeInstruction(s.pc); \
+	goto *kDispatch[decoded->opCode];
+
+#define CPU_THREADED_OP(n) \
+	op_##n: \
+	if (!ThreadedStep<0x##n>(s, *decoded)) goto done; \
+	CPU_THREADED_NEXT();
+
+#if CPU_DYNAREC
+block_done:
+#endif
+	CPU_THREADED_NEXT();
+	CPU_OPCODE_LIST(CPU_THREADED_OP)
+
+#undef CPU_THREADED_OP
+#undef CPU_THREADED_NEXT
+#undef CPU_THREADED_RUN_BLOCK
+
+done:
+	m_PC = s.pc;
+	m_instructionCount += s.instructions;
+	m_RegA = s.a;
+	m_RegX = s.x;
+	m_RegY = s.y;
+	m_SP = s.sp;
+	m_Status = s.status;
+
+	return s.cycles;
+}
+
+#undef CPU_OPCODE_LIST
+#endif
+
 bool CPU::AreAddrsOnSamePage(uint16_t addr1, uint16_t addr2)
 {
 	return (addr1 && 0xFF00) == (addr2 && 0xFF00);
@@ -1239,82 +2095,82 @@ std::map<uint16_t, std::string> CPU::Disassemble(uint16_t nStart, uint16_t nStop
 
 		// Read instruction, and get its readable name
 		uint8_t opcode = m_NES->ReadCpuMemory(addr); addr++;
-		sInst += m_opCodeLookup[opcode].name + " ";
+		sInst += std::string(s_mnemonicNames[(size_t)s_opCodeLookup[opcode].mnemonic]) + " ";
 
 		// Get oprands from desired locations, and form the
 		// instruction based upon its addressing mode. These
 		// routines mimmick the actual fetch routine of the
 		// 6502 in order to get accurate data as part of the
 		// instruction
-		if (m_opCodeLookup[opcode].addressMode == AddressMode::Implied)
+		if (s_opCodeLookup[opcode].addressMode == AddressMode::Implied)
 		{
 			sInst += " {IMP}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::IMM)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::IMM)
 		{
 			value = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "#$" + hex(value, 2) + " {IMM}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::ZP)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::ZP)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = 0x00;
 			sInst += "$" + hex(lo, 2) + " {ZP0}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::ZPX)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::ZPX)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = 0x00;
 			sInst += "$" + hex(lo, 2) + ", X {ZPX}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::ZPY)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::ZPY)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = 0x00;
 			sInst += "$" + hex(lo, 2) + ", Y {ZPY}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::INDX)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::INDX)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = 0x00;
 			sInst += "($" + hex(lo, 2) + ", X) {IZX}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::INDY)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::INDY)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = 0x00;
 			sInst += "($" + hex(lo, 2) + "), Y {IZY}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::Absolute)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::Absolute)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "$" + hex((uint16_t)(hi << 8) | lo, 4) + " {ABS}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::ABSX)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::ABSX)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "$" + hex((uint16_t)(hi << 8) | lo, 4) + ", X {ABX}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::ABSY)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::ABSY)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "$" + hex((uint16_t)(hi << 8) | lo, 4) + ", Y {ABY}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::Indirect)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::Indirect)
 		{
 			lo = m_NES->ReadCpuMemory(addr); addr++;
 			hi = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "($" + hex((uint16_t)(hi << 8) | lo, 4) + ") {IND}";
 		}
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::Relative)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::Relative)
 		{
 			value = m_NES->ReadCpuMemory(addr); addr++;
 			sInst += "$" + hex(value, 2) + " [$" + hex(addr + (int8_t)value, 4) + "] {REL}";
 		} 
-		else if (m_opCodeLookup[opcode].addressMode == AddressMode::Accum)
+		else if (s_opCodeLookup[opcode].addressMode == AddressMode::Accum)
 		{
 			sInst += " {Accum}";
 		}
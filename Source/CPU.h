@@ -2,9 +2,43 @@
 
 #include <cstdint>
 #include <array>
+#include <bitset>
 #include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Build time switch for the instruction dispatch.
+// 0: decode through the opcode lookup and the address mode switch in CPU::EvaluatePC
+// 1: jump straight to a CPU::Exec<OpCode> specialization per opcode
+// Both have to give the exact same results, flip it to compare them.
+#ifndef CPU_TEMPLATE_DISPATCH
+#define CPU_TEMPLATE_DISPATCH 0
+#endif
+
+// Threaded interpreter that lets the CPU run ahead of the PPU between PPU events, see CPU::RunThreaded.
+// Needs labels as values so it's GCC / Clang only, MSVC builds always step the CPU in lockstep with the PPU.
+#ifndef CPU_THREADED_DISPATCH
+#if defined(__GNUC__)
+#define CPU_THREADED_DISPATCH 1
+#else
+#define CPU_THREADED_DISPATCH 0
+#endif
+#endif
+
+// Native x86-64 translation of hot PRG ROM blocks on top of the threaded core, see Dynarec.h.
+// Needs to map executable memory so it's only built for x86-64 on unix-like systems.
+#ifndef CPU_DYNAREC
+#if CPU_THREADED_DISPATCH && defined(__x86_64__) && defined(__unix__)
+#define CPU_DYNAREC 1
+#else
+#define CPU_DYNAREC 0
+#endif
+#endif
 
 class NES;
+class Dynarec;
 
 class CPU
 {
@@ -12,7 +46,7 @@ public:
 	CPU();
 	~CPU();
 
-	enum class AddressMode
+	enum class AddressMode : int8_t
 	{
 		UNDEFINED = -1,
 		Accum = 0,
@@ -30,20 +64,112 @@ public:
 		Indirect = 12
 	};
 
+	enum class Mnemonic : uint8_t
+	{
+		NUL = 0,
+		ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI,
+		BNE, BPL, BRK, BVC, BVS, CLC, CLD, CLI,
+		CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR,
+		INC, INX, INY, JMP, JSR, LDA, LDX, LDY,
+		LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL,
+		ROR, RTI, RTS, SBC, SEC, SED, SEI, STA,
+		STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+		Count
+	};
+
+	// Plain old data so it's cheap to copy around, everything fits in 4 bytes
 	struct Instruction
 	{
-		std::string name;
-		void(CPU::* opCode)(Instruction instruction);
+		Mnemonic mnemonic;
 		AddressMode addressMode;
-		int clockCycles;
-		bool pageBoundaryCycle;
-		bool branchPageCycle;
+		uint8_t clockCycles;
+		uint8_t flags;
+
+		constexpr bool NeedsData() const { return (flags & kNeedsDataFlag) != 0; }
+		constexpr bool HasPageBoundaryCycle() const { return (flags & kPageBoundaryCycleFlag) != 0; }
+		constexpr bool HasBranchPageCycle() const { return (flags & kBranchPageCycleFlag) != 0; }
 	};
 
+	static constexpr uint8_t kNeedsDataFlag = 0b00000001;
+	static constexpr uint8_t kPageBoundaryCycleFlag = 0b00000010;
+	static constexpr uint8_t kBranchPageCycleFlag = 0b00000100;
+
+	// An instruction with its operand bytes already read out of memory
+	struct DecodedInstruction
+	{
+		Instruction instruction;
+		uint8_t opCode;
+		uint8_t operandLow;
+		uint8_t operandHigh;
+		uint8_t length; // 0 means not decoded yet
+	};
+
+	/* PRG ROM decode cache */
+	// PRG ROM is split in 8KB banks so a mapper can drop just the banks it switched
+	static constexpr uint16_t kDecodeCacheStart = 0x8000;
+	static constexpr uint16_t kDecodeCacheBankSize = 0x2000;
+	static constexpr int kDecodeCacheBanks = (0x10000 - kDecodeCacheStart) / kDecodeCacheBankSize;
+
+	struct DecodeCacheStats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t uncached = 0; // Instructions decoded outside PRG ROM, eg. code running from RAM
+		uint64_t invalidations = 0;
+	};
+
+	const DecodeCacheStats& GetDecodeCacheStats() { return m_decodeCacheStats; }
+
+	// Drops every decoded instruction in the PRG bank containing address
+	void InvalidateDecodeCache(uint16_t address);
+
+	// Heap memory behind the decode and idle loop caches
+	size_t GetCacheMemoryUsage();
+
 	void Initialize(NES *console);
-	void BuildOpCodeLookup();
 	void Cycle();
 
+	// Runs the next instruction in one go instead of spreading it over Cycle() calls, for when the caller keeps the
+	// clock itself (see NES::RunCatchUpFrame). Only valid between instructions, returns the cycles it takes.
+	int Step();
+
+	// Most cycles a single instruction can take, including page / branch penalties
+	static constexpr int kMaxInstructionCycles = 8;
+
+	// Cycles the CPU sits out after the current instruction, while OAM DMA has the bus. Step leaves them in
+	// GetClockCycles for the caller to run out, see SkipCycles.
+	void Stall(int cycles) { m_stallCycles += cycles; }
+
+	// Runs out cycles of an instruction that has already been executed, nothing happens on them
+	void SkipCycles(int cycles) { m_clockCycles -= cycles; }
+
+	// Instructions started since power on, however they were run
+	uint64_t GetInstructionCount() { return m_instructionCount; }
+
+	/* Idle loops */
+	// A short loop that only reads memory and then jumps back to its first instruction, like polling $2002 or a RAM
+	// flag until the NMI handler changes it. Once one pass leaves every register as it was, the loop keeps spinning
+	// the same way until something outside the CPU changes what it reads.
+	struct IdleLoop
+	{
+		uint8_t cycles = 0; // One pass, 0 if there is no idle loop here
+		uint8_t instructions = 0;
+	};
+
+	static constexpr int kMaxIdleLoopInstructions = 4;
+
+	// The idle loop starting at PC if there is one. Only looks at PRG ROM, results are dropped along with the decode cache.
+	IdleLoop GetIdleLoopAtPC();
+
+#if CPU_THREADED_DISPATCH
+	int RunThreaded(int cycleBudget);
+#endif
+
+#if CPU_DYNAREC
+	// Null until Initialize, include Dynarec.h to turn it on / off or read its stats
+	Dynarec* GetDynarec() { return m_dynarec.get(); }
+#endif
+
 	// Hardware Interrupts
 	void Reset();
 	void NonMaskableInterrupt(); // NMI
@@ -60,6 +186,7 @@ public:
 	uint8_t GetRegX() { return m_RegX; }
 	uint8_t GetRegY() { return m_RegY; }
 	uint8_t GetStackPointer() { return m_SP; }
+	uint8_t GetStatus() { return m_Status; }
 	uint16_t GetClockCycles() { return m_clockCycles; }
 	uint8_t GetNegativeFlag();
 	uint8_t GetOverflowFlag();
@@ -96,13 +223,35 @@ private:
 	uint16_t m_branchLocation = 0x0000;
 
 	uint16_t m_clockCycles = 0;
+	uint16_t m_stallCycles = 0;
+	uint64_t m_instructionCount = 0;
 
 	void ClearRegisters();
 	void EvaluatePC();
 
+	const DecodedInstruction& DecodeInstruction(uint16_t address);
+	void DecodeInto(uint16_t address, DecodedInstruction& decoded);
+
+	// Each bank is allocated the first time something in it gets decoded, most games only ever run out of a few
+	std::array<std::unique_ptr<DecodedInstruction[]>, kDecodeCacheBanks> m_decodeCache;
+	std::array<bool, kDecodeCacheBanks> m_decodeCacheBankUsed = {};
+	DecodedInstruction m_uncachedInstruction = {};
+	DecodeCacheStats m_decodeCacheStats;
+
+	struct IdleLoopBank
+	{
+		std::array<IdleLoop, kDecodeCacheBankSize> loops = {};
+		std::bitset<kDecodeCacheBankSize> analyzed;
+	};
+
+	IdleLoop AnalyzeIdleLoop(uint16_t address);
+	std::array<std::unique_ptr<IdleLoopBank>, kDecodeCacheBanks> m_idleLoopCache;
+
 	/* Utility */
 	bool OnSamePage(uint16_t addr1, uint16_t addr2);
-	bool DoesInstructionNeedData(Instruction instruction);
+
+	// Anything the CPU can't touch without the PPU / controllers being in sync. Cartridge space and RAM are fine.
+	static bool IsIoAddress(uint16_t address) { return address >= 0x2000 && address < 0x4020; }
 
 	/* Interrupt */
 	void DoInterrupt(uint16_t lo, uint16_t high);
@@ -131,7 +280,51 @@ private:
 	void SetCarryFlag(bool on);
 
 	/* Op Code Lookup */
-	std::array<Instruction, 256> m_opCodeLookup;
+	typedef void(CPU::* OpFunction)(Instruction instruction);
+
+	static constexpr bool OperationNeedsData(Mnemonic mnemonic);
+	static constexpr Instruction MakeInstruction(Mnemonic mnemonic, AddressMode addressMode, int clockCycles, bool pageBoundaryCycle, bool branchPageCycle);
+	static constexpr std::array<Instruction, 256> BuildOpCodeLookup();
+
+	static const std::array<Instruction, 256> s_opCodeLookup;
+	static const std::array<OpFunction, (size_t)Mnemonic::Count> s_opFunctions;
+	static const std::array<const char*, (size_t)Mnemonic::Count> s_mnemonicNames;
+
+#if CPU_TEMPLATE_DISPATCH
+	typedef void(CPU::* ExecFunction)(const DecodedInstruction& decoded);
+
+	template<AddressMode Mode, bool NeedsData> bool FetchOperand(const DecodedInstruction& decoded, uint16_t ogPc);
+	template<uint8_t OpCode> void Exec(const DecodedInstruction& decoded);
+	template<size_t... OpCodes> static constexpr std::array<ExecFunction, 256> BuildExecLookup(std::index_sequence<OpCodes...>);
+
+	static const std::array<ExecFunction, 256> s_execLookup;
+#endif
+
+#if CPU_THREADED_DISPATCH
+	struct ThreadedState
+	{
+		uint16_t pc;
+		uint8_t a;
+		uint8_t x;
+		uint8_t y;
+		uint8_t sp;
+		uint8_t status;
+		int cycles;
+		int instructions;
+	};
+
+	static void SetStatusFlag(uint8_t& status, uint8_t mask, bool on);
+	template<uint8_t OpCode> bool ThreadedStep(ThreadedState& s, const DecodedInstruction& decoded);
+
+	friend class LaneCpu;
+#endif
+
+#if CPU_DYNAREC
+	friend class Dynarec;
+	friend class DynarecCodeCache;
+
+	std::unique_ptr<Dynarec> m_dynarec;
+#endif
 
 	/* Op Codes */
 	void ADC(Instruction instruction);
@@ -0,0 +1,100 @@
+#include "ChrCache.h"
+
+#include <algorithm>
+
+#include "TileDecoder.h"
+
+void ChrCache::Attach(std::span<const uint8_t> chr)
+{
+	size_t tiles = chr.size() / kTileBytes;
+	m_chr = chr;
+	m_romCache = nullptr;
+	m_ramPixels.assign(tiles * kTilePixels, 0x00);
+	m_ramFlippedPixels.clear();
+	m_ramFlippedPixels.shrink_to_fit();
+	m_pixels = m_ramPixels.data();
+	m_flippedPixels = nullptr;
+	m_tileState.assign(tiles, 0);
+	m_stats = Stats();
+}
+
+void ChrCache::Attach(std::shared_ptr<ChrRomCache> romCache)
+{
+	m_chr = romCache->GetData();
+	m_romCache = romCache;
+	m_ramPixels.clear();
+	m_ramPixels.shrink_to_fit();
+	m_ramFlippedPixels.clear();
+	m_ramFlippedPixels.shrink_to_fit();
+	m_pixels = romCache->GetPixels(false);
+	m_flippedPixels = romCache->GetPixels(true);
+	m_tileState.assign(m_chr.size() / kTileBytes, 0);
+	m_stats = Stats();
+}
+
+void ChrCache::Invalidate()
+{
+	std::fill(m_tileState.begin(), m_tileState.end(), 0);
+}
+
+void ChrCache::BuildBank(int bank)
+{
+	int first = bank * kBankTiles;
+	if (!m_romCache || (m_tileState[first] & kDecoded) != 0)
+		return;
+
+	if (m_romCache->BuildBank(bank, false))
+	{
+		m_stats.bankBuilds++;
+	}
+	for (int tile = first; tile < first + kBankTiles; tile++)
+	{
+		m_tileState[tile] |= kDecoded;
+	}
+}
+
+void ChrCache::DecodeTile(int tile, bool flipped)
+{
+	uint8_t decoded = flipped ? kFlippedDecoded : kDecoded;
+	if (m_romCache)
+	{
+		// A whole bank at a time, it's shared and ROM so it never has to be done again
+		int first = tile - tile % kBankTiles;
+		if (m_romCache->BuildBank(tile / kBankTiles, flipped))
+		{
+			m_stats.bankBuilds++;
+		}
+		for (int bankTile = first; bankTile < first + kBankTiles; bankTile++)
+		{
+			m_tileState[bankTile] |= decoded;
+		}
+		return;
+	}
+
+	const uint8_t* pattern = &m_chr[tile * kTileBytes];
+	if (flipped)
+	{
+		if (m_ramFlippedPixels.empty())
+		{
+			m_ramFlippedPixels.assign(m_ramPixels.size(), 0x00);
+			m_flippedPixels = m_ramFlippedPixels.data();
+		}
+
+		uint8_t* pixels = &m_ramFlippedPixels[tile * kTilePixels];
+		for (int row = 0; row < 8; row++)
+		{
+			TileDecoder::DecodeRowFlipped(pattern[row], pattern[row + 8], pixels + row * 8);
+		}
+	}
+	else
+	{
+		TileDecoder::DecodeTile(pattern, &m_ramPixels[tile * kTilePixels]);
+	}
+	m_tileState[tile] |= decoded;
+	m_stats.tileDecodes++;
+}
+
+size_t ChrCache::GetMemoryUsage() const
+{
+	return m_ramPixels.capacity() + m_ramFlippedPixels.capacity() + m_tileState.capacity();
+}
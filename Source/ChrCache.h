@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "ChrRomCache.h"
+
+/*
+	Every tile of the cartridge's CHR ROM or CHR RAM decoded to 8x8 pixel values 0 - 3, one byte per pixel, so the PPU
+	copies rows out instead of pulling them apart from the bit planes on every fetch.
+
+	CHR ROM is decoded a 1KB bank (64 tiles) at a time into a ChrRomCache that every console running the cartridge
+	shares, the first time a mapper switches that bank in. CHR RAM belongs to the console so its tiles are decoded here,
+	when first drawn, and marked dirty by writes so only the tiles a game actually rewrites get decoded again.
+	Horizontally flipped copies are only made for tiles that sprites draw flipped.
+*/
+class ChrCache
+{
+public:
+	static constexpr int kTileBytes = ChrRomCache::kTileBytes;
+	static constexpr int kTilePixels = ChrRomCache::kTilePixels;
+	static constexpr int kBankTiles = ChrRomCache::kBankTiles;
+
+	struct Stats
+	{
+		uint64_t bankBuilds = 0; // CHR ROM banks decoded by this console, flipped or not
+		uint64_t tileDecodes = 0; // CHR RAM tiles decoded one at a time
+		uint64_t dirtyTiles = 0; // Decoded tiles thrown away by CHR RAM writes
+	};
+
+	// Starts over with chr as CHR RAM, which has to stay where it is for as long as the cache uses it
+	void Attach(std::span<const uint8_t> chr);
+
+	// Starts over drawing CHR ROM out of romCache
+	void Attach(std::shared_ptr<ChrRomCache> romCache);
+
+	// Forgets everything decoded so far, for when the whole of CHR RAM changed
+	void Invalidate();
+
+	// tile is the byte offset into CHR divided by kTileBytes, the result is 8 rows of 8 pixels
+	inline const uint8_t* GetTile(int tile, bool flipped)
+	{
+		uint8_t decoded = flipped ? kFlippedDecoded : kDecoded;
+		if ((m_tileState[tile] & decoded) == 0)
+		{
+			DecodeTile(tile, flipped);
+		}
+		return (flipped ? m_flippedPixels : m_pixels) + tile * kTilePixels;
+	}
+
+	// A CHR ROM bank is about to be drawn from
+	void BuildBank(int bank);
+
+	// A CHR RAM byte in this tile was written
+	inline void MarkDirty(int tile)
+	{
+		if (m_tileState[tile] != 0)
+		{
+			m_tileState[tile] = 0;
+			m_stats.dirtyTiles++;
+		}
+	}
+
+	const uint8_t* GetData() const { return m_chr.data(); }
+	const Stats& GetStats() const { return m_stats; }
+
+	// Null with CHR RAM
+	const std::shared_ptr<ChrRomCache>& GetRomCache() const { return m_romCache; }
+
+	// What this console holds on its own, the ROM cache is reported separately
+	size_t GetMemoryUsage() const;
+
+private:
+	enum TileState : uint8_t
+	{
+		kDecoded = 0x01,
+		kFlippedDecoded = 0x02
+	};
+
+	void DecodeTile(int tile, bool flipped);
+
+	std::span<const uint8_t> m_chr;
+	std::shared_ptr<ChrRomCache> m_romCache;
+
+	// Point into the ROM cache or at the CHR RAM arrays below
+	const uint8_t* m_pixels = nullptr;
+	const uint8_t* m_flippedPixels = nullptr;
+
+	std::vector<uint8_t> m_ramPixels;
+	std::vector<uint8_t> m_ramFlippedPixels; // Only allocated once something is drawn flipped
+	std::vector<uint8_t> m_tileState;
+	Stats m_stats;
+};
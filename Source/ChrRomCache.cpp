@@ -0,0 +1,60 @@
+#include "ChrRomCache.h"
+
+#include "TileDecoder.h"
+
+ChrRomCache::ChrRomCache(std::span<const uint8_t> chr)
+	: m_chr(chr)
+{
+	// Left uninitialized, nothing reads a bank before it's decoded
+	size_t pixels = chr.size() / kTileBytes * kTilePixels;
+	m_pixels.reset(new uint8_t[pixels]);
+	m_flippedPixels.reset(new uint8_t[pixels]);
+
+	m_bankCount = (int)(chr.size() / kBankBytes);
+	m_bankState.reset(new std::atomic<uint8_t>[m_bankCount]());
+}
+
+bool ChrRomCache::BuildBank(int bank, bool flipped)
+{
+	uint8_t decoded = flipped ? kFlippedDecoded : kDecoded;
+	if ((m_bankState[bank].load(std::memory_order_acquire) & decoded) != 0)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint8_t state = m_bankState[bank].load(std::memory_order_relaxed);
+	if ((state & decoded) != 0)
+		return false;
+
+	int first = bank * kBankTiles;
+	for (int tile = first; tile < first + kBankTiles; tile++)
+	{
+		const uint8_t* pattern = &m_chr[tile * kTileBytes];
+		if (flipped)
+		{
+			uint8_t* pixels = &m_flippedPixels[tile * kTilePixels];
+			for (int row = 0; row < 8; row++)
+			{
+				TileDecoder::DecodeRowFlipped(pattern[row], pattern[row + 8], pixels + row * 8);
+			}
+		}
+		else
+		{
+			TileDecoder::DecodeTile(pattern, &m_pixels[tile * kTilePixels]);
+		}
+	}
+
+	// The pixels have to be written before another thread can see the bank as decoded
+	m_bankState[bank].store(state | decoded, std::memory_order_release);
+	return true;
+}
+
+size_t ChrRomCache::GetMemoryUsage() const
+{
+	size_t decodedBanks = 0;
+	for (int bank = 0; bank < m_bankCount; bank++)
+	{
+		uint8_t state = m_bankState[bank].load(std::memory_order_relaxed);
+		decodedBanks += ((state & kDecoded) != 0) + ((state & kFlippedDecoded) != 0);
+	}
+	return decodedBanks * kBankTiles * kTilePixels + m_bankCount;
+}
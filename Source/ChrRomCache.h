@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+
+/*
+	A cartridge's CHR ROM decoded to pixel values like ChrCache does, shared by every console running it (see
+	GameCartridge::GetChrRomCache). ROM never changes so there is nothing a console could dirty, each one only keeps
+	track of which tiles it has already checked on.
+
+	Banks (1KB, 64 tiles) are decoded the first time any console draws from them, flipped copies the first time any
+	console draws a sprite from them flipped. The pixel arrays are reserved for the whole ROM up front but only the
+	banks that get decoded are ever written. Consoles can be on different threads, a bank is decoded under a lock and
+	published with its state so everyone else only pays for an atomic load.
+*/
+class ChrRomCache
+{
+public:
+	static constexpr int kTileBytes = 16;
+	static constexpr int kTilePixels = 64;
+	static constexpr int kBankBytes = 0x0400;
+	static constexpr int kBankTiles = kBankBytes / kTileBytes;
+
+	// chr has to stay where it is for as long as the cache is alive
+	ChrRomCache(std::span<const uint8_t> chr);
+
+	std::span<const uint8_t> GetData() const { return m_chr; }
+
+	// Every tile, kTilePixels each, only valid in banks that BuildBank has been called for
+	const uint8_t* GetPixels(bool flipped) const { return flipped ? m_flippedPixels.get() : m_pixels.get(); }
+
+	// Makes sure bank is decoded, returns true if this call did the work
+	bool BuildBank(int bank, bool flipped);
+
+	// Pixels decoded so far
+	size_t GetMemoryUsage() const;
+
+private:
+	ChrRomCache(const ChrRomCache&) = delete;
+	ChrRomCache& operator=(const ChrRomCache&) = delete;
+
+	enum BankState : uint8_t
+	{
+		kDecoded = 0x01,
+		kFlippedDecoded = 0x02
+	};
+
+	std::span<const uint8_t> m_chr;
+	std::unique_ptr<uint8_t[]> m_pixels;
+	std::unique_ptr<uint8_t[]> m_flippedPixels;
+	std::unique_ptr<std::atomic<uint8_t>[]> m_bankState;
+	int m_bankCount = 0;
+	std::mutex m_mutex;
+};
@@ -0,0 +1,283 @@
+#include "ConsoleChecks.h"
+
+#include "BatchRunner.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <span>
+#include <sstream>
+
+uint64_t HashFrame(NES& nes)
+{
+	uint64_t hash = 14695981039346656037ull;
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(nes.PPU.GetScreenBuffer());
+	for (int i = 0; i < PPU::kScreenWidth * PPU::kScreenHeight * (int)sizeof(uint16_t); i++)
+	{
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool RunRendererCheck(const GameCartridge& game, int frames, std::string& report)
+{
+	std::unique_ptr<NES> scanline(new NES());
+	std::unique_ptr<NES> perDot(new NES());
+	NES* consoles[] = { scanline.get(), perDot.get() };
+	for (NES* nes : consoles)
+	{
+		nes->PowerOn();
+		nes->LoadGameCartridge(game);
+		nes->CPU.Reset();
+	}
+	perDot->SetScanlineRendering(false);
+
+	std::ostringstream result;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		scanline->ClockFullFrame();
+		perDot->ClockFullFrame();
+
+		if (HashFrame(*scanline) != HashFrame(*perDot))
+		{
+			result << "Frame " << frame << " differs\n";
+			report = result.str();
+			return false;
+		}
+	}
+
+	result << "All " << frames << " frames match\n";
+	report = result.str();
+	return true;
+}
+
+const std::vector<CpuCheckProgram>& GetCpuCheckPrograms()
+{
+	static const std::vector<CpuCheckProgram> programs =
+	{
+		{
+			// A branch leaves its target behind for the page cycle check of the next instruction, which only branches
+			// are supposed to see. Not taken, the target is right after the ADC.
+			"Branch then ADC (zp),Y",
+			{
+				0xA9, 0x00,       // $8000 LDA #$00
+				0x85, 0xF0,       // $8002 STA $F0
+				0xA9, 0x02,       // $8004 LDA #$02
+				0x85, 0xF1,       // $8006 STA $F1
+				0xA9, 0x10,       // $8008 LDA #$10
+				0x8D, 0x05, 0x02, // $800A STA $0205
+				0xA0, 0x05,       // $800D LDY #$05
+				0x38,             // $800F SEC
+				0x90, 0x02,       // $8010 BCC $8014
+				0x71, 0xF0,       // $8012 ADC ($F0),Y
+				0x85, 0x10,       // $8014 STA $10
+				0x18,             // $8016 CLC
+				0x90, 0x00,       // $8017 BCC $8019
+				0x71, 0xF0,       // $8019 ADC ($F0),Y
+				0x85, 0x11,       // $801B STA $11
+				0x4C, 0x1D, 0x80, // $801D JMP $801D
+			},
+			{ 0x40 }
+		},
+		{
+			// BRK pushes the status with I as it was, then sets it. The handler stores the pushed byte.
+			"BRK with I clear",
+			{
+				0xA9, 0x80,       // $8000 LDA #$80
+				0x58,             // $8002 CLI
+				0x00,             // $8003 BRK
+				0xEA,             // $8004 Skipped, BRK returns past it
+				0x08,             // $8005 PHP
+				0x68,             // $8006 PLA
+				0x85, 0x11,       // $8007 STA $11
+				0x4C, 0x09, 0x80, // $8009 JMP $8009
+			},
+			{
+				0x68,             // $9000 PLA
+				0x85, 0x10,       // $9001 STA $10
+				0x48,             // $9003 PHA
+				0x40,             // $9004 RTI
+			}
+		},
+	};
+	return programs;
+}
+
+bool LoadCpuCheckProgram(const CpuCheckProgram& program, GameCartridge& game)
+{
+	const size_t kPrgSize = 16 * 1024;
+	const uint16_t kIrqAddress = 0x9000;
+	const uint16_t kNmiAddress = 0xA000;
+
+	// One 16KB PRG bank mirrored at $C000, CHR RAM, mapper 0
+	std::vector<uint8_t> image = { 'N', 'E', 'S', 0x1A, 0x01, 0x00, 0x00, 0x00 };
+	image.resize(16 + kPrgSize, 0x00);
+	uint8_t* prg = image.data() + 16;
+
+	std::copy(program.code.begin(), program.code.end(), prg);
+	std::copy(program.irq.begin(), program.irq.end(), prg + (kIrqAddress & 0x3FFF));
+	prg[kNmiAddress & 0x3FFF] = 0x40; // RTI
+
+	const uint16_t vectors[] = { kNmiAddress, 0x8000, kIrqAddress };
+	for (int i = 0; i < 3; i++)
+	{
+		prg[0x3FFA + i * 2] = (uint8_t)(vectors[i] & 0x00FF);
+		prg[0x3FFB + i * 2] = (uint8_t)(vectors[i] >> 8);
+	}
+
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::temp_directory_path(error) / "nesx-cpu-check.nes";
+	if (error) return false;
+
+	FILE* file = fopen(path.string().c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+	fclose(file);
+
+	if (written) game.LoadRomFromFile(path.string());
+
+	// The cartridge keeps the file mapped, on Windows it stays around until the next check overwrites it
+	std::filesystem::remove(path, error);
+	return written && game.IsLoaded();
+}
+
+bool RunCpuTraceCheck(std::string& report)
+{
+	std::ostringstream result;
+#if CPU_THREADED_DISPATCH
+	const int kMaxInstructions = 1000;
+
+	for (const CpuCheckProgram& program : GetCpuCheckPrograms())
+	{
+		GameCartridge game;
+		if (!LoadCpuCheckProgram(program, game))
+		{
+			result << program.name << ": couldn't write the cartridge\n";
+			report = result.str();
+			return false;
+		}
+
+		std::unique_ptr<NES> stepped(new NES());
+		std::unique_ptr<NES> threaded(new NES());
+		NES* consoles[] = { stepped.get(), threaded.get() };
+		for (NES* nes : consoles)
+		{
+			nes->PowerOn();
+			nes->LoadGameCartridge(game);
+			nes->CPU.Reset();
+			nes->CPU.SkipCycles(nes->CPU.GetClockCycles());
+		}
+
+		int instruction = 0;
+		for (; instruction < kMaxInstructions; instruction++)
+		{
+			uint16_t pc = stepped->CPU.GetProgramCounter();
+			int steppedCycles = stepped->CPU.Step();
+
+			// A budget of one cycle is exactly one instruction, unless the threaded core hands it back
+			int threadedCycles = threaded->CPU.RunThreaded(1);
+			if (threadedCycles == 0) threadedCycles = threaded->CPU.Step();
+
+			CPU& a = stepped->CPU;
+			CPU& b = threaded->CPU;
+			if (steppedCycles != threadedCycles || a.GetProgramCounter() != b.GetProgramCounter() ||
+				a.GetRegA() != b.GetRegA() || a.GetRegX() != b.GetRegX() || a.GetRegY() != b.GetRegY() ||
+				a.GetStackPointer() != b.GetStackPointer() || a.GetStatus() != b.GetStatus())
+			{
+				result << std::hex << std::uppercase << std::setfill('0');
+				result << program.name << ": instruction " << std::dec << instruction << std::hex << " at $"
+					<< std::setw(4) << pc << " differs\n";
+				CPU* cpus[] = { &a, &b };
+				const char* names[] = { "Step       ", "RunThreaded" };
+				const int cycles[] = { steppedCycles, threadedCycles };
+				for (int i = 0; i < 2; i++)
+				{
+					CPU& cpu = *cpus[i];
+					result << "    " << names[i] << " PC $" << std::setw(4) << cpu.GetProgramCounter()
+						<< " A $" << std::setw(2) << (int)cpu.GetRegA() << " X $" << std::setw(2) << (int)cpu.GetRegX()
+						<< " Y $" << std::setw(2) << (int)cpu.GetRegY() << " SP $" << std::setw(2) << (int)cpu.GetStackPointer()
+						<< " P $" << std::setw(2) << (int)cpu.GetStatus() << std::dec << " " << cycles[i] << " cycles"
+						<< std::hex << "\n";
+				}
+				report = result.str();
+				return false;
+			}
+
+			// Spinning on the JMP at the end
+			if (a.GetProgramCounter() == pc) break;
+		}
+
+		std::span<const uint8_t> steppedRam = stepped->GetCpuRam();
+		std::span<const uint8_t> threadedRam = threaded->GetCpuRam();
+		for (size_t address = 0; address < steppedRam.size(); address++)
+		{
+			if (steppedRam[address] != threadedRam[address])
+			{
+				result << std::hex << std::uppercase << std::setfill('0');
+				result << program.name << ": RAM differs at $" << std::setw(4) << address << ", $" << std::setw(2)
+					<< (int)steppedRam[address] << " stepped, $" << std::setw(2) << (int)threadedRam[address]
+					<< " threaded\n";
+				report = result.str();
+				return false;
+			}
+		}
+
+		result << program.name << ": " << instruction + 1 << " instructions match\n";
+	}
+#else
+	result << "Only one CPU core in this build, nothing to compare\n";
+#endif
+	report = result.str();
+	return true;
+}
+
+bool RunLaneCheck(int instances, int frames, std::string& report)
+{
+	std::ostringstream result;
+#if CPU_THREADED_DISPATCH
+	for (const CpuCheckProgram& program : GetCpuCheckPrograms())
+	{
+		GameCartridge game;
+		if (!LoadCpuCheckProgram(program, game))
+		{
+			result << program.name << ": couldn't write the cartridge\n";
+			report = result.str();
+			return false;
+		}
+
+		std::unique_ptr<NES> lockstep(new NES());
+		lockstep->PowerOn();
+		lockstep->LoadGameCartridge(game);
+		lockstep->CPU.Reset();
+		lockstep->SetScheduler(NES::Scheduler::Lockstep);
+		for (int frame = 0; frame < frames; frame++)
+		{
+			lockstep->ClockFullFrame();
+		}
+
+		BatchRunner runner(game, instances, 1);
+		runner.SetLaneExecution(true);
+		runner.Step(frames);
+
+		std::span<const uint8_t> expected = lockstep->GetCpuRam();
+		for (int instance = 0; instance < instances; instance++)
+		{
+			if (memcmp(runner.GetRam(instance), expected.data(), BatchRunner::kRamSize) != 0)
+			{
+				result << program.name << ": console " << instance << " RAM differs from lockstep\n";
+				report = result.str();
+				return false;
+			}
+		}
+
+		result << program.name << ": RAM of all " << instances << " consoles matches lockstep\n";
+	}
+#else
+	result << "No lane execution in this build, nothing to compare\n";
+#endif
+	report = result.str();
+	return true;
+}
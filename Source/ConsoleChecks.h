@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GameCartridge.h"
+#include "NES.h"
+
+/*
+	Self checks that run the same thing two ways that have to give the exact same results and compare them. Shared by
+	WinMain and the nesx-batch front end (BatchMain.cpp), so they also run headless on Linux.
+	Each returns false on the first difference, report says what was compared and where it went wrong.
+*/
+
+// FNV-1a over the PPU pixels of the last frame
+uint64_t HashFrame(NES& nes);
+
+// Runs the game twice side by side, once drawing whole scanlines and once every dot through PPU::Cycle, and compares a
+// hash of every frame
+bool RunRendererCheck(const GameCartridge& game, int frames, std::string& report);
+
+// A few instructions that once ran differently on one of the CPU cores, as a 16KB NROM cartridge. Code starts at $8000,
+// BRK / IRQ go to irq at $9000 and NMI returns straight away. Each ends spinning on a JMP to itself with whatever it
+// wants compared left in RAM.
+struct CpuCheckProgram
+{
+	const char* name;
+	std::vector<uint8_t> code;
+	std::vector<uint8_t> irq;
+};
+
+const std::vector<CpuCheckProgram>& GetCpuCheckPrograms();
+
+// GameCartridge only loads from files, so the program goes through a temporary one. False if that can't be written.
+bool LoadCpuCheckProgram(const CpuCheckProgram& program, GameCartridge& game);
+
+// Steps every program one instruction at a time through CPU::Step on one console and CPU::RunThreaded on another and
+// compares the registers and cycles after each instruction, and RAM at the end. Step runs CPU::Exec in a
+// CPU_TEMPLATE_DISPATCH build and the address mode switch otherwise, build both ways to check all three cores.
+// Nothing to compare without CPU_THREADED_DISPATCH.
+bool RunCpuTraceCheck(std::string& report);
+
+// Runs every program on instances consoles side by side in lanes (see BatchRunner::SetLaneExecution) for frames frames
+// and compares the RAM of each against a console running the program in lockstep.
+// Nothing to compare without CPU_THREADED_DISPATCH.
+bool RunLaneCheck(int instances, int frames, std::string& report);
@@ -0,0 +1,578 @@
+#include "Dynarec.h"
+
+#if CPU_DYNAREC
+
+#include <algorithm>
+#include <cstring>
+
+#include "NES.h"
+
+namespace
+{
+	/* x86-64 registers */
+	enum Reg : uint8_t
+	{
+		RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+		R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+	};
+
+	// Everything the block keeps around lives in callee saved registers so the memory helpers can't clobber it
+	constexpr Reg kState = RBX;   // CPU::ThreadedState*
+	constexpr Reg kConsole = R12; // NES*
+	constexpr Reg kRegA = R13;
+	constexpr Reg kRegX = R14;
+	constexpr Reg kRegY = R15;
+	constexpr Reg kStatus = RBP;
+
+	/* Condition codes */
+	enum Cond : uint8_t
+	{
+		CondO = 0x0, CondC = 0x2, CondNC = 0x3, CondZ = 0x4, CondNZ = 0x5
+	};
+
+	/* Group opcode extensions */
+	enum AluOp : uint8_t { AluAdd = 0, AluOr = 1, AluAdc = 2, AluSbb = 3, AluAnd = 4, AluSub = 5, AluXor = 6 };
+	enum ShiftOp : uint8_t { ShiftRcl = 2, ShiftRcr = 3, ShiftShl = 4, ShiftShr = 5 };
+
+	/* Status flags, same layout as CPU::m_Status */
+	constexpr uint8_t kNegative = 0x80;
+	constexpr uint8_t kOverflow = 0x40;
+	constexpr uint8_t kUnused = 0x20;
+	constexpr uint8_t kBrk = 0x10;
+	constexpr uint8_t kDecimal = 0x08;
+	constexpr uint8_t kIrq = 0x04;
+	constexpr uint8_t kZero = 0x02;
+	constexpr uint8_t kCarry = 0x01;
+
+	// Called from the translated code with the SysV calling convention
+	uint32_t ReadMemory(NES* console, uint32_t address)
+	{
+		return console->ReadCpuMemory((uint16_t)address);
+	}
+
+	void WriteMemory(NES* console, uint32_t address, uint32_t data)
+	{
+		console->WriteCpuMemory((uint16_t)address, (uint8_t)data);
+	}
+
+	// Just enough of an x86-64 assembler for the translated blocks. Byte registers always get a REX prefix so
+	// bpl and r8b-r15b can be used.
+	class Emitter
+	{
+	public:
+		std::vector<uint8_t> code;
+
+		void Byte(uint8_t value) { code.push_back(value); }
+		void Word(uint16_t value) { Byte(value & 0xFF); Byte(value >> 8); }
+		void Dword(uint32_t value) { Word(value & 0xFFFF); Word(value >> 16); }
+		void Qword(uint64_t value) { Dword((uint32_t)value); Dword((uint32_t)(value >> 32)); }
+
+		void Rex(Reg reg, Reg rm) { Byte(0x40 | (reg >= 8 ? 0x04 : 0x00) | (rm >= 8 ? 0x01 : 0x00)); }
+		void ModRM(uint8_t mod, uint8_t reg, uint8_t rm) { Byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+		/* 8 bit register ops */
+		// dst = dst op src, opcode is the "op r/m8, r8" form
+		void Op8(uint8_t opCode, Reg dst, Reg src) { Rex(src, dst); Byte(opCode); ModRM(3, src, dst); }
+		void Mov8(Reg dst, Reg src) { Op8(0x88, dst, src); }
+		void Alu8(AluOp op, Reg dst, Reg src) { Op8((uint8_t)(op << 3), dst, src); }
+		void Test8(Reg a, Reg b) { Op8(0x84, a, b); }
+		void AluImm8(AluOp op, Reg dst, uint8_t imm) { Rex(RAX, dst); Byte(0x80); ModRM(3, op, dst); Byte(imm); }
+		void TestImm8(Reg reg, uint8_t imm) { Rex(RAX, reg); Byte(0xF6); ModRM(3, 0, reg); Byte(imm); }
+		void MovImm8(Reg dst, uint8_t imm) { Rex(RAX, dst); Byte(0xB0 + (dst & 7)); Byte(imm); }
+		void Inc8(Reg reg) { Rex(RAX, reg); Byte(0xFE); ModRM(3, 0, reg); }
+		void Dec8(Reg reg) { Rex(RAX, reg); Byte(0xFE); ModRM(3, 1, reg); }
+		void Shift8(ShiftOp op, Reg reg) { Rex(RAX, reg); Byte(0xD0); ModRM(3, op, reg); }
+		void ShlImm8(Reg reg, uint8_t count) { Rex(RAX, reg); Byte(0xC0); ModRM(3, ShiftShl, reg); Byte(count); }
+		void SetCC(Cond cond, Reg dst) { Rex(RAX, dst); Byte(0x0F); Byte(0x90 + cond); ModRM(3, 0, dst); }
+
+		/* 32 bit register ops */
+		void MovImm32(Reg dst, uint32_t imm) { if (dst >= 8) Byte(0x41); Byte(0xB8 + (dst & 7)); Dword(imm); }
+		void AluImm32(AluOp op, Reg dst, uint32_t imm) { if (dst >= 8) Byte(0x41); Byte(0x81); ModRM(3, op, dst); Dword(imm); }
+		void Movzx8(Reg dst, Reg src) { Rex(dst, src); Byte(0x0F); Byte(0xB6); ModRM(3, dst, src); }
+
+		/* [kState + offset] */
+		void LoadState8(Reg dst, uint8_t offset) { Rex(dst, kState); Byte(0x8A); ModRM(1, dst, kState); Byte(offset); }
+		void StoreState8(uint8_t offset, Reg src) { Rex(src, kState); Byte(0x88); ModRM(1, src, kState); Byte(offset); }
+		void MovzxState8(Reg dst, uint8_t offset) { Rex(dst, kState); Byte(0x0F); Byte(0xB6); ModRM(1, dst, kState); Byte(offset); }
+		void StoreStateImm16(uint8_t offset, uint16_t imm) { Byte(0x66); Byte(0xC7); ModRM(1, 0, kState); Byte(offset); Word(imm); }
+		void AddStateImm32(uint8_t offset, uint32_t imm) { Byte(0x81); ModRM(1, 0, kState); Byte(offset); Dword(imm); }
+		void IncState8(uint8_t offset) { Byte(0xFE); ModRM(1, 0, kState); Byte(offset); }
+		void DecState8(uint8_t offset) { Byte(0xFE); ModRM(1, 1, kState); Byte(offset); }
+
+		/* Carry */
+		void LoadCarry() { Byte(0x0F); Byte(0xBA); ModRM(3, 4, kStatus); Byte(0x00); } // bt ebp, 0
+		void ComplementCarry() { Byte(0xF5); }
+
+		/* Control flow */
+		void Push(Reg reg) { if (reg >= 8) Byte(0x41); Byte(0x50 + (reg & 7)); }
+		void Pop(Reg reg) { if (reg >= 8) Byte(0x41); Byte(0x58 + (reg & 7)); }
+		// Calls one of the memory helpers, the address has to be in esi and the data in dl already
+		void CallHelper(const void* function)
+		{
+			Byte(0x4C); Byte(0x89); ModRM(3, kConsole, RDI); // mov rdi, r12
+			Byte(0x48); Byte(0xB8); Qword((uint64_t)function); // mov rax, function
+			Byte(0xFF); ModRM(3, 2, RAX); // call rax
+		}
+
+		// Jumps return the offset of their rel32 to patch with Bind
+		size_t Jump() { Byte(0xE9); Dword(0); return code.size() - 4; }
+		size_t JumpIf(Cond cond) { Byte(0x0F); Byte(0x80 + cond); Dword(0); return code.size() - 4; }
+		void Bind(size_t jump)
+		{
+			uint32_t relative = (uint32_t)(code.size() - (jump + 4));
+			std::memcpy(&code[jump], &relative, sizeof(relative));
+		}
+	};
+}
+
+Dynarec::Dynarec(std::shared_ptr<DynarecCodeCache> codeCache)
+{
+	SetCodeCache(codeCache);
+}
+
+void Dynarec::SetCodeCache(std::shared_ptr<DynarecCodeCache> codeCache)
+{
+	// Slots get looked up in the new cache as they're run
+	m_codeCache = codeCache ? codeCache : std::make_shared<DynarecCodeCache>();
+	m_slots.fill(nullptr);
+}
+
+bool Dynarec::Run(CPU& cpu, CPU::ThreadedState& state, int cycleBudget)
+{
+	int slot = (state.pc - CPU::kDecodeCacheStart) / CPU::kDecodeCacheBankSize;
+	int offset = (state.pc - CPU::kDecodeCacheStart) % CPU::kDecodeCacheBankSize;
+
+	BankTable* table = m_slots[slot];
+	if (!table && !(table = BindSlot(cpu, slot)))
+		return false;
+
+	const Block* block = table->blocks[offset].load(std::memory_order_acquire);
+	if (!block)
+	{
+		// Racing another console only costs a count or a translation that AddBlock throws away
+		std::atomic<uint8_t>& heat = table->heat[offset];
+		uint8_t count = heat.load(std::memory_order_relaxed);
+		if (count >= kHotThreshold)
+			return false;
+
+		heat.store(++count, std::memory_order_relaxed);
+		if (count < kHotThreshold)
+			return false;
+
+		block = Compile(cpu, state.pc, *table, offset);
+	}
+
+	if (!block->code || state.cycles + block->maxCycles > cycleBudget)
+		return false;
+
+	block->code(&state, cpu.m_NES);
+	state.instructions += block->instructions;
+
+	m_stats.blockRuns++;
+	m_stats.instructions += block->instructions;
+	return true;
+}
+
+void Dynarec::Invalidate(uint16_t address)
+{
+	if (address < CPU::kDecodeCacheStart)
+		return;
+
+	// Whatever got translated for the old bank stays in the cache for when it's switched back in
+	int slot = (address - CPU::kDecodeCacheStart) / CPU::kDecodeCacheBankSize;
+	if (!m_slots[slot])
+		return;
+
+	m_slots[slot] = nullptr;
+	m_stats.invalidations++;
+}
+
+Dynarec::BankTable* Dynarec::BindSlot(CPU& cpu, int slot)
+{
+	// Only a slot mapped straight at 8KB of ROM can be translated, blocks are looked up by where that ROM is
+	uint16_t address = CPU::kDecodeCacheStart + slot * CPU::kDecodeCacheBankSize;
+	const uint8_t* bank = cpu.m_NES->GetCpuRomPage(address);
+	if (!bank)
+		return nullptr;
+
+	for (int page = 1; page < CPU::kDecodeCacheBankSize / NES::kCpuPageSize; page++)
+	{
+		if (cpu.m_NES->GetCpuRomPage(address + page * NES::kCpuPageSize) != bank + page * NES::kCpuPageSize)
+			return nullptr;
+	}
+
+	m_slots[slot] = &m_codeCache->GetBankTable(bank, slot);
+	return m_slots[slot];
+}
+
+const Dynarec::Block* Dynarec::Compile(CPU& cpu, uint16_t address, BankTable& table, int offset)
+{
+	typedef CPU::Mnemonic Mnemonic;
+	typedef CPU::AddressMode AddressMode;
+
+	Emitter e;
+
+	// Sets Z and N from value, Z from (value & andWith) when given for the ROL quirk
+	auto setZeroNegative = [&](Reg value, Reg andWith = RAX)
+	{
+		e.Mov8(R8, value);
+		if (andWith != RAX) e.Alu8(AluAnd, R8, andWith);
+		e.Test8(R8, R8);
+		e.SetCC(CondZ, R8);
+		e.ShlImm8(R8, 1);
+		e.Mov8(R9, value);
+		e.AluImm8(AluAnd, R9, kNegative);
+		e.Alu8(AluOr, R8, R9);
+		e.AluImm8(AluAnd, kStatus, (uint8_t)~(kZero | kNegative));
+		e.Alu8(AluOr, kStatus, R8);
+	};
+	// Copies the x86 carry (inverted for subtraction) into the carry flag, has to come right after the op
+	auto storeCarry = [&](bool inverted)
+	{
+		e.SetCC(inverted ? CondNC : CondC, RCX);
+		e.AluImm8(AluAnd, kStatus, (uint8_t)~kCarry);
+		e.Alu8(AluOr, kStatus, RCX);
+	};
+	auto storeCarryOverflow = [&](bool inverted)
+	{
+		e.SetCC(inverted ? CondNC : CondC, RCX);
+		e.SetCC(CondO, RDX);
+		e.ShlImm8(RDX, 6);
+		e.Alu8(AluOr, RCX, RDX);
+		e.AluImm8(AluAnd, kStatus, (uint8_t)~(kCarry | kOverflow));
+		e.Alu8(AluOr, kStatus, RCX);
+	};
+
+	// Effective address into esi
+	auto loadAddress = [&](const CPU::DecodedInstruction& decoded)
+	{
+		uint16_t base = (decoded.operandHigh << 8) | decoded.operandLow;
+		switch (decoded.instruction.addressMode)
+		{
+		case AddressMode::ZP:
+		case AddressMode::Absolute:
+			e.MovImm32(RSI, base);
+			break;
+		case AddressMode::ZPX:
+		case AddressMode::ZPY:
+			e.Movzx8(RSI, decoded.instruction.addressMode == AddressMode::ZPX ? kRegX : kRegY);
+			e.AluImm32(AluAdd, RSI, decoded.operandLow);
+			e.AluImm32(AluAnd, RSI, 0x00FF);
+			break;
+		case AddressMode::ABSX:
+		case AddressMode::ABSY:
+			e.Movzx8(RSI, decoded.instruction.addressMode == AddressMode::ABSX ? kRegX : kRegY);
+			e.AluImm32(AluAdd, RSI, base);
+			e.AluImm32(AluAnd, RSI, 0xFFFF);
+			break;
+		default:
+			break;
+		}
+	};
+	auto read = [&](const CPU::DecodedInstruction& decoded)
+	{
+		loadAddress(decoded);
+		e.CallHelper((const void*)&ReadMemory);
+	};
+	auto write = [&](const CPU::DecodedInstruction& decoded, Reg value)
+	{
+		loadAddress(decoded);
+		e.Mov8(RDX, value);
+		e.CallHelper((const void*)&WriteMemory);
+	};
+	// Operand into al
+	auto loadOperand = [&](const CPU::DecodedInstruction& decoded)
+	{
+		if (decoded.instruction.addressMode == AddressMode::IMM) e.MovImm8(RAX, decoded.operandLow);
+		else read(decoded);
+	};
+	auto pushValue = [&](Reg value)
+	{
+		e.MovzxState8(RSI, kOffsetSp);
+		e.AluImm32(AluAdd, RSI, 0x0100);
+		e.Mov8(RDX, value);
+		e.CallHelper((const void*)&WriteMemory);
+		e.DecState8(kOffsetSp);
+	};
+	auto pullValue = [&]()
+	{
+		e.IncState8(kOffsetSp);
+		e.MovzxState8(RSI, kOffsetSp);
+		e.AluImm32(AluAdd, RSI, 0x0100);
+		e.CallHelper((const void*)&ReadMemory);
+	};
+
+	// Only instructions that can't reach the PPU / IO registers or write to PRG ROM, and nothing that needs the stack
+	// for control flow
+	auto canTranslate = [&](const CPU::DecodedInstruction& decoded)
+	{
+		const Mnemonic op = decoded.instruction.mnemonic;
+		const AddressMode mode = decoded.instruction.addressMode;
+
+		bool writes = false;
+		switch (op)
+		{
+		case Mnemonic::STA: case Mnemonic::STX: case Mnemonic::STY:
+		case Mnemonic::INC: case Mnemonic::DEC:
+			writes = true;
+			break;
+		case Mnemonic::ASL: case Mnemonic::LSR: case Mnemonic::ROL: case Mnemonic::ROR:
+			writes = mode != AddressMode::Accum;
+			break;
+		case Mnemonic::NUL: case Mnemonic::BRK: case Mnemonic::RTI: case Mnemonic::JSR: case Mnemonic::RTS:
+			return false;
+		default:
+			break;
+		}
+
+		if (mode == AddressMode::INDX || mode == AddressMode::INDY || mode == AddressMode::Indirect)
+			return false;
+
+		if (op != Mnemonic::JMP && (mode == AddressMode::Absolute || mode == AddressMode::ABSX || mode == AddressMode::ABSY))
+		{
+			uint16_t base = (decoded.operandHigh << 8) | decoded.operandLow;
+			int range = (mode == AddressMode::Absolute) ? 1 : 256;
+			for (int i = 0; i < range; i++)
+			{
+				uint16_t target = (uint16_t)(base + i);
+				if (CPU::IsIoAddress(target) || (writes && target >= CPU::kDecodeCacheStart)) return false;
+			}
+		}
+
+		return true;
+	};
+
+	/* Prologue, entry rsp is 8 off 16 byte alignment and 6 pushes keep it that way */
+	e.Push(RBX); e.Push(RBP); e.Push(R12); e.Push(R13); e.Push(R14); e.Push(R15);
+	e.Byte(0x48); e.Byte(0x83); e.ModRM(3, 5, RSP); e.Byte(0x08); // sub rsp, 8
+	e.Byte(0x48); e.Byte(0x89); e.ModRM(3, RDI, kState); // mov rbx, rdi
+	e.Byte(0x49); e.Byte(0x89); e.ModRM(3, RSI, kConsole); // mov r12, rsi
+	e.LoadState8(kRegA, kOffsetA);
+	e.LoadState8(kRegX, kOffsetX);
+	e.LoadState8(kRegY, kOffsetY);
+	e.LoadState8(kStatus, kOffsetStatus);
+
+	const uint16_t bankEnd = CPU::kDecodeCacheStart + ((address - CPU::kDecodeCacheStart) / CPU::kDecodeCacheBankSize + 1) * CPU::kDecodeCacheBankSize - 1;
+
+	uint16_t pc = address;
+	int cycles = 0;
+	int maxCycles = 0;
+	int instructions = 0;
+	std::vector<size_t> exits;
+	bool ended = false;
+
+	while (!ended && instructions < kMaxBlockInstructions)
+	{
+		CPU::DecodedInstruction decoded;
+		cpu.DecodeInto(pc, decoded);
+
+		const CPU::Instruction instruction = decoded.instruction;
+		const Mnemonic op = instruction.mnemonic;
+		const AddressMode mode = instruction.addressMode;
+		const uint16_t ogPc = pc;
+		const uint16_t nextPc = pc + decoded.length;
+
+		// The whole instruction has to be in this bank so invalidating a bank can't miss it
+		if (decoded.length == 0 || (uint32_t)ogPc + decoded.length - 1 > bankEnd)
+			break;
+
+		if (!canTranslate(decoded))
+			break;
+
+		cycles += instruction.clockCycles;
+
+		// (address && 0xFF00) >> 8 is always 0, so the page boundary cycle only depends on the high byte
+		if (instruction.HasPageBoundaryCycle() && !instruction.HasBranchPageCycle()
+			&& (mode == AddressMode::ABSX || mode == AddressMode::ABSY) && decoded.operandHigh != 0)
+		{
+			cycles += 1;
+		}
+
+		instructions++;
+
+		/* Translate */
+		switch (op)
+		{
+		case Mnemonic::ADC:
+			loadOperand(decoded);
+			e.LoadCarry();
+			e.Alu8(AluAdc, kRegA, RAX);
+			storeCarryOverflow(false);
+			setZeroNegative(kRegA);
+			break;
+		case Mnemonic::SBC:
+			loadOperand(decoded);
+			e.LoadCarry();
+			e.ComplementCarry();
+			e.Alu8(AluSbb, kRegA, RAX);
+			storeCarryOverflow(true);
+			setZeroNegative(kRegA);
+			break;
+		case Mnemonic::AND: loadOperand(decoded); e.Alu8(AluAnd, kRegA, RAX); setZeroNegative(kRegA); break;
+		case Mnemonic::ORA: loadOperand(decoded); e.Alu8(AluOr, kRegA, RAX); setZeroNegative(kRegA); break;
+		case Mnemonic::EOR: loadOperand(decoded); e.Alu8(AluXor, kRegA, RAX); setZeroNegative(kRegA); break;
+		case Mnemonic::ASL:
+		case Mnemonic::LSR:
+		case Mnemonic::ROL:
+		case Mnemonic::ROR:
+		{
+			ShiftOp shift = (op == Mnemonic::ASL) ? ShiftShl : (op == Mnemonic::LSR) ? ShiftShr : (op == Mnemonic::ROL) ? ShiftRcl : ShiftRcr;
+			Reg value = (mode == AddressMode::Accum) ? kRegA : RAX;
+
+			if (mode != AddressMode::Accum) read(decoded);
+			if (op == Mnemonic::ROL || op == Mnemonic::ROR) e.LoadCarry();
+			e.Shift8(shift, value);
+			storeCarry(false);
+
+			// ROL sets zero from (result & A), which is just the result when rotating A
+			if (op == Mnemonic::ROL && mode != AddressMode::Accum) setZeroNegative(RAX, kRegA);
+			else setZeroNegative(value);
+
+			if (mode != AddressMode::Accum) write(decoded, RAX);
+			break;
+		}
+		case Mnemonic::BIT:
+			read(decoded);
+			e.Mov8(R8, RAX);
+			e.Alu8(AluAnd, R8, kRegA);
+			e.SetCC(CondZ, R8);
+			e.ShlImm8(R8, 1);
+			e.AluImm8(AluAnd, RAX, kNegative | kOverflow);
+			e.Alu8(AluOr, R8, RAX);
+			e.AluImm8(AluAnd, kStatus, (uint8_t)~(kZero | kNegative | kOverflow));
+			e.Alu8(AluOr, kStatus, R8);
+			break;
+		case Mnemonic::CMP:
+		case Mnemonic::CPX:
+		case Mnemonic::CPY:
+			loadOperand(decoded);
+			e.Mov8(RDX, (op == Mnemonic::CMP) ? kRegA : (op == Mnemonic::CPX) ? kRegX : kRegY);
+			e.Alu8(AluSub, RDX, RAX);
+			storeCarry(true);
+			setZeroNegative(RDX);
+			break;
+		case Mnemonic::INC:
+		case Mnemonic::DEC:
+			read(decoded);
+			if (op == Mnemonic::INC) e.Inc8(RAX); else e.Dec8(RAX);
+			setZeroNegative(RAX);
+			write(decoded, RAX);
+			break;
+		case Mnemonic::INX: e.Inc8(kRegX); setZeroNegative(kRegX); break;
+		case Mnemonic::INY: e.Inc8(kRegY); setZeroNegative(kRegY); break;
+		case Mnemonic::DEX: e.Dec8(kRegX); setZeroNegative(kRegX); break;
+		case Mnemonic::DEY: e.Dec8(kRegY); setZeroNegative(kRegY); break;
+		case Mnemonic::LDA: loadOperand(decoded); e.Mov8(kRegA, RAX); setZeroNegative(kRegA); break;
+		case Mnemonic::LDX: loadOperand(decoded); e.Mov8(kRegX, RAX); setZeroNegative(kRegX); break;
+		case Mnemonic::LDY: loadOperand(decoded); e.Mov8(kRegY, RAX); setZeroNegative(kRegY); break;
+		case Mnemonic::STA: write(decoded, kRegA); break;
+		case Mnemonic::STX: write(decoded, kRegX); break;
+		case Mnemonic::STY: write(decoded, kRegY); break;
+		case Mnemonic::TAX: e.Mov8(kRegX, kRegA); setZeroNegative(kRegX); break;
+		case Mnemonic::TAY: e.Mov8(kRegY, kRegA); setZeroNegative(kRegY); break;
+		case Mnemonic::TXA: e.Mov8(kRegA, kRegX); setZeroNegative(kRegA); break;
+		case Mnemonic::TYA: e.Mov8(kRegA, kRegY); setZeroNegative(kRegA); break;
+		case Mnemonic::TSX: e.LoadState8(kRegX, kOffsetSp); setZeroNegative(kRegX); break;
+		case Mnemonic::TXS: e.StoreState8(kOffsetSp, kRegX); break;
+		case Mnemonic::PHA: pushValue(kRegA); break;
+		case Mnemonic::PHP:
+			e.Mov8(RCX, kStatus);
+			e.AluImm8(AluOr, RCX, kUnused | kBrk);
+			pushValue(RCX);
+			break;
+		case Mnemonic::PLA: pullValue(); e.Mov8(kRegA, RAX); setZeroNegative(kRegA); break;
+		case Mnemonic::PLP: pullValue(); e.Mov8(kStatus, RAX); break;
+		case Mnemonic::CLC: e.AluImm8(AluAnd, kStatus, (uint8_t)~kCarry); break;
+		case Mnemonic::CLD: e.AluImm8(AluAnd, kStatus, (uint8_t)~kDecimal); break;
+		case Mnemonic::CLI: e.AluImm8(AluAnd, kStatus, (uint8_t)~kIrq); break;
+		case Mnemonic::CLV: e.AluImm8(AluAnd, kStatus, (uint8_t)~kOverflow); break;
+		case Mnemonic::SEC: e.AluImm8(AluOr, kStatus, kCarry); break;
+		case Mnemonic::SED: e.AluImm8(AluOr, kStatus, kDecimal); break;
+		case Mnemonic::SEI: e.AluImm8(AluOr, kStatus, kIrq); break;
+		case Mnemonic::NOP: break;
+		case Mnemonic::JMP:
+		{
+			uint16_t target = (decoded.operandHigh << 8) | decoded.operandLow;
+			e.StoreStateImm16(kOffsetPc, target);
+			e.AddStateImm32(kOffsetCycles, cycles);
+			maxCycles = cycles;
+			ended = true;
+			break;
+		}
+		case Mnemonic::BCC: case Mnemonic::BCS: case Mnemonic::BEQ: case Mnemonic::BNE:
+		case Mnemonic::BMI: case Mnemonic::BPL: case Mnemonic::BVC: case Mnemonic::BVS:
+		{
+			uint16_t branchLocation = nextPc + (int8_t)decoded.operandLow;
+
+			// Same rules as EvaluatePC, worked out for both ways the branch can go
+			auto exitCycles = [&](uint16_t newPc, bool taken)
+			{
+				int total = cycles;
+				if (taken) total += cpu.OnSamePage(nextPc, branchLocation) ? 1 : 2;
+				if (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle() && newPc == branchLocation)
+				{
+					total += 1;
+					if (!cpu.AreAddrsOnSamePage(ogPc, newPc)) total += 1;
+				}
+				return total;
+			};
+			int takenCycles = exitCycles(branchLocation, true);
+			int notTakenCycles = exitCycles(nextPc, false);
+
+			uint8_t mask = (op == Mnemonic::BCC || op == Mnemonic::BCS) ? kCarry
+				: (op == Mnemonic::BEQ || op == Mnemonic::BNE) ? kZero
+				: (op == Mnemonic::BMI || op == Mnemonic::BPL) ? kNegative : kOverflow;
+			bool takenWhenSet = op == Mnemonic::BCS || op == Mnemonic::BEQ || op == Mnemonic::BMI || op == Mnemonic::BVS;
+
+			e.TestImm8(kStatus, mask);
+			size_t taken = e.JumpIf(takenWhenSet ? CondNZ : CondZ);
+
+			e.StoreStateImm16(kOffsetPc, nextPc);
+			e.AddStateImm32(kOffsetCycles, notTakenCycles);
+			exits.push_back(e.Jump());
+
+			e.Bind(taken);
+			e.StoreStateImm16(kOffsetPc, branchLocation);
+			e.AddStateImm32(kOffsetCycles, takenCycles);
+
+			maxCycles = std::max(takenCycles, notTakenCycles);
+			ended = true;
+			break;
+		}
+		default:
+			// Filtered out above
+			break;
+		}
+
+		pc = nextPc;
+	}
+
+	if (instructions == 0)
+	{
+		// Stored as untranslatable so nobody tries again
+		m_stats.blocksRejected++;
+		return m_codeCache->AddBlock(table, offset, {}, 0, 0);
+	}
+
+	if (!ended)
+	{
+		e.StoreStateImm16(kOffsetPc, pc);
+		e.AddStateImm32(kOffsetCycles, cycles);
+		maxCycles = cycles;
+	}
+
+	/* Epilogue */
+	for (size_t exit : exits) e.Bind(exit);
+	e.StoreState8(kOffsetA, kRegA);
+	e.StoreState8(kOffsetX, kRegX);
+	e.StoreState8(kOffsetY, kRegY);
+	e.StoreState8(kOffsetStatus, kStatus);
+	e.Byte(0x48); e.Byte(0x83); e.ModRM(3, 0, RSP); e.Byte(0x08); // add rsp, 8
+	e.Pop(R15); e.Pop(R14); e.Pop(R13); e.Pop(R12); e.Pop(RBP); e.Pop(RBX);
+	e.Byte(0xC3); // ret
+
+	m_stats.blocksCompiled++;
+	return m_codeCache->AddBlock(table, offset, e.code, (uint16_t)maxCycles, (uint16_t)instructions);
+}
+
+#endif
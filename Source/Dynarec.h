@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CPU.h"
+#include "DynarecCodeCache.h"
+
+#if CPU_DYNAREC
+
+class NES;
+
+/*
+	Translates hot PRG ROM basic blocks into native x86-64 code and runs them from CPU::RunThreaded.
+
+	Every PRG ROM address has an execution counter, once it reaches kHotThreshold the block starting there gets
+	translated. A block is a run of instructions whose memory accesses are all known not to touch the PPU / IO registers
+	($2000-$401F) or PRG ROM, it stops before the first instruction that can't promise that and after the first branch
+	or jump. Every cycle a block takes is known at translation time (taken / not taken for the branch at the end), so
+	the threaded core only enters it when the whole block fits in its cycle budget and the PPU catch-up and NMI land
+	on the same cycle as with the interpreter.
+
+	Code running from RAM is never translated, so self modifying code there always goes through the interpreter.
+	Blocks and counters live in a DynarecCodeCache shared with every console running the same cartridge, each console
+	only keeps which table to look in for each of the four 8KB PRG slots. A bank switch just looks the slot up again.
+*/
+class Dynarec
+{
+public:
+	// Starts out with a cache of its own, see SetCodeCache
+	Dynarec(std::shared_ptr<DynarecCodeCache> codeCache = nullptr);
+
+	// Times a block start has to run before it gets translated
+	static constexpr uint8_t kHotThreshold = 32;
+	static constexpr int kMaxBlockInstructions = 64;
+
+	struct Stats
+	{
+		uint64_t blocksCompiled = 0; // By this console, the others may have translated more of what it runs
+		uint64_t blocksRejected = 0; // Hot addresses where not even the first instruction could be translated
+		uint64_t blockRuns = 0;
+		uint64_t instructions = 0; // Instructions executed by translated blocks
+		uint64_t invalidations = 0;
+		uint64_t mappingFailures = 0; // Of the shared code cache, see DynarecCodeCache::GetMappingFailures
+	};
+
+	// False when no code memory could be mapped executable, the interpreter is used for everything then
+	bool IsAvailable() { return m_codeCache->IsAvailable(); }
+
+	// Runtime switch, handy to A/B the translated code against the interpreter
+	void SetEnabled(bool enabled) { m_enabled = enabled; }
+	bool IsEnabled() { return m_enabled && IsAvailable(); }
+
+	// Shares translated blocks with the other consoles using the same cache, see GameCartridge::GetDynarecCodeCache.
+	// Null gives the console a cache of its own.
+	void SetCodeCache(std::shared_ptr<DynarecCodeCache> codeCache);
+	const std::shared_ptr<DynarecCodeCache>& GetCodeCache() { return m_codeCache; }
+
+	const Stats& GetStats()
+	{
+		m_stats.mappingFailures = m_codeCache->GetMappingFailures();
+		return m_stats;
+	}
+
+	// Runs the block starting at state.pc if there is one and it fits in the cycle budget, translating it once it's hot.
+	// Returns false without touching the state if the instruction has to go through the interpreter instead.
+	bool Run(CPU& cpu, CPU::ThreadedState& state, int cycleBudget);
+
+	// The 8KB PRG slot containing address got switched to another bank
+	void Invalidate(uint16_t address);
+
+private:
+	Dynarec(const Dynarec&) = delete;
+	Dynarec& operator=(const Dynarec&) = delete;
+
+	typedef DynarecCodeCache::Block Block;
+	typedef DynarecCodeCache::BankTable BankTable;
+
+	BankTable* BindSlot(CPU& cpu, int slot);
+	const Block* Compile(CPU& cpu, uint16_t address, BankTable& table, int offset);
+
+	/* Where the translated code finds the registers */
+	static constexpr uint8_t kOffsetPc = offsetof(CPU::ThreadedState, pc);
+	static constexpr uint8_t kOffsetA = offsetof(CPU::ThreadedState, a);
+	static constexpr uint8_t kOffsetX = offsetof(CPU::ThreadedState, x);
+	static constexpr uint8_t kOffsetY = offsetof(CPU::ThreadedState, y);
+	static constexpr uint8_t kOffsetSp = offsetof(CPU::ThreadedState, sp);
+	static constexpr uint8_t kOffsetStatus = offsetof(CPU::ThreadedState, status);
+	static constexpr uint8_t kOffsetCycles = offsetof(CPU::ThreadedState, cycles);
+
+	bool m_enabled = true;
+
+	std::shared_ptr<DynarecCodeCache> m_codeCache;
+	std::array<BankTable*, CPU::kDecodeCacheBanks> m_slots = {}; // Null until the slot is looked up
+
+	Stats m_stats;
+};
+
+#endif
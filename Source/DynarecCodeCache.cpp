@@ -0,0 +1,108 @@
+#include "DynarecCodeCache.h"
+
+#if CPU_DYNAREC
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+const DynarecCodeCache::Block DynarecCodeCache::kUntranslatable;
+
+DynarecCodeCache::~DynarecCodeCache()
+{
+	for (uint8_t* chunk : m_chunks)
+	{
+		munmap(chunk, kCodeChunkSize);
+	}
+}
+
+DynarecCodeCache::BankTable& DynarecCodeCache::GetBankTable(const uint8_t* bank, int slot)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::unique_ptr<BankTable>& table = m_tables[{ bank, slot }];
+	if (!table)
+	{
+		table.reset(new BankTable());
+	}
+	return *table;
+}
+
+const DynarecCodeCache::Block* DynarecCodeCache::AddBlock(BankTable& table, int offset, const std::vector<uint8_t>& code,
+	uint16_t maxCycles, uint16_t instructions)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (const Block* existing = table.blocks[offset].load(std::memory_order_relaxed))
+		return existing;
+
+	const Block* block = &kUntranslatable;
+	size_t size = PageAlign(code.size());
+	uint8_t* memory = code.empty() ? nullptr : AllocateCode(size);
+	if (memory)
+	{
+		// Written while the pages are still RW, then sealed RX for good before any console can see the block
+		std::memcpy(memory, code.data(), code.size());
+		if (mprotect(memory, size, PROT_READ | PROT_EXEC) == 0)
+		{
+			Block translated;
+			translated.code = (BlockFunction)memory;
+			translated.maxCycles = maxCycles;
+			translated.instructions = instructions;
+			m_blocks.push_back(translated);
+			block = &m_blocks.back();
+		}
+		else
+		{
+			m_mappingFailures.fetch_add(1, std::memory_order_relaxed);
+			m_available.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// Other threads pick it up without the lock, the code has to be written before they can see it
+	table.blocks[offset].store(block, std::memory_order_release);
+	return block;
+}
+
+size_t DynarecCodeCache::PageAlign(size_t size)
+{
+	static const size_t kPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	return (size + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+uint8_t* DynarecCodeCache::AllocateCode(size_t size)
+{
+	if (size > kCodeChunkSize)
+		return nullptr;
+
+	// Sealed pages are never written again, so every block starts on a fresh page
+	if (m_chunkUsed + size > kCodeChunkSize)
+	{
+		// The rest of the last chunk goes unused, blocks are small next to it
+		if (!IsAvailable() || (m_chunks.size() + 1) * kCodeChunkSize > kMaxCodeSize)
+			return nullptr;
+
+		void* chunk = mmap(nullptr, kCodeChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk == MAP_FAILED)
+		{
+			m_mappingFailures.fetch_add(1, std::memory_order_relaxed);
+			m_available.store(false, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		m_chunks.push_back((uint8_t*)chunk);
+		m_chunkUsed = 0;
+	}
+
+	uint8_t* memory = m_chunks.back() + m_chunkUsed;
+	m_chunkUsed += size;
+	m_codeUsed += size;
+	return memory;
+}
+
+size_t DynarecCodeCache::GetMemoryUsage()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_codeUsed + m_blocks.size() * sizeof(Block) + m_tables.size() * sizeof(BankTable);
+}
+
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "CPU.h"
+
+#if CPU_DYNAREC
+
+class NES;
+
+/*
+	The translated blocks of one cartridge, shared by every console running it (see GameCartridge::GetDynarecCodeCache).
+
+	A translation only depends on the PRG ROM bytes and the address they run at, so blocks are kept per 8KB bank of PRG
+	ROM and CPU slot it's mapped at. A console switching a bank back in finds what it (or any other console) translated
+	there before, and the consoles of a BatchRunner share one copy of the code instead of each translating their own.
+
+	Consoles can run on different threads. Looking up a block is an atomic load, adding one takes a lock. Code memory is
+	mapped a chunk at a time when the first block needs it and is never freed or moved while the cache is alive, since a
+	console could be running any of it.
+
+	Memory is never writable and executable at once. A chunk is mapped RW, each block is copied into pages of its own
+	and those are switched to RX before the block is published, so hosts that refuse W+X mappings still translate.
+*/
+class DynarecCodeCache
+{
+public:
+	typedef void(*BlockFunction)(CPU::ThreadedState* state, NES* console);
+
+	struct Block
+	{
+		BlockFunction code = nullptr; // Null where nothing can be translated
+		uint16_t maxCycles = 0;
+		uint16_t instructions = 0;
+	};
+
+	// One 8KB bank of PRG ROM as seen from one CPU slot, indexed by the offset into the bank
+	struct BankTable
+	{
+		std::array<std::atomic<const Block*>, CPU::kDecodeCacheBankSize> blocks = {}; // Null until it gets hot
+		std::array<std::atomic<uint8_t>, CPU::kDecodeCacheBankSize> heat = {};
+	};
+
+	static constexpr size_t kCodeChunkSize = 1024 * 1024;
+	static constexpr size_t kMaxCodeSize = 32 * 1024 * 1024;
+
+	DynarecCodeCache() {}
+	~DynarecCodeCache();
+
+	// bank is where the 8KB of PRG ROM mapped at slot (counted from CPU::kDecodeCacheStart) start
+	BankTable& GetBankTable(const uint8_t* bank, int slot);
+
+	// Stores a block at table.blocks[offset] unless another console got there first, returns whichever is stored.
+	// The code gets copied to executable memory, rounded up to whole pages. No code, or no memory left for it, stores an
+	// untranslatable block.
+	const Block* AddBlock(BankTable& table, int offset, const std::vector<uint8_t>& code, uint16_t maxCycles,
+		uint16_t instructions);
+
+	// False once mapping executable memory failed
+	bool IsAvailable() const { return m_available.load(std::memory_order_relaxed); }
+
+	// Chunks that couldn't be mapped and blocks that couldn't be made executable, the first one turns IsAvailable off
+	uint64_t GetMappingFailures() const { return m_mappingFailures.load(std::memory_order_relaxed); }
+
+	// Code in use, blocks and tables
+	size_t GetMemoryUsage();
+
+private:
+	DynarecCodeCache(const DynarecCodeCache&) = delete;
+	DynarecCodeCache& operator=(const DynarecCodeCache&) = delete;
+
+	static size_t PageAlign(size_t size);
+	uint8_t* AllocateCode(size_t size); // size in whole pages
+
+	static const Block kUntranslatable;
+
+	std::mutex m_mutex;
+	std::map<std::pair<const uint8_t*, int>, std::unique_ptr<BankTable>> m_tables;
+	std::deque<Block> m_blocks; // Never move, the tables point at them
+
+	std::vector<uint8_t*> m_chunks;
+	size_t m_chunkUsed = kCodeChunkSize; // The first block maps a chunk
+	size_t m_codeUsed = 0;
+	std::atomic<bool> m_available = true;
+	std::atomic<uint64_t> m_mappingFailures = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "EmulationThread.h"
+
+#include <algorithm>
+
+#include "NES.h"
+
+EmulationThread::EmulationThread(NES& nes)
+	: m_nes(nes)
+{
+}
+
+EmulationThread::~EmulationThread()
+{
+	Stop();
+}
+
+void EmulationThread::Start(std::chrono::nanoseconds frameInterval)
+{
+	if (m_thread.joinable())
+		return;
+
+	m_quit.store(false, std::memory_order_relaxed);
+	m_thread = std::thread(&EmulationThread::Run, this, frameInterval);
+}
+
+void EmulationThread::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+
+	m_quit.store(true, std::memory_order_relaxed);
+	m_thread.join();
+}
+
+bool EmulationThread::PushInput(uint8_t firstController, uint8_t secondController)
+{
+	InputEvent event;
+	event.time = Clock::now();
+	event.firstController = firstController;
+	event.secondController = secondController;
+	return m_inputs.Push(event);
+}
+
+const EmulationThread::Frame* EmulationThread::TakeNewestFrame()
+{
+	return m_frames.TakeNewest() ? &m_frames.GetFrontBuffer() : nullptr;
+}
+
+void EmulationThread::Run(std::chrono::nanoseconds frameInterval)
+{
+	Clock::time_point nextFrame = Clock::now();
+	uint64_t number = m_framesEmulated.load(std::memory_order_relaxed);
+
+	while (!m_quit.load(std::memory_order_relaxed))
+	{
+		if (frameInterval.count() > 0)
+		{
+			// Sleep to the next frame's start, counted from the last one so the rate doesn't drift. After a long stall
+			// (a debugger, the machine sleeping) start over from now instead of racing to catch up.
+			nextFrame += frameInterval;
+			Clock::time_point now = Clock::now();
+			if (now > nextFrame + frameInterval)
+			{
+				nextFrame = now;
+			}
+			else
+			{
+				std::this_thread::sleep_until(nextFrame);
+			}
+		}
+
+		ApplyInput(Clock::now());
+		m_nes.ClockFullFrame();
+
+		Frame& frame = m_frames.GetBackBuffer();
+		std::copy_n(m_nes.PPU.GetScreenBuffer(), frame.pixels.size(), frame.pixels.begin());
+		frame.number = ++number;
+		m_frames.Publish();
+
+		m_framesEmulated.store(number, std::memory_order_relaxed);
+	}
+}
+
+void EmulationThread::ApplyInput(Clock::time_point frameStart)
+{
+	// Changes from after the frame started wait for the next one
+	while (const InputEvent* event = m_inputs.Front())
+	{
+		if (event->time > frameStart)
+			break;
+
+		m_nes.SetFirstControllerState(event->firstController);
+		m_nes.SetSecondControllerState(event->secondController);
+		m_inputs.Pop();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "PPU.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+class NES;
+
+/*
+	Runs a console on a thread of its own, so presenting a frame (waiting for vsync, a slow driver) never holds up
+	emulation and emulation never holds up the window.
+
+	Finished frames go out through a triple buffer and the presenting thread always takes the newest one, frames it
+	didn't get to in time are skipped rather than queued up. Controller input comes in the other way through a queue,
+	each change stamped with when it happened. A frame picks up every change from before it started, so input lands on
+	the same frame no matter when the presenting thread got around to sending it.
+
+	Everything here besides Start / Stop is called from one presenting thread, nothing touches the NES from outside
+	while the thread is running.
+*/
+class EmulationThread
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// NTSC runs at 60.0988 frames per second
+	static constexpr std::chrono::nanoseconds kNtscFrameInterval = std::chrono::nanoseconds(16639267);
+
+	struct Frame
+	{
+		std::array<uint16_t, PPU::kScreenWidth * PPU::kScreenHeight> pixels; // See PPU::GetScreenBuffer
+		uint64_t number = 0; // Counts from 1, a gap since the last frame taken means frames were skipped
+	};
+
+	struct InputEvent
+	{
+		Clock::time_point time;
+		uint8_t firstController = 0x00;
+		uint8_t secondController = 0x00;
+	};
+
+	EmulationThread(NES& nes);
+	~EmulationThread();
+
+	// frameInterval 0 runs as fast as it can
+	void Start(std::chrono::nanoseconds frameInterval = kNtscFrameInterval);
+	void Stop();
+
+	// New controller state as of now, false if the emulation thread is too far behind to take more
+	bool PushInput(uint8_t firstController, uint8_t secondController);
+
+	// The newest frame, null if there isn't one since the last call. Stays valid until the next call.
+	const Frame* TakeNewestFrame();
+
+	uint64_t GetFramesEmulated() const { return m_framesEmulated.load(std::memory_order_relaxed); }
+
+private:
+	EmulationThread(const EmulationThread&) = delete;
+	EmulationThread& operator=(const EmulationThread&) = delete;
+
+	void Run(std::chrono::nanoseconds frameInterval);
+	void ApplyInput(Clock::time_point frameStart);
+
+	NES& m_nes;
+	std::thread m_thread;
+	std::atomic<bool> m_quit = false;
+
+	TripleBuffer<Frame> m_frames;
+	SpscQueue<InputEvent, 256> m_inputs;
+	std::atomic<uint64_t> m_framesEmulated = 0;
+};
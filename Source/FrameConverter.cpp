@@ -0,0 +1,178 @@
+#include "FrameConverter.h"
+
+#include "PPU.h"
+
+// Gathers need AVX2 (/arch:AVX2 or -mavx2), without them it's a plain table lookup
+#if defined(__AVX2__)
+#define FRAME_CONVERTER_AVX2 1
+#include <immintrin.h>
+#else
+#define FRAME_CONVERTER_AVX2 0
+#endif
+
+// 2C02 palette, the same for every PPU
+const NesColor FrameConverter::kNesColors[0x40] =
+{
+	NesColor(84, 84, 84),
+	NesColor(0, 30, 116),
+	NesColor(8, 16, 144),
+	NesColor(48, 0, 136),
+	NesColor(68, 0, 100),
+	NesColor(92, 0, 48),
+	NesColor(84, 4, 0),
+	NesColor(60, 24, 0),
+	NesColor(32, 42, 0),
+	NesColor(8, 58, 0),
+	NesColor(0, 64, 0),
+	NesColor(0, 60, 0),
+	NesColor(0, 50, 60),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+	NesColor(152, 150, 152),
+	NesColor(8, 76, 196),
+	NesColor(48, 50, 236),
+	NesColor(92, 30, 228),
+	NesColor(136, 20, 176),
+	NesColor(160, 20, 100),
+	NesColor(152, 34, 32),
+	NesColor(120, 60, 0),
+	NesColor(84, 90, 0),
+	NesColor(40, 114, 0),
+	NesColor(8, 124, 0),
+	NesColor(0, 118, 40),
+	NesColor(0, 102, 120),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+	NesColor(236, 238, 236),
+	NesColor(76, 154, 236),
+	NesColor(120, 124, 236),
+	NesColor(176, 98, 236),
+	NesColor(228, 84, 236),
+	NesColor(236, 88, 180),
+	NesColor(236, 106, 100),
+	NesColor(212, 136, 32),
+	NesColor(160, 170, 0),
+	NesColor(116, 196, 0),
+	NesColor(76, 208, 32),
+	NesColor(56, 204, 108),
+	NesColor(56, 180, 204),
+	NesColor(60, 60, 60),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+	NesColor(236, 238, 236),
+	NesColor(168, 204, 236),
+	NesColor(188, 188, 236),
+	NesColor(212, 178, 236),
+	NesColor(236, 174, 236),
+	NesColor(236, 174, 212),
+	NesColor(236, 180, 176),
+	NesColor(228, 196, 144),
+	NesColor(204, 210, 120),
+	NesColor(180, 222, 120),
+	NesColor(168, 226, 144),
+	NesColor(152, 226, 180),
+	NesColor(160, 214, 228),
+	NesColor(160, 162, 160),
+	NesColor(0, 0, 0),
+	NesColor(0, 0, 0),
+};
+
+FrameConverter::FrameConverter(PixelFormat format)
+	: m_format(format)
+{
+	for (int pixel = 0; pixel < (int)m_table.size(); pixel++)
+	{
+		// Grayscale keeps only the brightness column of the color
+		uint8_t color = pixel & PPU::kPixelColorMask;
+		if (pixel & PPU::kPixelGrayscale) color &= 0x30;
+
+		// Each emphasis bit darkens the other two channels
+		float channels[3] = { (float)kNesColors[color].r, (float)kNesColors[color].g, (float)kNesColors[color].b };
+		uint8_t emphasis = (pixel >> PPU::kPixelEmphasisShift) & 0x07; // Red, green, blue
+		for (int bit = 0; bit < 3; bit++)
+		{
+			if ((emphasis & (1 << bit)) == 0) continue;
+			for (int channel = 0; channel < 3; channel++)
+			{
+				if (channel != bit) channels[channel] *= 0.816f;
+			}
+		}
+		uint32_t r = (uint32_t)channels[0];
+		uint32_t g = (uint32_t)channels[1];
+		uint32_t b = (uint32_t)channels[2];
+
+		switch (m_format)
+		{
+		case PixelFormat::RGBA8: m_table[pixel] = r | (g << 8) | (b << 16) | 0xFF000000; break;
+		case PixelFormat::BGRA8: m_table[pixel] = b | (g << 8) | (r << 16) | 0xFF000000; break;
+		case PixelFormat::RGB565: m_table[pixel] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3); break;
+		case PixelFormat::Gray8: m_table[pixel] = (r * 77 + g * 150 + b * 29) >> 8; break;
+		}
+	}
+}
+
+int FrameConverter::GetBytesPerPixel() const
+{
+	switch (m_format)
+	{
+	case PixelFormat::RGB565: return 2;
+	case PixelFormat::Gray8: return 1;
+	default: return 4;
+	}
+}
+
+// Table entries are 32 bits whatever the format, narrower formats just keep the low bits
+template<typename T>
+static void LookUpPixels(const uint32_t* table, const uint16_t* pixels, int count, T* out)
+{
+	int i = 0;
+
+#if FRAME_CONVERTER_AVX2
+	// 16 pixels at a time, two gathers of 8 then packed down to the output width
+	const __m256i mask = _mm256_set1_epi32(0x03FF);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i low = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i)));
+		__m256i high = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i + 8)));
+		low = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), _mm256_and_si256(low, mask), 4);
+		high = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), _mm256_and_si256(high, mask), 4);
+
+		if constexpr (sizeof(T) == 4)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), low);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), high);
+		}
+		else
+		{
+			// Packing works within 128 bit lanes, the permute puts the 16 results back in order
+			__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+			if constexpr (sizeof(T) == 2)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), words);
+			}
+			else
+			{
+				__m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		out[i] = (T)table[pixels[i] & 0x03FF];
+	}
+}
+
+void FrameConverter::Convert(const uint16_t* pixels, int count, void* out) const
+{
+	switch (GetBytesPerPixel())
+	{
+	case 4: LookUpPixels(m_table.data(), pixels, count, static_cast<uint32_t*>(out)); break;
+	case 2: LookUpPixels(m_table.data(), pixels, count, static_cast<uint16_t*>(out)); break;
+	default: LookUpPixels(m_table.data(), pixels, count, static_cast<uint8_t*>(out)); break;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+struct NesColor
+{
+	union
+	{
+		uint32_t n = 0;
+		struct { uint8_t r; uint8_t g; uint8_t b; uint8_t a; };
+	};
+
+	NesColor() {}
+	NesColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha = 0x00)
+	{
+		n = red | (green << 8) | (blue << 16) | (alpha << 24);
+	}
+};
+
+/*
+	Turns a frame of PPU pixels (see PPU::GetScreenBuffer) into pixels for the host, once per frame.
+
+	A PPU pixel is the NES color plus the $2001 emphasis and grayscale bits it was drawn with, 1024 combinations in
+	all. Each one is converted once into a table for the target format, so emphasis and grayscale cost nothing per
+	pixel and the conversion is a single lookup.
+	Reference: https://www.nesdev.org/wiki/PPU_palettes
+*/
+class FrameConverter
+{
+public:
+	enum class PixelFormat
+	{
+		RGBA8, // Bytes in R, G, B, A order
+		BGRA8, // Bytes in B, G, R, A order
+		RGB565, // 16 bits, red in the top 5
+		Gray8 // 8 bit luma
+	};
+
+	FrameConverter(PixelFormat format = PixelFormat::RGBA8);
+
+	PixelFormat GetFormat() const { return m_format; }
+	int GetBytesPerPixel() const;
+
+	// out needs count * GetBytesPerPixel() bytes
+	void Convert(const uint16_t* pixels, int count, void* out) const;
+
+	static const NesColor kNesColors[0x40];
+
+private:
+	PixelFormat m_format;
+	std::array<uint32_t, 1024> m_table;
+};
@@ -1,100 +1,98 @@
 #include "GameCartridge.h"
 
-#include <fstream>
-#include <memory>
+#include <algorithm>
+
+#include "ChrRomCache.h"
+#include "DynarecCodeCache.h"
 
 // Support iNES file format
 void GameCartridge::LoadRomFromFile(std::string filePath)
 {
     // Reference: https://www.nesdev.org/wiki/INES
 
-    std::ifstream romFile;
-    romFile.open(filePath.c_str(), std::ifstream::binary);
+    std::shared_ptr<const RomFile> romFile = RomFile::Open(filePath);
 
-    if (romFile.is_open())
+    // Get Header
+    const size_t kHeaderSize = 16;
+    if (romFile && romFile->GetData().size() >= kHeaderSize)
+    {
+        ParseHeaderData(romFile->GetData().data());
+        MapRomData(romFile);
+    }
+    else
     {
-        romFile.seekg(0, romFile.end);
-        int length = romFile.tellg();
-        romFile.seekg(0, romFile.beg);
-
-        // Get Header
-        const int kHeaderSize = 16;
-        char header[kHeaderSize] = { 0 };
-        romFile.read(header, kHeaderSize);
-        ParseHeaderData(header);
-
-        // Get trainer data
-        if (mapperFlags1 & 0x04)
-        {
-            // Trainer flag set
-            romFile.read(m_trainerData, 512);
-        }
-        else
-        {
-            // Zero out trainer data
-            char* begin = m_trainerData;
-            char* end = begin + sizeof(m_trainerData);
-            std::fill(begin, end, 0);
-        }
-
-        prg.resize(prgRomSize * kPrgBlockSize);
-        chr.resize(chrRomSize * kChrBlockSize);
-
-        // Get Program Data
-        romFile.read((char*)prg.data(), prg.size());
-
-        // Get Character Data
-        romFile.read((char*)chr.data(), chr.size());
-
-        // Get PlayChoice inst-rom data
-
-        // Get PlayChoice PROM data
-
-        romFile.close();
+        MapRomData(nullptr);
     }
 }
 
-void GameCartridge::ParseHeaderData(char headerData[])
+void GameCartridge::LoadRomFromFile(std::string filePath, const std::array<uint8_t, 16>& header)
 {
-    std::copy(headerData, headerData + 4, headerConstant);
-    prgRomSize = headerData[4];
-    chrRomSize = headerData[5];
-    mapperFlags1 = headerData[6];
-    mapperFlags2 = headerData[7];
-    prgRamSize = headerData[8];
-    tvSystem = headerData[9];
-    tvSystemPrgRam = headerData[10];
-    std::copy(headerData + 11, headerData + 16, headerPadding);
+    ParseHeaderData(header.data());
+    MapRomData(RomFile::Open(filePath));
 }
 
-/*
-* 
-* Do the address mapping here. (The mapper was hardware of the cartridge anyways??)
-* Pass the mapped addresses to the NES when they need it.
-* 
-*/
-std::vector<uint8_t> GameCartridge::GetPrgData()
+void GameCartridge::MapRomData(std::shared_ptr<const RomFile> romFile)
 {
-    std::vector<uint8_t> data;
-    data.resize(32768);
+    // Consoles still running the previous ROM keep their own reference to its mapping
+    m_romFile = nullptr;
+    m_trainer = {};
+    m_prg = {};
+    m_chr = {};
+    m_chrRomCache = nullptr;
+    m_dynarecCodeCache = nullptr;
 
-    for (int i = 0; i < data.size(); i++)
-    {
-        data[i] = prg[i % prg.size()];
-    }
+    if (!romFile)
+        return;
 
-    return data;
-}
+    // The file's own header is skipped either way
+    std::span<const uint8_t> data = romFile->GetData();
+    const size_t kHeaderSize = 16;
+    size_t offset = kHeaderSize;
 
-std::vector<uint8_t> GameCartridge::GetChrData()
-{
-    std::vector<uint8_t> data;
-    data.resize(16384);
+    // Get trainer data
+    const size_t kTrainerSize = 512;
+    size_t trainerSize = (mapperFlags1 & 0x04) ? kTrainerSize : 0;
+
+    size_t prgSize = (size_t)prgRomSize * kPrgBlockSize;
+    size_t chrSize = (size_t)chrRomSize * kChrBlockSize;
+    if (data.size() < offset + trainerSize + prgSize + chrSize)
+        return;
 
-    for (int i = 0; i < data.size(); i++)
+    m_trainer = data.subspan(offset, trainerSize);
+    offset += trainerSize;
+
+    // Get Program Data
+    m_prg = data.subspan(offset, prgSize);
+    offset += prgSize;
+
+    // Get Character Data
+    m_chr = data.subspan(offset, chrSize);
+
+    // Get PlayChoice inst-rom data
+
+    // Get PlayChoice PROM data
+
+    m_romFile = romFile;
+
+    if (!m_chr.empty())
     {
-        data[i] = chr[i % chr.size()];
+        m_chrRomCache = std::make_shared<ChrRomCache>(m_chr);
     }
 
-    return data;
+#if CPU_DYNAREC
+    m_dynarecCodeCache = std::make_shared<DynarecCodeCache>();
+#endif
 }
+
+void GameCartridge::ParseHeaderData(const uint8_t headerData[])
+{
+    std::copy(headerData, headerData + 4, headerConstant);
+    prgRomSize = headerData[4];
+    chrRomSize = headerData[5];
+    mapperFlags1 = headerData[6];
+    mapperFlags2 = headerData[7];
+    prgRamSize = headerData[8];
+    tvSystem = headerData[9];
+    tvSystemPrgRam = headerData[10];
+    std::copy(headerData + 11, headerData + 16, headerPadding);
+}
\ No newline at end of file
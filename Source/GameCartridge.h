@@ -1,40 +1,86 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
-#include <vector>
+
+#include "RomFile.h"
+
+class ChrRomCache;
+class DynarecCodeCache;
 
 // Reference: https://www.nesdev.org/wiki/INES
 
+// How the 4 nametables at $2000 - $2FFF share the console's 2KB of VRAM
+enum class Mirroring : uint8_t
+{
+	Horizontal,
+	Vertical,
+	SingleScreenLow,
+	SingleScreenHigh,
+	FourScreen // The cartridge has 2KB of VRAM of its own, each nametable is separate
+};
+
 // Wrapper class to parse .NES file format roms
 
 class GameCartridge
 {
 public:
+	// Maps the file and points PRG / CHR straight into the mapping, the header is parsed in place.
+	// A file that is missing or shorter than its header says leaves the cartridge empty.
 	void LoadRomFromFile(std::string filePath);
 
-	inline uint8_t GetMirroringArrangement() { return mapperFlags1 & 0x01; }
+	// Same, with a header from somewhere else (see RomLibrary) used in place of the one in the file
+	void LoadRomFromFile(std::string filePath, const std::array<uint8_t, 16>& header);
+
+	bool IsLoaded() const { return m_romFile != nullptr; }
+
+	inline uint8_t GetMirroringArrangement() const { return mapperFlags1 & 0x01; }
+	inline bool HasFourScreenVram() const { return (mapperFlags1 & 0x08) != 0; }
+	inline Mirroring GetMirroring() const
+	{
+		if (HasFourScreenVram()) return Mirroring::FourScreen;
+		return GetMirroringArrangement() ? Mirroring::Vertical : Mirroring::Horizontal;
+	}
+	inline uint8_t GetMapperId() const { return (mapperFlags1 >> 4) | (mapperFlags2 & 0xF0); }
+
+	// Read only views of the ROM data, every console running this cartridge points at the same bytes and keeps the
+	// file mapped through GetRomFile. CHR ROM is empty for cartridges that come with CHR RAM instead.
+	std::shared_ptr<const RomFile> GetRomFile() const { return m_romFile; }
+	std::span<const uint8_t> GetPrgRom() const { return m_prg; }
+	std::span<const uint8_t> GetChrRom() const { return m_chr; }
+	std::span<const uint8_t> GetTrainer() const { return m_trainer; }
+
+	// Decoded CHR ROM for every console running this cartridge, null with CHR RAM
+	std::shared_ptr<ChrRomCache> GetChrRomCache() const { return m_chrRomCache; }
 
-	std::vector<uint8_t> GetPrgData();
-	std::vector<uint8_t> GetChrData();
+	// Translated PRG ROM code for every console running this cartridge, null when the dynarec isn't built in
+	std::shared_ptr<DynarecCodeCache> GetDynarecCodeCache() const { return m_dynarecCodeCache; }
 
 private:
-	void ParseHeaderData(char headerData[]);
+	void ParseHeaderData(const uint8_t headerData[]);
+	void MapRomData(std::shared_ptr<const RomFile> romFile);
 
 	const int kPrgBlockSize = 16384;
 	const int kChrBlockSize = 8192;
 
-	char headerConstant[4];
-	uint8_t prgRomSize;
-	uint8_t chrRomSize;
-	uint8_t mapperFlags1;
-	uint8_t mapperFlags2;
-	uint8_t prgRamSize;
-	uint8_t tvSystem;
-	uint8_t tvSystemPrgRam;
-	char headerPadding[5];
+	char headerConstant[4] = {};
+	uint8_t prgRomSize = 0;
+	uint8_t chrRomSize = 0;
+	uint8_t mapperFlags1 = 0;
+	uint8_t mapperFlags2 = 0;
+	uint8_t prgRamSize = 0;
+	uint8_t tvSystem = 0;
+	uint8_t tvSystemPrgRam = 0;
+	char headerPadding[5] = {};
 
-	char m_trainerData[512];
+	std::shared_ptr<const RomFile> m_romFile;
+	std::span<const uint8_t> m_trainer;
+	std::span<const uint8_t> m_prg;
+	std::span<const uint8_t> m_chr;
 
-	std::vector<uint8_t> prg;
-	std::vector<uint8_t> chr;
+	std::shared_ptr<ChrRomCache> m_chrRomCache;
+	std::shared_ptr<DynarecCodeCache> m_dynarecCodeCache;
 };
\ No newline at end of file
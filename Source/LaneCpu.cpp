@@ -0,0 +1,620 @@
+#include "LaneCpu.h"
+
+#if CPU_THREADED_DISPATCH
+
+#include "NES.h"
+
+namespace
+{
+	/* Status flags, same layout as CPU::m_Status */
+	constexpr uint8_t kNegative = 0x80;
+	constexpr uint8_t kOverflow = 0x40;
+	constexpr uint8_t kUnused = 0x20;
+	constexpr uint8_t kBrk = 0x10;
+	constexpr uint8_t kDecimal = 0x08;
+	constexpr uint8_t kIrq = 0x04;
+	constexpr uint8_t kZero = 0x02;
+	constexpr uint8_t kCarry = 0x01;
+
+	constexpr uint16_t kStackLocation = 0x0100;
+
+	inline uint8_t SetFlag(uint8_t status, uint8_t flag, bool on)
+	{
+		return on ? status | flag : status & ~flag;
+	}
+
+	inline uint8_t SetZeroNegative(uint8_t status, uint8_t value)
+	{
+		return (status & ~(kZero | kNegative)) | (value == 0x00 ? kZero : 0x00) | (value & kNegative);
+	}
+}
+
+void LaneCpu::Run(NES* const* consoles, const int* budgets, int* cycles, int count)
+{
+	for (int lane = 0; lane < kLanes; lane++)
+	{
+		Load(lane, lane < count ? consoles[lane] : nullptr, lane < count ? budgets[lane] : 0);
+	}
+
+	while (true)
+	{
+		// Lanes stop where RunThreaded would, the rest follow the lowest PC
+		int leader = -1;
+		int running = 0;
+		for (int lane = 0; lane < kLanes; lane++)
+		{
+			if (!m_running[lane])
+				continue;
+
+			uint16_t pc = m_pc[lane];
+			if (m_cycles[lane] >= m_budgets[lane] || CPU::IsIoAddress(pc) || CPU::IsIoAddress((uint16_t)(pc + 2)))
+			{
+				m_running[lane] = false;
+				continue;
+			}
+
+			running++;
+			if (leader < 0 || pc < m_pc[leader]) leader = lane;
+		}
+
+		if (leader < 0)
+			break;
+
+		// Copied, code running from RAM is decoded into a single slot that the other lanes' decodes would overwrite
+		const CPU::DecodedInstruction decoded = m_consoles[leader]->CPU.DecodeInstruction(m_pc[leader]);
+		for (int lane = 0; lane < kLanes; lane++)
+		{
+			m_mask[lane] = 0;
+			if (!m_running[lane])
+				continue;
+
+			if (m_pc[lane] == m_pc[leader])
+			{
+				const CPU::DecodedInstruction& own = lane == leader ? decoded : m_consoles[lane]->CPU.DecodeInstruction(m_pc[lane]);
+				m_mask[lane] = own.opCode == decoded.opCode && own.operandLow == decoded.operandLow
+					&& own.operandHigh == decoded.operandHigh;
+			}
+
+			if (m_mask[lane])
+			{
+				m_waiting[lane] = 0;
+			}
+			else if (++m_waiting[lane] >= kPeelAfter)
+			{
+				Peel(lane);
+			}
+		}
+
+		m_stats.steps++;
+		m_stats.runningLanes += running;
+		Execute(decoded);
+	}
+
+	for (int lane = 0; lane < count; lane++)
+	{
+		Store(lane);
+		cycles[lane] = m_cycles[lane];
+	}
+}
+
+void LaneCpu::Load(int lane, NES* console, int budget)
+{
+	m_consoles[lane] = console;
+	m_budgets[lane] = budget;
+	m_cycles[lane] = 0;
+	m_instructions[lane] = 0;
+	m_waiting[lane] = 0;
+	m_running[lane] = console != nullptr && budget > 0;
+	m_peeled[lane] = false;
+
+	if (console)
+	{
+		CPU& cpu = console->CPU;
+		m_pc[lane] = cpu.m_PC;
+		m_a[lane] = cpu.m_RegA;
+		m_x[lane] = cpu.m_RegX;
+		m_y[lane] = cpu.m_RegY;
+		m_sp[lane] = cpu.m_SP;
+		m_status[lane] = cpu.m_Status;
+	}
+	else
+	{
+		m_pc[lane] = 0x0000;
+		m_a[lane] = m_x[lane] = m_y[lane] = m_sp[lane] = m_status[lane] = 0x00;
+	}
+}
+
+void LaneCpu::Store(int lane)
+{
+	CPU& cpu = m_consoles[lane]->CPU;
+	cpu.m_instructionCount += m_instructions[lane];
+	m_instructions[lane] = 0;
+
+	// A peeled lane's CPU already has its registers
+	if (m_peeled[lane])
+		return;
+
+	cpu.m_PC = m_pc[lane];
+	cpu.m_RegA = m_a[lane];
+	cpu.m_RegX = m_x[lane];
+	cpu.m_RegY = m_y[lane];
+	cpu.m_SP = m_sp[lane];
+	cpu.m_Status = m_status[lane];
+}
+
+void LaneCpu::Peel(int lane)
+{
+	Store(lane);
+
+	CPU& cpu = m_consoles[lane]->CPU;
+	uint64_t instructions = cpu.GetInstructionCount();
+	m_cycles[lane] += cpu.RunThreaded(m_budgets[lane] - m_cycles[lane]);
+
+	m_running[lane] = false;
+	m_peeled[lane] = true;
+	m_stats.peeledLanes++;
+	m_stats.peeledInstructions += cpu.GetInstructionCount() - instructions;
+}
+
+inline uint8_t LaneCpu::Read(int lane, uint16_t address)
+{
+	return m_consoles[lane]->ReadCpuMemory(address);
+}
+
+inline void LaneCpu::Write(int lane, uint16_t address, uint8_t data)
+{
+	m_consoles[lane]->WriteCpuMemory(address, data);
+}
+
+inline void LaneCpu::Push(int lane, uint8_t data)
+{
+	Write(lane, kStackLocation + m_sp[lane], data);
+	m_sp[lane]--;
+}
+
+inline uint8_t LaneCpu::Pull(int lane)
+{
+	m_sp[lane]++;
+	return Read(lane, kStackLocation + m_sp[lane]);
+}
+
+void LaneCpu::Execute(const CPU::DecodedInstruction& decoded)
+{
+	typedef CPU::Mnemonic Mnemonic;
+	typedef CPU::AddressMode AddressMode;
+
+	const CPU::Instruction instruction = decoded.instruction;
+	const Mnemonic op = instruction.mnemonic;
+	const AddressMode mode = instruction.addressMode;
+	uint8_t* const mask = m_mask;
+
+	// Lanes that can't run the instruction here stop where they are, like a false from ThreadedStep
+	auto stop = [&](int lane)
+	{
+		mask[lane] = 0;
+		m_running[lane] = false;
+	};
+
+	alignas(32) uint16_t ogPc[kLanes];
+	alignas(32) uint16_t pc[kLanes];
+
+	/* Operand fetch, lane by lane since it can read memory */
+	const bool writesMemory = op == Mnemonic::STA || op == Mnemonic::STX || op == Mnemonic::STY
+		|| op == Mnemonic::INC || op == Mnemonic::DEC || ((op == Mnemonic::ASL || op == Mnemonic::LSR
+		|| op == Mnemonic::ROL || op == Mnemonic::ROR) && mode != AddressMode::Accum);
+	const bool zeroPage = mode == AddressMode::ZP || mode == AddressMode::ZPX || mode == AddressMode::ZPY;
+
+	for (int lane = 0; lane < kLanes; lane++)
+	{
+		ogPc[lane] = m_pc[lane];
+		pc[lane] = m_pc[lane] + decoded.length;
+		m_data[lane] = 0x00;
+		m_address[lane] = 0x0000;
+		m_branchLocation[lane] = 0x0000;
+		m_pageCrossed[lane] = 0;
+	}
+
+	for (int lane = 0; lane < kLanes; lane++)
+	{
+		if (!mask[lane])
+			continue;
+
+		if (op == Mnemonic::NUL)
+		{
+			// Let the regular path deal with unused opcodes
+			stop(lane);
+			continue;
+		}
+
+		uint8_t low = decoded.operandLow;
+		uint8_t high = decoded.operandHigh;
+		uint16_t address = 0x0000;
+
+		switch (mode)
+		{
+		case AddressMode::Accum:
+			m_data[lane] = m_a[lane];
+			break;
+		case AddressMode::IMM:
+			address = ogPc[lane] + 1;
+			m_data[lane] = low;
+			break;
+		case AddressMode::Absolute:
+			address = (high << 8) | low;
+			if (op != Mnemonic::JMP && op != Mnemonic::JSR && CPU::IsIoAddress(address))
+			{
+				stop(lane);
+				continue;
+			}
+			break;
+		case AddressMode::ZP:
+		case AddressMode::ZPX:
+		case AddressMode::ZPY:
+			if (mode == AddressMode::ZPX) low += m_x[lane];
+			if (mode == AddressMode::ZPY) low += m_y[lane];
+			address = low;
+			break;
+		case AddressMode::ABSX:
+		case AddressMode::ABSY:
+			address = ((high << 8) | low) + (mode == AddressMode::ABSX ? m_x[lane] : m_y[lane]);
+			// Same check as ThreadedStep / EvaluatePC, kept as is so every core counts the same cycles
+			m_pageCrossed[lane] = ((address && 0xFF00) >> 8) != high;
+			if (CPU::IsIoAddress(address))
+			{
+				stop(lane);
+				continue;
+			}
+			break;
+		case AddressMode::Relative:
+			m_branchLocation[lane] = pc[lane] + (int8_t)low;
+			break;
+		case AddressMode::INDX:
+		{
+			uint8_t zeroPageAddress = low + m_x[lane];
+			low = Read(lane, zeroPageAddress);
+			high = Read(lane, (uint8_t)(zeroPageAddress + 1));
+			address = (high << 8) | low;
+			if (CPU::IsIoAddress(address))
+			{
+				stop(lane);
+				continue;
+			}
+			break;
+		}
+		case AddressMode::INDY:
+		{
+			uint8_t zeroPageAddress = low;
+			low = Read(lane, zeroPageAddress);
+			high = Read(lane, (uint8_t)(zeroPageAddress + 1));
+			address = ((high << 8) | low) + m_y[lane];
+			m_pageCrossed[lane] = ((address && 0xFF00) >> 8) != high;
+			if (CPU::IsIoAddress(address))
+			{
+				stop(lane);
+				continue;
+			}
+			break;
+		}
+		case AddressMode::Indirect:
+		{
+			address = (high << 8) | low;
+			uint16_t highAddress = (low == 0xFF) ? (address & 0xFF00) : (uint16_t)(address + 1);
+			if (CPU::IsIoAddress(address) || CPU::IsIoAddress(highAddress))
+			{
+				stop(lane);
+				continue;
+			}
+			m_branchLocation[lane] = (Read(lane, highAddress) << 8) | Read(lane, address);
+			break;
+		}
+		default:
+			break;
+		}
+
+		// Writes into cartridge space go to the mapper, which needs the PPU caught up first
+		if (writesMemory && !zeroPage && address >= CPU::kDecodeCacheStart)
+		{
+			stop(lane);
+			continue;
+		}
+
+		if (instruction.NeedsData() && mode != AddressMode::Accum && mode != AddressMode::IMM)
+		{
+			m_data[lane] = Read(lane, address);
+		}
+		m_address[lane] = address;
+	}
+
+	/* Operation */
+	// Register only work runs on every lane and is blended in by the mask, so these loops vectorize
+	uint8_t* const a = m_a;
+	uint8_t* const x = m_x;
+	uint8_t* const y = m_y;
+	uint8_t* const sp = m_sp;
+	uint8_t* const status = m_status;
+	const uint8_t* const data = m_data;
+
+	auto forLanes = [&](auto&& operation)
+	{
+		for (int lane = 0; lane < kLanes; lane++)
+		{
+			operation(lane);
+		}
+	};
+
+	auto forMaskedLanes = [&](auto&& operation)
+	{
+		for (int lane = 0; lane < kLanes; lane++)
+		{
+			if (mask[lane]) operation(lane);
+		}
+	};
+
+	auto loadRegister = [&](uint8_t* reg, const uint8_t* value)
+	{
+		forLanes([&](int lane)
+		{
+			uint8_t result = value[lane];
+			reg[lane] = mask[lane] ? result : reg[lane];
+			status[lane] = mask[lane] ? SetZeroNegative(status[lane], result) : status[lane];
+		});
+	};
+
+	auto setFlag = [&](uint8_t flag, bool on)
+	{
+		forLanes([&](int lane)
+		{
+			status[lane] = mask[lane] ? SetFlag(status[lane], flag, on) : status[lane];
+		});
+	};
+
+	auto storeResult = [&](const uint8_t* result)
+	{
+		if (mode == AddressMode::Accum)
+		{
+			forLanes([&](int lane) { a[lane] = mask[lane] ? result[lane] : a[lane]; });
+		}
+		else
+		{
+			forMaskedLanes([&](int lane) { Write(lane, m_address[lane], result[lane]); });
+		}
+	};
+
+	auto branch = [&](uint8_t flag, bool set)
+	{
+		forMaskedLanes([&](int lane)
+		{
+			if (((status[lane] & flag) != 0) == set)
+			{
+				m_cycles[lane] += (pc[lane] & 0xFF00) == (m_branchLocation[lane] & 0xFF00) ? 1 : 2;
+				pc[lane] = m_branchLocation[lane];
+			}
+		});
+	};
+
+	alignas(32) uint8_t result[kLanes];
+
+	switch (op)
+	{
+	case Mnemonic::ADC:
+		forLanes([&](int lane)
+		{
+			uint16_t sum = (uint16_t)a[lane] + data[lane] + (status[lane] & kCarry);
+			uint8_t value = (uint8_t)sum;
+			uint8_t overflow = (a[lane] ^ value) & ~(a[lane] ^ data[lane]) & 0x80;
+			uint8_t flags = (status[lane] & ~(kCarry | kZero | kNegative | kOverflow)) | (uint8_t)(sum >> 8)
+				| (value == 0x00 ? kZero : 0x00) | (value & kNegative) | (overflow ? kOverflow : 0x00);
+			a[lane] = mask[lane] ? value : a[lane];
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		break;
+	case Mnemonic::SBC:
+		forLanes([&](int lane)
+		{
+			uint16_t sum = a[lane] + (data[lane] ^ 0x00FF) + (status[lane] & kCarry);
+			uint8_t value = (uint8_t)sum;
+			bool overflow = ((sum ^ a[lane]) & (sum ^ (data[lane] ^ 0x00FF)) & 0x0080) != 0;
+			uint8_t flags = (status[lane] & ~(kCarry | kZero | kNegative | kOverflow)) | ((sum & 0xFF00) != 0 ? kCarry : 0x00)
+				| (value == 0x00 ? kZero : 0x00) | (value & kNegative) | (overflow ? kOverflow : 0x00);
+			a[lane] = mask[lane] ? value : a[lane];
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		break;
+	case Mnemonic::AND:
+		forLanes([&](int lane) { result[lane] = a[lane] & data[lane]; });
+		loadRegister(a, result);
+		break;
+	case Mnemonic::ORA:
+		forLanes([&](int lane) { result[lane] = a[lane] | data[lane]; });
+		loadRegister(a, result);
+		break;
+	case Mnemonic::EOR:
+		forLanes([&](int lane) { result[lane] = a[lane] ^ data[lane]; });
+		loadRegister(a, result);
+		break;
+	case Mnemonic::ASL:
+		forLanes([&](int lane)
+		{
+			result[lane] = (uint8_t)(data[lane] << 1);
+			uint8_t flags = SetZeroNegative(SetFlag(status[lane], kCarry, (data[lane] & 0x80) != 0), result[lane]);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		storeResult(result);
+		break;
+	case Mnemonic::LSR:
+		forLanes([&](int lane)
+		{
+			result[lane] = data[lane] >> 1;
+			uint8_t flags = SetZeroNegative(SetFlag(status[lane], kCarry, (data[lane] & 0x01) != 0), result[lane]);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		storeResult(result);
+		break;
+	case Mnemonic::ROL:
+		forLanes([&](int lane) { result[lane] = (uint8_t)(data[lane] << 1) | (status[lane] & kCarry); });
+		storeResult(result);
+		// The zero flag looks at A after the store, like the other cores
+		forLanes([&](int lane)
+		{
+			uint8_t flags = SetFlag(status[lane], kCarry, (data[lane] & 0x80) != 0);
+			flags = SetFlag(flags, kZero, (result[lane] & a[lane]) == 0x00);
+			flags = SetFlag(flags, kNegative, (result[lane] & 0x80) != 0);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		break;
+	case Mnemonic::ROR:
+		forLanes([&](int lane)
+		{
+			result[lane] = (data[lane] >> 1) | ((status[lane] & kCarry) ? 0x80 : 0x00);
+			uint8_t flags = SetZeroNegative(SetFlag(status[lane], kCarry, (data[lane] & 0x01) != 0), result[lane]);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		storeResult(result);
+		break;
+	case Mnemonic::BIT:
+		forLanes([&](int lane)
+		{
+			uint8_t flags = SetFlag(status[lane], kZero, (data[lane] & a[lane]) == 0x00);
+			flags = SetFlag(flags, kNegative, (data[lane] & 0x80) != 0);
+			flags = SetFlag(flags, kOverflow, (data[lane] & 0x40) != 0);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		break;
+	case Mnemonic::BCC: branch(kCarry, false); break;
+	case Mnemonic::BCS: branch(kCarry, true); break;
+	case Mnemonic::BEQ: branch(kZero, true); break;
+	case Mnemonic::BNE: branch(kZero, false); break;
+	case Mnemonic::BMI: branch(kNegative, true); break;
+	case Mnemonic::BPL: branch(kNegative, false); break;
+	case Mnemonic::BVC: branch(kOverflow, false); break;
+	case Mnemonic::BVS: branch(kOverflow, true); break;
+	case Mnemonic::BRK:
+		forMaskedLanes([&](int lane)
+		{
+			pc[lane]++;
+			Push(lane, pc[lane] >> 8);
+			Push(lane, (uint8_t)(pc[lane] & 0x00FF));
+			// Pushed with the I flag as it was, like CPU::DoInterrupt
+			status[lane] = SetFlag(SetFlag(status[lane], kUnused, true), kBrk, false);
+			Push(lane, status[lane]);
+			status[lane] = SetFlag(status[lane], kIrq, true);
+			uint16_t newPcLo = Read(lane, 0xFFFE);
+			uint16_t newPcHigh = Read(lane, 0xFFFF);
+			pc[lane] = (newPcHigh << 8) | newPcLo;
+		});
+		break;
+	case Mnemonic::RTI:
+		forMaskedLanes([&](int lane)
+		{
+			status[lane] = Pull(lane);
+			uint16_t lo = Pull(lane);
+			uint16_t hi = Pull(lane);
+			pc[lane] = (hi << 8) | lo;
+		});
+		break;
+	case Mnemonic::JMP:
+		forLanes([&](int lane)
+		{
+			uint16_t target = mode == AddressMode::Indirect ? m_branchLocation[lane] : m_address[lane];
+			pc[lane] = mask[lane] ? target : pc[lane];
+		});
+		break;
+	case Mnemonic::JSR:
+		forMaskedLanes([&](int lane)
+		{
+			pc[lane]--;
+			Push(lane, pc[lane] >> 8);
+			Push(lane, (uint8_t)(pc[lane] & 0x00FF));
+			pc[lane] = m_address[lane];
+		});
+		break;
+	case Mnemonic::RTS:
+		forMaskedLanes([&](int lane)
+		{
+			uint16_t lo = Pull(lane);
+			uint16_t hi = Pull(lane);
+			pc[lane] = ((hi << 8) | lo) + 1;
+		});
+		break;
+	case Mnemonic::PHA: forMaskedLanes([&](int lane) { Push(lane, a[lane]); }); break;
+	case Mnemonic::PHP: forMaskedLanes([&](int lane) { Push(lane, status[lane] | kUnused | kBrk); }); break;
+	case Mnemonic::PLA:
+		forMaskedLanes([&](int lane) { result[lane] = Pull(lane); });
+		loadRegister(a, result);
+		break;
+	case Mnemonic::PLP: forMaskedLanes([&](int lane) { status[lane] = Pull(lane); }); break;
+	case Mnemonic::CLC: setFlag(kCarry, false); break;
+	case Mnemonic::CLD: setFlag(kDecimal, false); break;
+	case Mnemonic::CLI: setFlag(kIrq, false); break;
+	case Mnemonic::CLV: setFlag(kOverflow, false); break;
+	case Mnemonic::SEC: setFlag(kCarry, true); break;
+	case Mnemonic::SED: setFlag(kDecimal, true); break;
+	case Mnemonic::SEI: setFlag(kIrq, true); break;
+	case Mnemonic::CMP:
+	case Mnemonic::CPX:
+	case Mnemonic::CPY:
+	{
+		const uint8_t* reg = op == Mnemonic::CMP ? a : op == Mnemonic::CPX ? x : y;
+		forLanes([&](int lane)
+		{
+			uint8_t flags = SetFlag(status[lane], kCarry, reg[lane] >= data[lane]);
+			flags = SetFlag(flags, kZero, reg[lane] == data[lane]);
+			flags = SetFlag(flags, kNegative, ((reg[lane] - data[lane]) & 0x80) != 0);
+			status[lane] = mask[lane] ? flags : status[lane];
+		});
+		break;
+	}
+	case Mnemonic::DEC:
+	case Mnemonic::INC:
+		forLanes([&](int lane)
+		{
+			result[lane] = op == Mnemonic::INC ? data[lane] + 0x01 : data[lane] - 0x01;
+			status[lane] = mask[lane] ? SetZeroNegative(status[lane], result[lane]) : status[lane];
+		});
+		forMaskedLanes([&](int lane) { Write(lane, m_address[lane], result[lane]); });
+		break;
+	case Mnemonic::DEX: forLanes([&](int lane) { result[lane] = x[lane] - 1; }); loadRegister(x, result); break;
+	case Mnemonic::DEY: forLanes([&](int lane) { result[lane] = y[lane] - 1; }); loadRegister(y, result); break;
+	case Mnemonic::INX: forLanes([&](int lane) { result[lane] = x[lane] + 1; }); loadRegister(x, result); break;
+	case Mnemonic::INY: forLanes([&](int lane) { result[lane] = y[lane] + 1; }); loadRegister(y, result); break;
+	case Mnemonic::LDA: loadRegister(a, data); break;
+	case Mnemonic::LDX: loadRegister(x, data); break;
+	case Mnemonic::LDY: loadRegister(y, data); break;
+	case Mnemonic::STA: forMaskedLanes([&](int lane) { Write(lane, m_address[lane], a[lane]); }); break;
+	case Mnemonic::STX: forMaskedLanes([&](int lane) { Write(lane, m_address[lane], x[lane]); }); break;
+	case Mnemonic::STY: forMaskedLanes([&](int lane) { Write(lane, m_address[lane], y[lane]); }); break;
+	case Mnemonic::TAX: loadRegister(x, a); break;
+	case Mnemonic::TAY: loadRegister(y, a); break;
+	case Mnemonic::TSX: loadRegister(x, sp); break;
+	case Mnemonic::TXA: loadRegister(a, x); break;
+	case Mnemonic::TXS: forLanes([&](int lane) { sp[lane] = mask[lane] ? x[lane] : sp[lane]; }); break;
+	case Mnemonic::TYA: loadRegister(a, y); break;
+	default:
+		break;
+	}
+
+	/* Variable clock cycles, same rules as EvaluatePC */
+	forMaskedLanes([&](int lane)
+	{
+		int cycles = instruction.clockCycles;
+		if (instruction.HasPageBoundaryCycle() && instruction.HasBranchPageCycle())
+		{
+			if (pc[lane] == m_branchLocation[lane])
+			{
+				cycles += 1;
+				if (!m_consoles[lane]->CPU.AreAddrsOnSamePage(ogPc[lane], pc[lane])) cycles += 1;
+			}
+		}
+		else if (instruction.HasPageBoundaryCycle() && m_pageCrossed[lane])
+		{
+			cycles += 1;
+		}
+
+		m_cycles[lane] += cycles;
+		m_pc[lane] = pc[lane];
+		m_instructions[lane]++;
+		m_stats.laneInstructions++;
+	});
+}
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+
+#include "CPU.h"
+
+#if CPU_THREADED_DISPATCH
+
+class NES;
+
+/*
+	Experimental struct of arrays CPU core for many consoles running the same game, see BatchRunner::SetLaneExecution.
+
+	Runs the CPUs of up to kLanes consoles ahead at once, each with its own cycle budget, in place of CPU::RunThreaded
+	on each of them. A, X, Y, SP, P and PC of every console sit side by side in arrays, one lane per console. Every step
+	picks the lowest PC of the lanes still running, decodes the instruction once and runs it on every lane at that PC
+	(and with the same bytes there, lanes can have different banks mapped). Register and flag updates are plain loops
+	over all lanes blended with the lane mask, which the compiler turns into SIMD. Memory accesses go through each
+	lane's own memory map, so RAM stays where each NES keeps it.
+
+	Lanes at other PCs are masked out and wait for their turn, running the lowest PC first lets a lane that fell behind
+	on a branch catch up with the others where the paths meet again. A lane left out for kPeelAfter steps in a row has
+	gone its own way, so it gets peeled off and runs the rest of its budget on its own CPU.
+
+	Same rules as ThreadedStep, quirks included: a lane stops before an instruction that would touch the PPU / IO
+	registers or write into cartridge space, or once its budget is used up, and every lane ends up in the exact same
+	state it would have with RunThreaded.
+*/
+class LaneCpu
+{
+public:
+	static constexpr int kLanes = 16;
+	static constexpr int kPeelAfter = 64;
+
+	struct Stats
+	{
+		uint64_t steps = 0; // Instructions decoded, each run on one or more lanes
+		uint64_t laneInstructions = 0; // Instructions run by lanes, summed
+		uint64_t runningLanes = 0; // Lanes still running at each step, summed
+		uint64_t peeledLanes = 0;
+		uint64_t peeledInstructions = 0; // Run by the scalar CPU after a lane was peeled off
+	};
+
+	// consoles[i] runs ahead up to budgets[i] CPU cycles (see NES::ResumeCatchUpFrame), 0 leaves it alone.
+	// cycles[i] gets the cycles it actually ran, like the return value of CPU::RunThreaded.
+	void Run(NES* const* consoles, const int* budgets, int* cycles, int count);
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	void Load(int lane, NES* console, int budget);
+	void Store(int lane);
+	void Peel(int lane);
+
+	// Runs decoded on the lanes in m_mask, lanes that can't run it stop instead
+	void Execute(const CPU::DecodedInstruction& decoded);
+
+	uint8_t Read(int lane, uint16_t address);
+	void Write(int lane, uint16_t address, uint8_t data);
+	void Push(int lane, uint8_t data);
+	uint8_t Pull(int lane);
+
+	/* Lane state */
+	alignas(32) uint8_t m_a[kLanes];
+	alignas(32) uint8_t m_x[kLanes];
+	alignas(32) uint8_t m_y[kLanes];
+	alignas(32) uint8_t m_sp[kLanes];
+	alignas(32) uint8_t m_status[kLanes];
+	alignas(32) uint16_t m_pc[kLanes];
+	alignas(32) int m_cycles[kLanes];
+
+	NES* m_consoles[kLanes];
+	int m_budgets[kLanes];
+	int m_instructions[kLanes];
+	int m_waiting[kLanes]; // Steps in a row this lane was masked out
+	bool m_running[kLanes];
+	bool m_peeled[kLanes];
+
+	/* The instruction being run */
+	alignas(32) uint8_t m_mask[kLanes]; // 1 for lanes running it
+	alignas(32) uint8_t m_data[kLanes];
+	alignas(32) uint16_t m_address[kLanes];
+	alignas(32) uint16_t m_branchLocation[kLanes];
+	alignas(32) uint8_t m_pageCrossed[kLanes];
+
+	Stats m_stats;
+};
+
+#endif
@@ -0,0 +1,354 @@
+#include "Mapper.h"
+#include "NES.h"
+
+Mapper::Mapper(NES& nes, std::span<const uint8_t> prgRom, std::span<const uint8_t> chrRom, std::vector<uint8_t>& chrRam)
+	: m_nes(nes), m_prgRom(prgRom), m_chrRom(chrRom)
+{
+	if (m_chrRom.empty())
+	{
+		m_chrRam = chrRam.data();
+		m_chr = chrRam.data();
+		m_chrSize = (int)chrRam.size();
+	}
+	else
+	{
+		m_chr = m_chrRom.data();
+		m_chrSize = (int)m_chrRom.size();
+	}
+
+	m_prgBanks.fill(-1);
+	m_chrBanks.fill(-1);
+}
+
+void Mapper::MapPrg8k(int slot, int bank)
+{
+	const int kBankSize = 0x2000;
+	if (m_prgRom.empty())
+		return; // Nothing loaded, the window stays open bus
+
+	bank = WrapBank(bank, (int)m_prgRom.size() / kBankSize);
+	if (m_prgBanks[slot] == bank)
+		return;
+
+	m_prgBanks[slot] = bank;
+	uint16_t address = 0x8000 + slot * kBankSize;
+	m_nes.MapCpuMemory(address, kBankSize, m_prgRom.data() + bank * kBankSize);
+	m_nes.CPU.InvalidateDecodeCache(address);
+}
+
+void Mapper::MapPrg16k(int slot, int bank)
+{
+	MapPrg8k(slot * 2, bank * 2);
+	MapPrg8k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::MapPrg32k(int bank)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		MapPrg8k(i, bank * 4 + i);
+	}
+}
+
+void Mapper::MapChr1k(int slot, int bank)
+{
+	const int kBankSize = 0x0400;
+	bank = WrapBank(bank, m_chrSize / kBankSize);
+	if (m_chrBanks[slot] == bank)
+		return;
+
+	m_chrBanks[slot] = bank;
+	if (m_chrRam)
+	{
+		m_nes.MapPatternTable(slot, m_chrRam + bank * kBankSize);
+	}
+	else
+	{
+		m_nes.MapPatternTable(slot, m_chr + bank * kBankSize);
+	}
+}
+
+void Mapper::MapChr2k(int slot, int bank)
+{
+	MapChr1k(slot * 2, bank * 2);
+	MapChr1k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::MapChr4k(int slot, int bank)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		MapChr1k(slot * 4 + i, bank * 4 + i);
+	}
+}
+
+void Mapper::MapChr8k(int bank)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		MapChr1k(i, bank * 8 + i);
+	}
+}
+
+void Mapper::SetMirroring(Mirroring mirroring)
+{
+	m_nes.SetMirroring(mirroring);
+}
+
+/* NROM */
+void MapperNROM::Reset()
+{
+	// A single 16KB bank shows up at both $8000 and $C000
+	MapPrg16k(0, 0);
+	MapPrg16k(1, -1);
+	MapChr8k(0);
+}
+
+/* MMC1 */
+// Reference: https://www.nesdev.org/wiki/MMC1
+void MapperMMC1::Reset()
+{
+	m_shift = 0x10;
+	m_control = 0x0C;
+	m_chrBank0 = 0x00;
+	m_chrBank1 = 0x00;
+	m_prgBank = 0x00;
+	UpdateBanks();
+}
+
+void MapperMMC1::WriteRegister(uint16_t address, uint8_t data)
+{
+	// Bit 7 resets the shift register and locks the last PRG bank at $C000
+	if (data & 0x80)
+	{
+		m_shift = 0x10;
+		m_control |= 0x0C;
+		UpdateBanks();
+		return;
+	}
+
+	bool complete = (m_shift & 0x01) != 0;
+	m_shift = (m_shift >> 1) | ((data & 0x01) << 4);
+	if (!complete)
+		return;
+
+	// Fifth write, the address picks the register
+	uint8_t value = m_shift;
+	switch ((address >> 13) & 0x03)
+	{
+	case 0: m_control = value; break;
+	case 1: m_chrBank0 = value; break;
+	case 2: m_chrBank1 = value; break;
+	case 3: m_prgBank = value; break;
+	}
+	m_shift = 0x10;
+
+	UpdateBanks();
+}
+
+void MapperMMC1::UpdateBanks()
+{
+	switch (m_control & 0x03)
+	{
+	case 0: SetMirroring(Mirroring::SingleScreenLow); break;
+	case 1: SetMirroring(Mirroring::SingleScreenHigh); break;
+	case 2: SetMirroring(Mirroring::Vertical); break;
+	case 3: SetMirroring(Mirroring::Horizontal); break;
+	}
+
+	// 512KB boards (SUROM) pick the 256KB half with bit 4 of the CHR bank
+	int outerBank = m_chrBank0 & 0x10;
+	int prgBank = outerBank | (m_prgBank & 0x0F);
+	switch ((m_control >> 2) & 0x03)
+	{
+	case 0:
+	case 1:
+		// 32KB, low bit ignored
+		MapPrg16k(0, prgBank & ~0x01);
+		MapPrg16k(1, prgBank | 0x01);
+		break;
+	case 2:
+		// First bank fixed at $8000
+		MapPrg16k(0, outerBank);
+		MapPrg16k(1, prgBank);
+		break;
+	case 3:
+		// Last bank fixed at $C000
+		MapPrg16k(0, prgBank);
+		MapPrg16k(1, outerBank | 0x0F);
+		break;
+	}
+
+	if (m_control & 0x10)
+	{
+		MapChr4k(0, m_chrBank0);
+		MapChr4k(1, m_chrBank1);
+	}
+	else
+	{
+		// 8KB, low bit ignored
+		MapChr8k(m_chrBank0 >> 1);
+	}
+}
+
+/* UxROM */
+void MapperUxROM::Reset()
+{
+	MapPrg16k(0, 0);
+	MapPrg16k(1, -1);
+	MapChr8k(0);
+}
+
+void MapperUxROM::WriteRegister(uint16_t address, uint8_t data)
+{
+	MapPrg16k(0, data);
+}
+
+/* CNROM */
+void MapperCNROM::Reset()
+{
+	MapPrg16k(0, 0);
+	MapPrg16k(1, -1);
+	MapChr8k(0);
+}
+
+void MapperCNROM::WriteRegister(uint16_t address, uint8_t data)
+{
+	MapChr8k(data);
+}
+
+/* MMC3 */
+// Reference: https://www.nesdev.org/wiki/MMC3
+void MapperMMC3::Reset()
+{
+	m_bankSelect = 0x00;
+	m_banks = { 0, 2, 4, 5, 6, 7, 0, 1 };
+	m_irqLatch = 0x00;
+	m_irqCounter = 0x00;
+	m_irqReload = false;
+	m_irqEnabled = false;
+	m_nes.ReleaseIRQ();
+	UpdateBanks();
+}
+
+void MapperMMC3::WriteRegister(uint16_t address, uint8_t data)
+{
+	// Registers are picked by the address range and whether it's even or odd
+	switch (address & 0xE001)
+	{
+	case 0x8000:
+		m_bankSelect = data;
+		UpdateBanks();
+		break;
+	case 0x8001:
+		m_banks[m_bankSelect & 0x07] = data;
+		UpdateBanks();
+		break;
+	case 0xA000:
+		SetMirroring((data & 0x01) ? Mirroring::Horizontal : Mirroring::Vertical);
+		break;
+	case 0xA001:
+		// PRG RAM protect, cartridge RAM is always on here
+		break;
+	case 0xC000:
+		m_irqLatch = data;
+		break;
+	case 0xC001:
+		m_irqCounter = 0;
+		m_irqReload = true;
+		break;
+	case 0xE000:
+		// Also acknowledges an IRQ that's already been raised
+		m_irqEnabled = false;
+		m_nes.ReleaseIRQ();
+		break;
+	case 0xE001:
+		m_irqEnabled = true;
+		break;
+	}
+}
+
+void MapperMMC3::UpdateBanks()
+{
+	// R6 swaps between $8000 and $C000, the second to last bank takes the other one
+	if (m_bankSelect & 0x40)
+	{
+		MapPrg8k(0, -2);
+		MapPrg8k(2, m_banks[6]);
+	}
+	else
+	{
+		MapPrg8k(0, m_banks[6]);
+		MapPrg8k(2, -2);
+	}
+	MapPrg8k(1, m_banks[7]);
+	MapPrg8k(3, -1);
+
+	// Two 2KB banks and four 1KB banks, the halves of the pattern tables swap with bit 7
+	int twoKbSlot = (m_bankSelect & 0x80) ? 2 : 0;
+	int oneKbSlot = (m_bankSelect & 0x80) ? 0 : 4;
+	MapChr2k(twoKbSlot, m_banks[0] >> 1);
+	MapChr2k(twoKbSlot + 1, m_banks[1] >> 1);
+	for (int i = 0; i < 4; i++)
+	{
+		MapChr1k(oneKbSlot + i, m_banks[2 + i]);
+	}
+}
+
+void MapperMMC3::ClockScanlineCounter()
+{
+	if (m_irqCounter == 0 || m_irqReload)
+	{
+		m_irqCounter = m_irqLatch;
+		m_irqReload = false;
+	}
+	else
+	{
+		m_irqCounter--;
+	}
+
+	if (m_irqCounter == 0 && m_irqEnabled)
+	{
+		m_nes.AssertIRQ();
+	}
+}
+
+int MapperMMC3::GetScanlineClocksUntilIrq()
+{
+	if (!m_irqEnabled)
+		return 0;
+
+	// Run the counter forward on a copy, it either hits 0 within one reload or never does
+	uint8_t counter = m_irqCounter;
+	bool reload = m_irqReload;
+	for (int clocks = 1; clocks <= 257; clocks++)
+	{
+		if (counter == 0 || reload)
+		{
+			counter = m_irqLatch;
+			reload = false;
+		}
+		else
+		{
+			counter--;
+		}
+
+		if (counter == 0) return clocks;
+	}
+
+	return 0;
+}
+
+/* AxROM */
+void MapperAxROM::Reset()
+{
+	MapPrg32k(0);
+	MapChr8k(0);
+	SetMirroring(Mirroring::SingleScreenLow);
+}
+
+void MapperAxROM::WriteRegister(uint16_t address, uint8_t data)
+{
+	MapPrg32k(data & 0x07);
+	SetMirroring((data & 0x10) ? Mirroring::SingleScreenHigh : Mirroring::SingleScreenLow);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "GameCartridge.h"
+
+class NES;
+
+/*
+	The cartridge hardware between the console and the ROM. Switching a bank never copies anything, it only points
+	8KB windows of the CPU memory map or 1KB pages of the PPU pattern tables somewhere else in the cartridge's ROM.
+
+	The console calls WriteRegister through a handler instantiated for the concrete mapper class (see
+	NES::InstallMapper), so it's a direct call rather than a virtual one. NROM has no registers and never gets called.
+	Reference: https://www.nesdev.org/wiki/Mapper
+*/
+class Mapper
+{
+public:
+	Mapper(NES& nes, std::span<const uint8_t> prgRom, std::span<const uint8_t> chrRom, std::vector<uint8_t>& chrRam);
+	virtual ~Mapper() {}
+
+	// Whether CPU writes to $8000 - $FFFF need to reach WriteRegister
+	static constexpr bool kHasRegisters = true;
+
+	// Power on banks
+	virtual void Reset() = 0;
+
+	// CPU writes to $8000 - $FFFF
+	virtual void WriteRegister(uint16_t address, uint8_t data) = 0;
+
+	/* Scanline counter */
+	// Mappers like MMC3 count scanlines and raise an IRQ, PPU::Cycle clocks them once per rendered line
+	virtual bool HasScanlineCounter() { return false; }
+	virtual void ClockScanlineCounter() {}
+
+	// Clocks from now until the counter raises an IRQ, 0 if it won't with the current registers
+	virtual int GetScanlineClocksUntilIrq() { return 0; }
+
+protected:
+	// Negative banks count back from the end of ROM, banks past the end wrap around
+	void MapPrg8k(int slot, int bank);
+	void MapPrg16k(int slot, int bank);
+	void MapPrg32k(int bank);
+
+	void MapChr1k(int slot, int bank);
+	void MapChr2k(int slot, int bank);
+	void MapChr4k(int slot, int bank);
+	void MapChr8k(int bank);
+
+	void SetMirroring(Mirroring mirroring);
+
+	NES& m_nes;
+
+private:
+	Mapper(const Mapper&) = delete;
+	Mapper& operator=(const Mapper&) = delete;
+
+	static int WrapBank(int bank, int count) { return ((bank % count) + count) % count; }
+
+	// Owned by the NES's cartridge mapping
+	std::span<const uint8_t> m_prgRom;
+	std::span<const uint8_t> m_chrRom;
+
+	// CHR RAM instead of ROM when the cartridge has none
+	uint8_t* m_chrRam = nullptr;
+	const uint8_t* m_chr = nullptr;
+	int m_chrSize = 0;
+
+	// What each window points at right now, so rewriting the same bank doesn't drop the CPU's decode cache
+	std::array<int, 4> m_prgBanks;
+	std::array<int, 8> m_chrBanks;
+};
+
+// Mapper 0, 16KB or 32KB PRG and 8KB CHR, no registers
+class MapperNROM final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	static constexpr bool kHasRegisters = false;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override {}
+};
+
+// Mapper 1, serial port loaded one bit per write
+class MapperMMC1 final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override;
+
+private:
+	void UpdateBanks();
+
+	uint8_t m_shift = 0x10; // The 1 marks when 5 bits have been shifted in
+	uint8_t m_control = 0x0C;
+	uint8_t m_chrBank0 = 0x00;
+	uint8_t m_chrBank1 = 0x00;
+	uint8_t m_prgBank = 0x00;
+};
+
+// Mapper 2, switchable 16KB at $8000 and the last 16KB fixed at $C000
+class MapperUxROM final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 3, switchable 8KB CHR
+class MapperCNROM final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 4, 8KB PRG / 1KB CHR banks and a scanline IRQ
+class MapperMMC3 final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override;
+
+	bool HasScanlineCounter() override { return true; }
+	void ClockScanlineCounter() override;
+	int GetScanlineClocksUntilIrq() override;
+
+private:
+	void UpdateBanks();
+
+	uint8_t m_bankSelect = 0x00;
+	std::array<uint8_t, 8> m_banks = {};
+
+	uint8_t m_irqLatch = 0x00;
+	uint8_t m_irqCounter = 0x00;
+	bool m_irqReload = false;
+	bool m_irqEnabled = false;
+};
+
+// Mapper 7, switchable 32KB PRG and single screen mirroring
+class MapperAxROM final : public Mapper
+{
+public:
+	using Mapper::Mapper;
+
+	void Reset() override;
+	void WriteRegister(uint16_t address, uint8_t data) override;
+};
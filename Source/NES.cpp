@@ -1,80 +1,227 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
 
 #include "NES.h"
+#include "Dynarec.h"
+
+NES::NES()
+{
+	// Blank CHR RAM until a cartridge says otherwise
+	m_chrRam.assign(0x2000, 0x00);
+	m_chrCache.Attach(m_chrRam);
+	for (int i = 0; i < 8; i++)
+	{
+		MapPatternTable(i, m_chrRam.data() + i * 0x0400);
+	}
+	SetMirroring(Mirroring::Horizontal);
+
+	ResetCpuMemoryMap();
+}
+
+NES::~NES()
+{
+}
 
 void NES::PowerOn()
 {
-	for (auto& i : CPUMemory) i = 0x00;
-	for (auto& i : PPUMemory) i = 0x00;
+	for (auto& i : m_cpuRam) i = 0x00;
+	for (auto& i : m_prgRam) i = 0x00;
+	for (auto& i : m_vram) i = 0x00;
+	for (auto& i : m_paletteRam) i = 0x00;
+	for (auto& i : m_chrRam) i = 0x00;
+	m_chrCache.Invalidate();
 
 	CPU.Initialize(this);
 	PPU.Initialize(this);
 }
 
-void NES::LoadGameCartridge(GameCartridge game)
+void NES::LoadGameCartridge(const GameCartridge& game)
 {
-	m_gameMirroring = game.GetMirroringArrangement();
+	m_idleLoopAddresses.clear();
 
-	// Get data
-	std::vector<uint8_t> prg = game.GetPrgData();
-	std::vector<uint8_t> chr = game.GetChrData();
+	m_romFile = game.GetRomFile();
+	m_prgRom = game.GetPrgRom();
+	m_chrRom = game.GetChrRom();
 
-	// Copy pgr data to $8000 - $FFFF on CPU
-	for (int i = 0; i < 32768; i++)
+	// No CHR ROM means the cartridge has 8KB of CHR RAM instead
+	if (!m_chrRom.empty())
+	{
+		m_chrRam.clear();
+		m_chrRam.shrink_to_fit();
+	}
+	else
 	{
-		uint16_t addr = 0x8000 + i;
-		WriteCpuMemory(addr, prg[i]);
+		m_chrRam.assign(0x2000, 0x00);
 	}
+	if (game.GetChrRomCache()) m_chrCache.Attach(game.GetChrRomCache());
+	else m_chrCache.Attach(m_chrRam);
+
+#if CPU_DYNAREC
+	if (CPU.GetDynarec()) CPU.GetDynarec()->SetCodeCache(game.GetDynarecCodeCache());
+#endif
 
-	// Copy chr data to $0000 - $3FFF on PPU
-	for (int i = 0; i < 16384; i++)
+	switch (game.GetMapperId())
 	{
-		uint16_t addr = 0x0000 + i;
-		WritePPUMemory(addr, chr[i]);
+	case 1: InstallMapper<MapperMMC1>(game); break;
+	case 2: InstallMapper<MapperUxROM>(game); break;
+	case 3: InstallMapper<MapperCNROM>(game); break;
+	case 4: InstallMapper<MapperMMC3>(game); break;
+	case 7: InstallMapper<MapperAxROM>(game); break;
+	default: InstallMapper<MapperNROM>(game); break; // Anything unsupported gets NROM and likely won't run
 	}
 }
 
-void NES::RequestNMI()
+template<typename T>
+void NES::InstallMapper(const GameCartridge& game)
 {
-	m_doNMI = true;
+	m_mapper.reset(new T(*this, m_prgRom, m_chrRom, m_chrRam));
+	m_scanlineCounter = m_mapper->HasScanlineCounter();
+
+	// ROM pages get mapped by Reset, writes to them go straight to this mapper's registers
+	if (T::kHasRegisters)
+	{
+		MapCpuHandlers(0x8000, 0x8000, &NES::ReadOpenBus, &NES::WriteMapperRegister<T>);
+	}
+	else
+	{
+		MapCpuHandlers(0x8000, 0x8000, &NES::ReadOpenBus, &NES::WriteOpenBus);
+	}
+
+	m_fourScreenVram = game.HasFourScreenVram();
+	SetMirroring(game.GetMirroring());
+	m_mapper->Reset();
+}
+
+template<typename T>
+void NES::WriteMapperRegister(uint16_t address, uint8_t data)
+{
+	// Bank switches change what the PPU fetches from here on, and can move the next mapper IRQ
+	SyncPpu();
+	static_cast<T*>(m_mapper.get())->T::WriteRegister(address, data);
+	m_eventsChanged = true;
 }
 
-void NES::RequestIRQ()
+void NES::MapPatternTable(int slot, uint8_t* memory)
 {
-	m_doIRQ = true;
+	m_ppuReadPages[slot] = memory;
+	m_ppuWritePages[slot] = memory;
+	m_patternTableTiles[slot] = (int)(memory - m_chrCache.GetData()) / ChrCache::kTileBytes;
+	PPU.InvalidateBackgroundFetch();
 }
 
-bool NES::IsRamRegister(uint16_t address)
+void NES::MapPatternTable(int slot, const uint8_t* memory)
 {
-	return (address >= 0x0000 && address <= 0x1FFF);
+	m_ppuReadPages[slot] = memory;
+	m_ppuWritePages[slot] = nullptr;
+	m_patternTableTiles[slot] = (int)(memory - m_chrCache.GetData()) / ChrCache::kTileBytes;
+
+	// ROM never changes, decode the whole bank now rather than tile by tile while drawing
+	m_chrCache.BuildBank(m_patternTableTiles[slot] / ChrCache::kBankTiles);
+	PPU.InvalidateBackgroundFetch();
 }
 
-bool NES::IsPpuRegister(uint16_t address)
+void NES::SetMirroring(Mirroring mirroring)
 {
-	return (address >= 0x2000 && address <= 0x3FFF);
+	// Which 1KB of VRAM each of the 4 nametables shows
+	static const uint8_t kNametablePages[5][4] =
+	{
+		{ 0, 0, 1, 1 }, // Horizontal
+		{ 0, 1, 0, 1 }, // Vertical
+		{ 0, 0, 0, 0 }, // Single screen low
+		{ 1, 1, 1, 1 }, // Single screen high
+		{ 0, 1, 2, 3 }, // Four screen
+	};
+
+	// Four screen boards have no mirroring to switch, whatever the mapper says
+	if (m_fourScreenVram) mirroring = Mirroring::FourScreen;
+
+	// $2000 - $2FFF, then the same again at $3000 - $3FFF
+	for (int i = 0; i < 4; i++)
+	{
+		uint8_t* nametable = m_vram.data() + kNametablePages[(int)mirroring][i] * 0x0400;
+		m_ppuReadPages[8 + i] = m_ppuReadPages[12 + i] = nametable;
+		m_ppuWritePages[8 + i] = m_ppuWritePages[12 + i] = nametable;
+	}
+	PPU.InvalidateBackgroundFetch();
+}
+
+void NES::ClockScanlineCounter()
+{
+	if (m_scanlineCounter)
+	{
+		m_mapper->ClockScanlineCounter();
+	}
+}
+
+int NES::GetDotsUntilNextEvent()
+{
+	int dots = PPU.GetDotsUntilNextEvent();
+
+	if (m_scanlineCounter)
+	{
+		int clocks = m_mapper->GetScanlineClocksUntilIrq();
+		if (clocks > 0)
+		{
+			int untilIrq = PPU.GetDotsUntilScanlineClock(clocks);
+			if (untilIrq < dots) dots = untilIrq;
+		}
+	}
+
+	return dots;
+}
+
+void NES::RequestNMI()
+{
+	m_doNMI = true;
+}
+
+void NES::AssertIRQ()
+{
+	m_irqLine = true;
+}
+
+void NES::ReleaseIRQ()
+{
+	m_irqLine = false;
 }
 
 void NES::Tick()
 {
-	PPU.Cycle();
+	// Interrupts raised by dots the PPU is only catching up on now land before the CPU's next cycle, the same way
+	// they would have in lockstep (the CPU was still busy with its last instruction on those dots)
+	CatchUpPpu(m_globalClockCount);
+	HandleInterrupts();
+
+	CatchUpPpu(m_globalClockCount + 1);
 	if (m_globalClockCount % 3 == 0)
 		CPU.Cycle();
 
+	HandleInterrupts();
+
+	m_globalClockCount += 1;
+}
+
+bool NES::IsIRQPending()
+{
+	return m_irqLine && !CPU.GetIRQFlag();
+}
+
+void NES::HandleInterrupts()
+{
 	if (m_doNMI)
 	{
 		m_doNMI = false;
+		m_interruptCount++;
 		CPU.NonMaskableInterrupt();
 	}
 
-	if (m_doIRQ)
+	if (IsIRQPending() && CPU.GetClockCycles() == 0)
 	{
-		m_doIRQ = false;
+		m_interruptCount++;
 		CPU.MaskableInterrupt();
 	}
-
-	m_globalClockCount += 1;
 }
 
 void NES::Clock(bool completeInstruction)
@@ -99,88 +246,293 @@ void NES::Clock(bool completeInstruction)
 	}
 }
 
-void NES::ClockFullFrame()
+// Runs the PPU up to (not including) the given dot
+void NES::CatchUpPpu(long int clock)
 {
-	do
+	while (m_ppuClockCount < clock)
 	{
-		Tick();
-	} while (!PPU.IsFrameComplete() && !debugRequestStop);
+		// The CPU syncs before it touches the PPU, so a line it can't get to before the end is drawn in one go
+		if (m_scanlineRendering && clock - m_ppuClockCount >= PPU::kScreenWidth && PPU.CanRenderScanline())
+		{
+			PPU.RenderScanline();
+			m_ppuClockCount += PPU::kScreenWidth;
+			continue;
+		}
 
-	debugRequestStop = false;
+		PPU.Cycle();
+		m_ppuClockCount++;
+	}
 }
 
-void NES::WriteCpuMemory(uint16_t address, uint8_t data)
+// Brings the PPU to where it would be in lockstep when the CPU does something it can see.
+// In Tick the PPU has already run the current dot, so this does nothing there.
+void NES::SyncPpu()
 {
-	if (IsRamRegister(address))
-	{
-		// If first three bits are zero we are doing a ram write which needs mirroring
-		// Within $0000 - $1FFF
+	CatchUpPpu(m_globalClockCount + 1);
+}
+
+// CPU cycles the CPU can run whole instructions on its own for (see CPU::RunThreaded), while nothing it does can be
+// seen by the PPU. It stops on anything that touches PPU / IO registers, StepCpuAhead takes it from there.
+int NES::GetRunAheadBudget()
+{
+#if CPU_THREADED_DISPATCH
+	// Only from the point where the next Tick would start a new instruction
+	// Held off entirely while /IRQ is asserted, the CPU would have to stop as soon as it clears I
+	if (m_globalClockCount % 3 != 0 || CPU.GetClockCycles() != 0 || m_doNMI || m_irqLine)
+		return 0;
 
-		uint16_t ramAddress = address & m_ramAddressMask;
+	// Leave idle loops to SkipIdleLoop, it has to see them go round one pass at a time
+	if (m_idleLoopSkipping && CPU.GetIdleLoopAtPC().cycles != 0)
+		return 0;
 
-		// Write to the four mirrored ram locations
-		CPUMemory[ramAddress | m_ramMirror0] = data;
-		CPUMemory[ramAddress | m_ramMirror1] = data;
-		CPUMemory[ramAddress | m_ramMirror2] = data;
-		CPUMemory[ramAddress | m_ramMirror3] = data;
-	}
-	else if (IsPpuRegister(address))
+	int cycleBudget = (int)(m_eventClock - m_globalClockCount) / 3 - CPU::kMaxInstructionCycles;
+	return std::max(cycleBudget, 0);
+#else
+	return 0;
+#endif
+}
+
+// Runs one instruction at the current clock, the PPU only gets caught up if the instruction touches it
+void NES::StepCpuAhead()
+{
+	int cycles = CPU.Step();
+
+	// Lands on the same clock as in Tick, the CPU picks up the interrupt's cycles through Tick afterwards
+	HandleInterrupts();
+
+	m_globalClockCount += cycles * 3;
+}
+
+bool NES::SkipIdleLoop()
+{
+	if (!m_idleLoopSkipping)
+		return false;
+
+	// Only from the point where the next Tick would start a new instruction
+	if (m_globalClockCount % 3 != 0 || CPU.GetClockCycles() != 0 || m_doNMI || IsIRQPending())
+		return false;
+
+	CPU::IdleLoop loop = CPU.GetIdleLoopAtPC();
+	if (loop.cycles == 0)
+		return false;
+
+	// Needs to see the PPU as it is before this dot
+	CatchUpPpu(m_globalClockCount);
+
+	IdleLoopWatch now;
+	now.pc = CPU.GetProgramCounter();
+	now.a = CPU.GetRegA();
+	now.x = CPU.GetRegX();
+	now.y = CPU.GetRegY();
+	now.sp = CPU.GetStackPointer();
+	now.status = CPU.GetStatus();
+	now.instructions = CPU.GetInstructionCount();
+	now.interrupts = m_interruptCount;
+	now.clock = m_globalClockCount;
+	now.quietDots = std::min(PPU.GetDotsUntilStatusChange(), GetDotsUntilNextEvent());
+	now.ppuStatus = PPU.PeekRegister(0x2002);
+
+	// We need to have watched exactly one pass come back with every register unchanged, without an interrupt and
+	// without the PPU changing anything it could read. From then on each pass does the exact same thing until the
+	// next PPU event.
+	const IdleLoopWatch& last = m_idleLoopWatch;
+	bool samePass = last.pc == now.pc && last.a == now.a && last.x == now.x && last.y == now.y && last.sp == now.sp
+		&& last.status == now.status && last.interrupts == now.interrupts && last.ppuStatus == now.ppuStatus
+		&& now.instructions - last.instructions == loop.instructions && now.clock - last.clock <= last.quietDots;
+
+	m_idleLoopWatch = now;
+	if (!samePass)
+		return false;
+
+	int passes = now.quietDots / (loop.cycles * 3);
+	if (passes <= 0)
+		return false;
+
+	// The PPU catches up on its own later, nothing it does in between changes anything the loop reads
+	int dots = passes * loop.cycles * 3;
+	m_globalClockCount += dots;
+
+	// Still sitting at the start of the loop with nothing changed, so this counts as a watched pass too
+	m_idleLoopWatch.clock = m_globalClockCount;
+	m_idleLoopWatch.quietDots = now.quietDots - dots;
+
+	m_idleLoopStats.skips++;
+	m_idleLoopStats.skippedCycles += dots / 3;
+	m_idleLoopAddresses.insert(now.pc);
+	return true;
+}
+
+void NES::ClockFullFrame()
+{
+	if (m_scheduler == Scheduler::CatchUp)
 	{
-		// PPU Registers have a lot of side effects rather than just reading / writing. 
-		// Delegate the functionality to the PPU and let it handle it.
-		PPU.WriteRegister(address, data);
+		RunCatchUpFrame();
 	}
-	else if (address == 0x4014)
+	else
 	{
-		// Activate DMA for the PPU OAM data
-
-		// A DMA transfer actually suspends the CPU for 512 clock cycles but I think that's needlessly complex for this.
-		// I am just going to transfer all the data at once, which means the PPU is running faster than it would 
-		// on a real console. Maybe side effects? 
-		uint16_t startAddress = (data << 8); // Page to transfer is the data passed in
-		for (int i = 0; i < 256; i++)
+		do
 		{
-			PPU.WriteOAMMemory(i, ReadCpuMemory(startAddress + i));
-		}
+			Tick();
+		} while (!PPU.IsFrameComplete() && !debugRequestStop);
 	}
-	else if (address == 0x4016 || address == 0x4017)
+
+	debugRequestStop = false;
+}
+
+void NES::RunCatchUpFrame()
+{
+	int cycleBudget;
+	while ((cycleBudget = ResumeCatchUpFrame()) > 0)
 	{
-		uint8_t contollerLatchMask = data & 0x01;
-		if (contollerLatchMask)
+#if CPU_THREADED_DISPATCH
+		EndRunAhead(CPU.RunThreaded(cycleBudget));
+#endif
+	}
+}
+
+int NES::ResumeCatchUpFrame()
+{
+	do
+	{
+		// Nothing before this dot can raise an interrupt or complete the frame
+		if (!m_eventWindowOpen)
 		{
-			// Poll input
-			FirstControllerLatch = FirstControllerButtonState;
-			SecondControllerLatch = SecondControllerButtonState;
+			m_eventClock = m_ppuClockCount + GetDotsUntilNextEvent();
+			m_eventsChanged = false;
+			m_eventWindowOpen = true;
 		}
-		else
+
+		// Whole instructions for as long as they are sure to finish before it, or until a register write moves it
+		while (!m_doNMI && !IsIRQPending() && !m_eventsChanged)
 		{
-			// Return to serial mode
-			FirstControllerShift = FirstControllerLatch;
-			SecondControllerShift = SecondControllerLatch;
+			// Dots up to the next CPU cycle don't do anything the CPU could see
+			long int cpuClock = m_globalClockCount + (3 - m_globalClockCount % 3) % 3;
+
+			// A CPU stalled by OAM DMA just waits, skip as much of the stall as fits before the event
+			if (CPU.GetClockCycles() != 0)
+			{
+				int cycles = std::min<int>(CPU.GetClockCycles(), (int)(m_eventClock - cpuClock) / 3);
+				if (cycles <= 0)
+					break;
+
+				CPU.SkipCycles(cycles);
+				m_globalClockCount = cpuClock + cycles * 3;
+				continue;
+			}
+
+			if (cpuClock + CPU::kMaxInstructionCycles * 3 > m_eventClock)
+				break;
+
+			m_globalClockCount = cpuClock;
+
+			// Hand the CPU to the caller to run ahead, unless it just came back without getting anywhere
+			if (!m_runAheadStuck)
+			{
+				int cycleBudget = GetRunAheadBudget();
+				if (cycleBudget > 0)
+					return cycleBudget;
+			}
+			m_runAheadStuck = false;
+
+			if (SkipIdleLoop())
+				continue;
+
+			StepCpuAhead();
 		}
+
+		// Events, and the cycles an interrupt adds, go through the lockstep path
+		Tick();
+		m_eventWindowOpen = false;
+	} while (!PPU.IsFrameComplete() && !debugRequestStop);
+
+	return 0;
+}
+
+void NES::EndRunAhead(int cycles)
+{
+	m_globalClockCount += cycles * 3;
+	m_runAheadStuck = cycles == 0;
+}
+
+void NES::MapCpuMemory(uint16_t address, int size, uint8_t* memory)
+{
+	int firstPage = address / kCpuPageSize;
+	for (int i = 0; i < size / kCpuPageSize; i++)
+	{
+		m_cpuReadPages[firstPage + i].memory = memory + i * kCpuPageSize;
+		m_cpuWritePages[firstPage + i].memory = memory + i * kCpuPageSize;
 	}
-	else
+}
+
+void NES::MapCpuMemory(uint16_t address, int size, const uint8_t* memory)
+{
+	int firstPage = address / kCpuPageSize;
+	for (int i = 0; i < size / kCpuPageSize; i++)
 	{
-		CPUMemory[address] = data;
+		m_cpuReadPages[firstPage + i].memory = memory + i * kCpuPageSize;
 	}
 }
 
-uint8_t NES::ReadCpuMemory(uint16_t address, bool peekMode)
+void NES::MapCpuHandlers(uint16_t address, int size, CpuReadHandler read, CpuWriteHandler write)
 {
-	if (IsPpuRegister(address))
+	int firstPage = address / kCpuPageSize;
+	for (int i = 0; i < size / kCpuPageSize; i++)
 	{
-		// PPU Registers have a lot of side effects rather than just reading / writing. 
-		// Delegate the functionality to the PPU and let it handle it.
-		if (peekMode)
-		{
-			PPU.PeekRegister(address);
-		}
-		else
-		{
-			PPU.GetRegister(address);
-		}
+		m_cpuReadPages[firstPage + i] = { nullptr, read };
+		m_cpuWritePages[firstPage + i] = { nullptr, write };
 	}
-	else if (address == 0x4016)
+}
+
+void NES::ResetCpuMemoryMap()
+{
+	// $0000 - $1FFF, RAM mirrors all point at the same 2KB
+	for (int mirror = 0; mirror < 4; mirror++)
+	{
+		MapCpuMemory(mirror * 0x0800, 0x0800, m_cpuRam.data());
+	}
+
+	MapCpuHandlers(0x2000, 0x2000, &NES::ReadPpuRegister, &NES::WritePpuRegister);
+	MapCpuHandlers(0x4000, 0x0100, &NES::ReadIoRegister, &NES::WriteIoRegister);
+
+	// $4100 - $5FFF, expansion area, nothing there
+	MapCpuHandlers(0x4100, 0x1F00, &NES::ReadOpenBus, &NES::WriteOpenBus);
+
+	// $6000 - $7FFF, cartridge RAM
+	MapCpuMemory(0x6000, 0x2000, m_prgRam.data());
+
+	// $8000 - $FFFF, PRG ROM once a cartridge is loaded. NROM has no registers so writes go nowhere.
+	MapCpuHandlers(0x8000, 0x8000, &NES::ReadOpenBus, &NES::WriteOpenBus);
+}
+
+uint8_t NES::ReadPpuRegister(uint16_t address, bool peekMode)
+{
+	// PPU Registers have a lot of side effects rather than just reading / writing. 
+	// Delegate the functionality to the PPU and let it handle it.
+	if (peekMode)
+	{
+		return PPU.PeekRegister(address);
+	}
+	else
+	{
+		SyncPpu();
+		return PPU.GetRegister(address);
+	}
+}
+
+void NES::WritePpuRegister(uint16_t address, uint8_t data)
+{
+	// PPU Registers have a lot of side effects rather than just reading / writing. 
+	// Delegate the functionality to the PPU and let it handle it.
+	SyncPpu();
+	PPU.WriteRegister(address, data);
+
+	// Turning rendering on / off starts or stops the mapper's scanline counter
+	if (m_scanlineCounter) m_eventsChanged = true;
+}
+
+uint8_t NES::ReadIoRegister(uint16_t address, bool peekMode)
+{
+	if (address == 0x4016)
 	{
 		/* First Controller Polling */
 		bool data = (FirstControllerShift & 0x80) > 0;
@@ -196,56 +548,79 @@ uint8_t NES::ReadCpuMemory(uint16_t address, bool peekMode)
 	}
 	else
 	{
-		return CPUMemory[address];
+		return ReadOpenBus(address, peekMode);
 	}
 }
 
-uint16_t NES::MirrorPPUAddress(uint16_t address)
+void NES::WriteIoRegister(uint16_t address, uint8_t data)
 {
-	uint16_t mirroredAddress = address & 0x3FFF;
-	if (mirroredAddress >= 0x3F00 && mirroredAddress < 0x4000)
+	if (address == 0x4014)
 	{
-		mirroredAddress &= 0x001F;
-		if (mirroredAddress == 0x0010) mirroredAddress = 0x0000;
-		if (mirroredAddress == 0x0014) mirroredAddress = 0x0004;
-		if (mirroredAddress == 0x0018) mirroredAddress = 0x0008;
-		if (mirroredAddress == 0x001C) mirroredAddress = 0x000C;
-		mirroredAddress |= 0x3F00;
-	}
-	if (mirroredAddress >= 0x3000 && mirroredAddress <= 0x3EFF)
-	{
-		// Mirrors $2000 - $2EFF
-		mirroredAddress &= ~0x1000;
+		// Activate DMA for the PPU OAM data, the page to transfer is the data passed in
+		SyncPpu();
+
+		// RAM and ROM pages are copied straight out of the memory map, anything else is read byte by byte
+		const uint8_t* source = m_cpuReadPages[data].memory;
+		std::array<uint8_t, kCpuPageSize> page;
+		if (!source)
+		{
+			for (int i = 0; i < kCpuPageSize; i++)
+			{
+				page[i] = ReadCpuMemory((data << 8) + i);
+			}
+			source = page.data();
+		}
+		PPU.WriteOAMDma(source);
+
+		// The CPU is halted while the DMA has the bus: a cycle to halt, another if the DMA starts on an odd cycle,
+		// then 256 read / write pairs. It starts on the cycle after this instruction.
+		long int dmaCycle = m_globalClockCount / 3 + CPU.GetClockCycles();
+		CPU.Stall(513 + (dmaCycle & 1));
 	}
-	if (mirroredAddress >= 0x2000 && mirroredAddress <= 0x2FFF)
+	else if (address == 0x4016 || address == 0x4017)
 	{
-		if (GetCartridgeMirroring())
+		uint8_t contollerLatchMask = data & 0x01;
+		if (contollerLatchMask)
 		{
-			// Vertical name table mirroring
-			// 2000 mirrors 2800, 2400 mirrors 2C00
-			if (mirroredAddress >= 0x2800 && mirroredAddress <= 0x2FFF)
-				mirroredAddress -= 0x0800;
+			// Poll input
+			FirstControllerLatch = FirstControllerButtonState;
+			SecondControllerLatch = SecondControllerButtonState;
 		}
 		else
 		{
-			// Horizontal name table mirroring
-			// 2000 mirrors 2400, 2800 mirrors 2C00
-			if (mirroredAddress >= 0x2400 && mirroredAddress <= 0x27FF)
-				mirroredAddress -= 0x0400;
-			if (mirroredAddress >= 0x2C00 && mirroredAddress <= 0x2FFF)
-				mirroredAddress -= 0x0400;
+			// Return to serial mode
+			FirstControllerShift = FirstControllerLatch;
+			SecondControllerShift = SecondControllerLatch;
 		}
 	}
+}
 
-	return mirroredAddress;
+uint8_t NES::ReadOpenBus(uint16_t address, bool peekMode)
+{
+	return address >> 8;
 }
 
-void NES::WritePPUMemory(uint16_t address, uint8_t data)
+void NES::WriteOpenBus(uint16_t address, uint8_t data)
 {
-	PPUMemory[MirrorPPUAddress(address)] = data;
 }
 
-uint8_t NES::ReadPPUMemory(uint16_t address)
+std::vector<NES::MemoryReportEntry> NES::GetMemoryReport()
 {
-	return PPUMemory[MirrorPPUAddress(address)];
-}
\ No newline at end of file
+	std::vector<MemoryReportEntry> report;
+	report.push_back({ "NES (CPU, PPU and RAM inline)", sizeof(NES), false });
+	report.push_back({ "  CPU", sizeof(CPU), false });
+	report.push_back({ "  PPU", sizeof(PPU), false });
+	report.push_back({ "  CPU memory map", sizeof(m_cpuReadPages) + sizeof(m_cpuWritePages), false });
+	report.push_back({ "  RAM, PRG RAM, VRAM, palette", sizeof(m_cpuRam) + sizeof(m_prgRam) + sizeof(m_vram) + sizeof(m_paletteRam), false });
+	report.push_back({ "Framebuffer", PPU::kScreenWidth * PPU::kScreenHeight * sizeof(uint16_t), false });
+	report.push_back({ "CHR RAM", m_chrRam.capacity(), false });
+	report.push_back({ "Decoded CHR cache", m_chrCache.GetMemoryUsage(), false });
+	if (m_chrCache.GetRomCache()) report.push_back({ "Decoded CHR ROM", m_chrCache.GetRomCache()->GetMemoryUsage(), true });
+	report.push_back({ "CPU decode / idle loop caches", CPU.GetCacheMemoryUsage(), false });
+#if CPU_DYNAREC
+	if (CPU.GetDynarec()) report.push_back({ "Dynarec code cache", CPU.GetDynarec()->GetCodeCache()->GetMemoryUsage(), true });
+#endif
+	report.push_back({ "PRG ROM", m_prgRom.size(), true });
+	report.push_back({ "CHR ROM", m_chrRom.size(), true });
+	return report;
+}
@@ -2,40 +2,138 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
 
+#include "ChrCache.h"
 #include "CPU.h"
 #include "PPU.h"
 #include "GameCartridge.h"
+#include "Mapper.h"
 
 class NES
 {
 public:
-	NES() {};
-	~NES() {};
+	NES();
+	~NES();
 
 	CPU CPU;
 	PPU PPU;
 
 	void PowerOn();
-	void LoadGameCartridge(GameCartridge game);
+	void LoadGameCartridge(const GameCartridge& game);
 
 	void RequestNMI();
-	void RequestIRQ();
+
+	// The cartridge's /IRQ line is level triggered, it stays asserted until the mapper releases it (MMC3: $E000).
+	// The CPU takes it at the next instruction boundary with I clear, and again after RTI if it's still asserted.
+	void AssertIRQ();
+	void ReleaseIRQ();
 
 	// CPU gets 64K of memory
-	void WriteCpuMemory(uint16_t address, uint8_t data);
-	uint8_t ReadCpuMemory(uint16_t address, bool peekMode = false);
+	inline void WriteCpuMemory(uint16_t address, uint8_t data)
+	{
+		const CpuWritePage& page = m_cpuWritePages[address >> 8];
+		if (page.memory) page.memory[address & 0xFF] = data;
+		else (this->*page.handler)(address, data);
+	}
+
+	inline uint8_t ReadCpuMemory(uint16_t address, bool peekMode = false)
+	{
+		const CpuReadPage& page = m_cpuReadPages[address >> 8];
+		if (page.memory) return page.memory[address & 0xFF];
+		return (this->*page.handler)(address, peekMode);
+	}
+
+	/* CPU memory map */
+	// The CPU bus is split into 256 byte pages, each with a read and a write entry. An entry either points straight at
+	// host memory, so RAM / ROM accesses are a single indexed load, or is null and goes through a handler instead
+	// (registers, writes into ROM). Remapping a page is just swapping its pointer.
+	static constexpr int kCpuPageSize = 256;
+	static constexpr int kCpuPageCount = 256;
+
+	typedef uint8_t(NES::*CpuReadHandler)(uint16_t address, bool peekMode);
+	typedef void(NES::*CpuWriteHandler)(uint16_t address, uint8_t data);
+
+	// Points the pages covering [address, address + size) at memory, size has to be a multiple of kCpuPageSize.
+	// Read only memory leaves the write entries of those pages alone.
+	void MapCpuMemory(uint16_t address, int size, uint8_t* memory);
+	void MapCpuMemory(uint16_t address, int size, const uint8_t* memory);
+	void MapCpuHandlers(uint16_t address, int size, CpuReadHandler read, CpuWriteHandler write);
+
+	// Where the page containing address reads from when it's mapped read only, null for RAM and handlers
+	const uint8_t* GetCpuRomPage(uint16_t address) const
+	{
+		const int page = address >> 8;
+		return m_cpuWritePages[page].memory ? nullptr : m_cpuReadPages[page].memory;
+	}
 
 	// PPU gets 64K of memory but it's really just 16K mirrored 4 times
-	void WritePPUMemory(uint16_t address, uint8_t data);
-	uint8_t ReadPPUMemory(uint16_t address);
+	inline void WritePPUMemory(uint16_t address, uint8_t data)
+	{
+		address &= 0x3FFF;
+		if (address >= 0x3F00)
+		{
+			m_paletteRam[MirrorPaletteAddress(address)] = data;
+			return;
+		}
+
+		uint8_t* page = m_ppuWritePages[address >> 10];
+		if (page)
+		{
+			page[address & 0x03FF] = data;
+			if (address < 0x2000)
+			{
+				m_chrCache.MarkDirty(m_patternTableTiles[address >> 10] + ((address & 0x03FF) >> 4));
+			}
+		}
+	}
+
+	inline uint8_t ReadPPUMemory(uint16_t address)
+	{
+		address &= 0x3FFF;
+		if (address >= 0x3F00) return m_paletteRam[MirrorPaletteAddress(address)];
+		return m_ppuReadPages[address >> 10][address & 0x03FF];
+	}
+
+	/* PPU memory map */
+	// $0000 - $3FFF in 1KB pages, like the CPU memory map: pattern tables (0 - 7), the 4 nametables (8 - 11) and their
+	// mirror at $3000 (12 - 15). Palette RAM sits over the end of the last page and is the only range checked for.
+	static constexpr int kPpuPageCount = 16;
+
+	// $3F10 / $3F14 / $3F18 / $3F1C are the same bytes as $3F00 / $3F04 / $3F08 / $3F0C
+	static inline uint8_t MirrorPaletteAddress(uint16_t address)
+	{
+		return address & ((address & 0x03) ? 0x1F : 0x0F);
+	}
+
+	// The tile at a pattern table address ($0000 - $1FFF, any byte of the tile) decoded to 8x8 pixel values,
+	// see ChrCache
+	inline const uint8_t* GetDecodedTile(uint16_t address, bool flipped)
+	{
+		return m_chrCache.GetTile(m_patternTableTiles[(address >> 10) & 0x07] + ((address & 0x03FF) >> 4), flipped);
+	}
+
+	const ChrCache& GetChrCache() { return m_chrCache; }
 
-	uint16_t MirrorPPUAddress(uint16_t address);
+	// The 2KB at $0000 - $07FF, without the mirrors
+	std::span<const uint8_t> GetCpuRam() const { return m_cpuRam; }
+
+	/* Cartridge */
+	// Used by the mapper to switch CHR banks (1KB pages of $0000 - $1FFF) and nametable mirroring
+	void MapPatternTable(int slot, uint8_t* memory);
+	void MapPatternTable(int slot, const uint8_t* memory);
+	void SetMirroring(Mirroring mirroring);
+
+	// Called by the PPU once per rendered scanline
+	void ClockScanlineCounter();
 
 	void SetFirstControllerState(uint8_t state) { FirstControllerButtonState = state; }
 	void SetSecondControllerState(uint8_t state) { SecondControllerButtonState = state; }
 
-	uint8_t GetCartridgeMirroring() { return m_gameMirroring; }
 	uint8_t GetFirstControllerShift() { return FirstControllerShift; }
 	uint8_t GetSecondControllerShift() { return SecondControllerShift; }
 
@@ -43,6 +141,57 @@ public:
 	void Clock(bool completeInstruction);
 	void ClockFullFrame();
 
+	/* Scheduling */
+	// Lockstep runs every dot through Tick. Catch up lets the CPU run whole instructions ahead and only brings the PPU
+	// up to the CPU's clock when the CPU touches it or when the PPU could raise an NMI / complete the frame.
+	// Both produce the exact same frames, lockstep is kept around as the reference.
+	enum class Scheduler
+	{
+		Lockstep,
+		CatchUp
+	};
+
+	void SetScheduler(Scheduler scheduler) { m_scheduler = scheduler; }
+	Scheduler GetScheduler() { return m_scheduler; }
+
+	// Catch up draws whole visible lines with PPU::RenderScanline when the CPU can't touch the PPU partway through.
+	// Off runs every dot through PPU::Cycle, lockstep always does.
+	void SetScanlineRendering(bool enabled) { m_scanlineRendering = enabled; }
+
+	// A catch up frame in pieces, for running the CPUs of several consoles side by side (see LaneCpu). Runs the frame up
+	// to the next point where the CPU can run ahead on its own and returns the CPU cycle budget for that, the same
+	// one CPU::RunThreaded gets. Report how many cycles the CPU ran with EndRunAhead, then call again until it returns
+	// 0 for a complete frame. ClockFullFrame does all of this with the CPU's own RunThreaded.
+	int ResumeCatchUpFrame();
+	void EndRunAhead(int cycles);
+
+	/* Idle loop skipping */
+	// When the CPU is spinning in an idle loop (see CPU::IdleLoop) ClockFullFrame skips whole passes of it at once,
+	// up to the next point the PPU could change what the loop reads or raise an NMI.
+	struct IdleLoopStats
+	{
+		uint64_t skips = 0;
+		uint64_t skippedCycles = 0; // CPU cycles
+	};
+
+	void SetIdleLoopSkipping(bool enabled) { m_idleLoopSkipping = enabled; }
+	const IdleLoopStats& GetIdleLoopStats() { return m_idleLoopStats; }
+
+	// First instruction of every idle loop skipped since the cartridge was loaded
+	const std::set<uint16_t>& GetIdleLoopAddresses() { return m_idleLoopAddresses; }
+
+	/* Memory report */
+	// Everything one console instance holds on to, ROM is listed separately since it is shared with every other
+	// console running the same cartridge.
+	struct MemoryReportEntry
+	{
+		std::string name;
+		size_t bytes;
+		bool shared;
+	};
+
+	std::vector<MemoryReportEntry> GetMemoryReport();
+
 	bool debugRequestStop = false;
 
 private:
@@ -50,9 +199,7 @@ private:
 	NES& operator=(const NES&) = delete;
 
 	bool m_doNMI = false;
-	bool m_doIRQ = false;
-
-	uint8_t m_gameMirroring; // TODO: data shouldnt live in NES class
+	bool m_irqLine = false;
 
 	/* Controllers */
 	// Button state is the current state of buttons pressed on a frame, may not actually get polled by the rom though
@@ -67,18 +214,118 @@ private:
 	uint8_t SecondControllerLatch = 0x00;
 	uint8_t SecondControllerShift = 0x00;
 
-	const uint16_t m_nonRamMask = 0xE000;
-	const uint16_t m_ramAddressMask = 0x07FF;
-	const uint16_t m_ramMirror0 = 0x0000;
-	const uint16_t m_ramMirror1 = 0x0800;
-	const uint16_t m_ramMirror2 = 0x1000;
-	const uint16_t m_ramMirror3 = 0x1800;
-
 	long int m_globalClockCount = 0;
 
-	bool IsRamRegister(uint16_t address);
-	bool IsPpuRegister(uint16_t address);
+	/* CPU memory map */
+	struct CpuReadPage
+	{
+		const uint8_t* memory = nullptr;
+		CpuReadHandler handler = nullptr;
+	};
+
+	struct CpuWritePage
+	{
+		uint8_t* memory = nullptr;
+		CpuWriteHandler handler = nullptr;
+	};
+
+	std::array<CpuReadPage, kCpuPageCount> m_cpuReadPages;
+	std::array<CpuWritePage, kCpuPageCount> m_cpuWritePages;
+
+	void ResetCpuMemoryMap();
+
+	// $2000 - $3FFF, the 8 PPU registers mirrored
+	uint8_t ReadPpuRegister(uint16_t address, bool peekMode);
+	void WritePpuRegister(uint16_t address, uint8_t data);
+
+	// $4000 - $40FF, OAM DMA and controllers. There is no APU, the rest of the page is open bus.
+	uint8_t ReadIoRegister(uint16_t address, bool peekMode);
+	void WriteIoRegister(uint16_t address, uint8_t data);
+
+	// Nothing answers, the CPU reads back the high byte of the address it just put on the bus
+	uint8_t ReadOpenBus(uint16_t address, bool peekMode);
+	void WriteOpenBus(uint16_t address, uint8_t data);
+
+	bool IsIRQPending(); // Asserted with I clear
+	void HandleInterrupts();
+
+	/* Cartridge */
+	std::unique_ptr<Mapper> m_mapper;
+	bool m_scanlineCounter = false;
+
+	template<typename T> void InstallMapper(const GameCartridge& game);
+	template<typename T> void WriteMapperRegister(uint16_t address, uint8_t data);
+
+	/* Scheduling */
+	Scheduler m_scheduler = Scheduler::CatchUp;
+	bool m_scanlineRendering = true;
+
+	// Dots the PPU has actually run, lags behind m_globalClockCount while the CPU runs ahead
+	long int m_ppuClockCount = 0;
+
+	// Set by register writes that can move the next mapper IRQ
+	bool m_eventsChanged = false;
+
+	// Where ResumeCatchUpFrame left off. The dot of the next event, and whether the CPU came back from running ahead
+	// without getting anywhere.
+	long int m_eventClock = 0;
+	bool m_eventWindowOpen = false;
+	bool m_runAheadStuck = false;
+
+	// Like PPU::GetDotsUntilNextEvent, also counting the mapper's IRQ
+	int GetDotsUntilNextEvent();
+
+	void CatchUpPpu(long int clock);
+	void SyncPpu();
+
+	void RunCatchUpFrame();
+	int GetRunAheadBudget();
+	void StepCpuAhead();
+
+	/* Idle loop skipping */
+	// Where the CPU was the last time it sat at the start of an idle loop
+	struct IdleLoopWatch
+	{
+		uint16_t pc = 0x0000;
+		uint8_t a = 0x00;
+		uint8_t x = 0x00;
+		uint8_t y = 0x00;
+		uint8_t sp = 0x00;
+		uint8_t status = 0x00;
+		uint64_t instructions = 0;
+		uint64_t interrupts = 0;
+		long int clock = 0;
+		int quietDots = 0; // PPU::GetDotsUntilStatusChange at the time
+		uint8_t ppuStatus = 0x00;
+	};
+
+	bool m_idleLoopSkipping = true;
+	IdleLoopWatch m_idleLoopWatch;
+	IdleLoopStats m_idleLoopStats;
+	std::set<uint16_t> m_idleLoopAddresses;
+	uint64_t m_interruptCount = 0;
+
+	bool SkipIdleLoop();
+
+	/* Memory */
+	// Sized like the hardware. ROM isn't copied, the memory maps point into the cartridge's mapped file, which
+	// m_romFile keeps alive.
+	std::array<uint8_t, 2 * 1024> m_cpuRam; // Mirrored 4 times over $0000 - $1FFF by the memory map
+	std::array<uint8_t, 8 * 1024> m_prgRam; // $6000 - $7FFF on the cartridge
+	std::array<uint8_t, 4 * 1024> m_vram; // Two nametables, and two more on four screen cartridges. See SetMirroring
+	std::array<uint8_t, 32> m_paletteRam;
+
+	std::shared_ptr<const RomFile> m_romFile;
+	std::span<const uint8_t> m_prgRom;
+	std::span<const uint8_t> m_chrRom;
+	std::vector<uint8_t> m_chrRam; // Only allocated for cartridges without CHR ROM
+
+	// See kPpuPageCount. Pattern table pages point into CHR ROM or CHR RAM, their write pages are null for ROM.
+	std::array<const uint8_t*, kPpuPageCount> m_ppuReadPages;
+	std::array<uint8_t*, kPpuPageCount> m_ppuWritePages;
+	bool m_fourScreenVram = false;
 
-	std::array<uint8_t, 64 * 1024> CPUMemory;
-	std::array<uint8_t, 64 * 1024> PPUMemory;
+	// Decoded copy of CHR, and the first tile of it each of the pages above shows
+	ChrCache m_chrCache;
+	std::array<int, 8> m_patternTableTiles;
 };
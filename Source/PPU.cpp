@@ -1,72 +1,16 @@
 #include "PPU.h"
 #include "NES.h"
+#include "TileDecoder.h"
+
+#include <cstring>
 
 PPU::PPU()
 {
-	nesColors[0x00] = NesColor(84, 84, 84);
-	nesColors[0x01] = NesColor(0, 30, 116);
-	nesColors[0x02] = NesColor(8, 16, 144);
-	nesColors[0x03] = NesColor(48, 0, 136);
-	nesColors[0x04] = NesColor(68, 0, 100);
-	nesColors[0x05] = NesColor(92, 0, 48);
-	nesColors[0x06] = NesColor(84, 4, 0);
-	nesColors[0x07] = NesColor(60, 24, 0);
-	nesColors[0x08] = NesColor(32, 42, 0);
-	nesColors[0x09] = NesColor(8, 58, 0);
-	nesColors[0x0A] = NesColor(0, 64, 0);
-	nesColors[0x0B] = NesColor(0, 60, 0);
-	nesColors[0x0C] = NesColor(0, 50, 60);
-	nesColors[0x0D] = NesColor(0, 0, 0);
-	nesColors[0x0E] = NesColor(0, 0, 0);
-	nesColors[0x0F] = NesColor(0, 0, 0);
-	nesColors[0x10] = NesColor(152, 150, 152);
-	nesColors[0x11] = NesColor(8, 76, 196);
-	nesColors[0x12] = NesColor(48, 50, 236);
-	nesColors[0x13] = NesColor(92, 30, 228);
-	nesColors[0x14] = NesColor(136, 20, 176);
-	nesColors[0x15] = NesColor(160, 20, 100);
-	nesColors[0x16] = NesColor(152, 34, 32);
-	nesColors[0x17] = NesColor(120, 60, 0);
-	nesColors[0x18] = NesColor(84, 90, 0);
-	nesColors[0x19] = NesColor(40, 114, 0);
-	nesColors[0x1A] = NesColor(8, 124, 0);
-	nesColors[0x1B] = NesColor(0, 118, 40);
-	nesColors[0x1C] = NesColor(0, 102, 120);
-	nesColors[0x1D] = NesColor(0, 0, 0);
-	nesColors[0x1E] = NesColor(0, 0, 0);
-	nesColors[0x1F] = NesColor(0, 0, 0);
-	nesColors[0x20] = NesColor(236, 238, 236);
-	nesColors[0x21] = NesColor(76, 154, 236);
-	nesColors[0x22] = NesColor(120, 124, 236);
-	nesColors[0x23] = NesColor(176, 98, 236);
-	nesColors[0x24] = NesColor(228, 84, 236);
-	nesColors[0x25] = NesColor(236, 88, 180);
-	nesColors[0x26] = NesColor(236, 106, 100);
-	nesColors[0x27] = NesColor(212, 136, 32);
-	nesColors[0x28] = NesColor(160, 170, 0);
-	nesColors[0x29] = NesColor(116, 196, 0);
-	nesColors[0x2A] = NesColor(76, 208, 32);
-	nesColors[0x2B] = NesColor(56, 204, 108);
-	nesColors[0x2C] = NesColor(56, 180, 204);
-	nesColors[0x2D] = NesColor(60, 60, 60);
-	nesColors[0x2E] = NesColor(0, 0, 0);
-	nesColors[0x2F] = NesColor(0, 0, 0);
-	nesColors[0x30] = NesColor(236, 238, 236);
-	nesColors[0x31] = NesColor(168, 204, 236);
-	nesColors[0x32] = NesColor(188, 188, 236);
-	nesColors[0x33] = NesColor(212, 178, 236);
-	nesColors[0x34] = NesColor(236, 174, 236);
-	nesColors[0x35] = NesColor(236, 174, 212);
-	nesColors[0x36] = NesColor(236, 180, 176);
-	nesColors[0x37] = NesColor(228, 196, 144);
-	nesColors[0x38] = NesColor(204, 210, 120);
-	nesColors[0x39] = NesColor(180, 222, 120);
-	nesColors[0x3A] = NesColor(168, 226, 144);
-	nesColors[0x3B] = NesColor(152, 226, 180);
-	nesColors[0x3C] = NesColor(160, 214, 228);
-	nesColors[0x3D] = NesColor(160, 162, 160);
-	nesColors[0x3E] = NesColor(0, 0, 0);
-	nesColors[0x3F] = NesColor(0, 0, 0);
+	SetRow(0);
+	screen.reset(new uint16_t[kScreenWidth * kScreenHeight]);
+
+	// Black ($0F) until something is drawn
+	std::fill_n(screen.get(), kScreenWidth * kScreenHeight, 0x000F);
 }
 
 PPU::~PPU()
@@ -94,8 +38,20 @@ uint16_t PPU::GetPPULatchAddress()
 	return m_LatchAddress;
 }
 
+void PPU::WriteOAMDma(const uint8_t* page)
+{
+	// Wraps around to the start of OAM when the OAM address isn't 0
+	int firstPart = 256 - m_OAMAddress;
+	std::memcpy(OAMMemory.data() + m_OAMAddress, page, firstPart);
+	std::memcpy(OAMMemory.data(), page + firstPart, m_OAMAddress);
+	m_spriteBucketsDirty = true;
+}
+
 void PPU::WriteRegister(uint16_t address, uint8_t data)
 {
+	// Scroll, pattern table and VRAM writes can all change the tile being drawn
+	InvalidateBackgroundFetch();
+
 	uint8_t temp = 0;
 	switch (address & 0x07)
 	{
@@ -114,7 +70,7 @@ void PPU::WriteRegister(uint16_t address, uint8_t data)
 		HardSetOAMAddress(data);
 		break;
 	case 0x0004:
-		OAMMemory[m_OAMAddress] = data;
+		WriteOAMMemory(m_OAMAddress, data);
 		break;
 	case 0x0005:
 		if (!latch)
@@ -235,6 +191,59 @@ uint8_t PPU::GetRegister(uint16_t address)
 	return data;
 }
 
+void PPU::FetchBackgroundTile()
+{
+	// Pixel / Tile lookup, with the scroll applied the pixel sits at (x, y) across the 2x2 nametables
+	int x = m_curPixelColumn + m_xScroll; // 0 - 510
+	int y = m_curPixelRow + m_yScroll; // 0 - 494
+
+	// Coarse
+	uint8_t xTile = x / 8;
+	uint8_t yTile = y / 8;
+
+	// Fine
+	uint8_t xPixel = x % 8; // 0 - 7
+	uint8_t yPixel = y % 8; // 0 - 7
+
+	// Scrolling past the right or bottom edge takes us into the next name table
+	uint16_t nameTableOffset = 0x0000;
+	if (xTile > 31)
+	{
+		xTile = xTile - 32;
+		nameTableOffset += 0x0400;
+	}
+	if (yTile > 29)
+	{
+		yTile = yTile - 30;
+		nameTableOffset += 0x0800;
+	}
+
+	// Name Table lookup
+	uint8_t nameTableIndex = (m_Active_NameTableY << 1) | m_Active_NameTableX;
+	uint16_t nameTableRoot = 0x2000 + nameTableIndex * 0x0400 + nameTableOffset;
+
+	uint8_t val = m_NES->ReadPPUMemory(nameTableRoot + yTile * 32 + xTile);
+
+	// Pattern lookup, the whole row of the tile already decoded
+	uint8_t tableId = GetPPUControlBackgroundPatternTable();
+	const uint8_t* row = m_NES->GetDecodedTile(tableId * 0x1000 + val * 16, false) + yPixel * 8;
+	std::copy(row, row + 8, m_bgPixels.begin());
+
+	// Palette lookup is a byte of data containing the palettes for four 2x2 tiles
+	uint16_t attributeTableRoot = nameTableRoot + 0x03C0;
+	uint8_t attributeRegionX = xTile / 4; // 0 - 7
+	uint8_t attributeRegionY = yTile / 4; // 0 - 6
+	uint8_t palette = m_NES->ReadPPUMemory(attributeTableRoot + attributeRegionX + attributeRegionY * 8);
+
+	// Determine which region our tile is and use that palette
+	uint8_t isRight = (xTile / 2) % 2;
+	uint8_t isBottom = (yTile / 2) % 2;
+	m_bgPalette = (palette >> ((isBottom << 2) | (isRight << 1))) & 0x03;
+
+	// The fine scroll may start partway into the tile
+	m_bgPixelsLeft = 8 - xPixel;
+}
+
 void PPU::RenderPixel()
 {
 	bool backgroundOpaque = false;
@@ -245,109 +254,26 @@ void PPU::RenderPixel()
 		// Background Rendering
 		if (GetPPUMaskShowBackground())
 		{
-			// Pixel / Tile lookup
-			// Coarse
-			uint8_t xTile = m_curPixelColumn / 8; // 0 - 31
-			uint8_t yTile = m_curPixelRow / 8; // 0 - 29
-	
-			// Fine
-			uint8_t xPixel = m_curPixelColumn % 8; // 0 - 7
-			uint8_t yPixel = m_curPixelRow % 8; // 0 - 7
-
-			uint16_t nameTableOffset = 0x0000;
-
-			// Apply X Scroll
-			uint8_t xTileScroll = m_xScroll / 8;
-			uint8_t xPixelScroll = m_xScroll % 8;
-
-			// Apply scroll within the pixel, if scrolling into the next tile, update the tile value
-			xPixel += xPixelScroll;
-			if (xPixel > 7)
-			{
-				// Scrolled into new tile
-				xTile += 1;
-				xPixel = xPixel % 8;
-			}
-
-			// Apply scroll of *tiles*, this may take us into a new nametable which will require update.
-			xTile += xTileScroll;
-			if (xTile > 31)
-			{
-				// Scrolled into new name table
-				xTile = xTile - 32;
-				nameTableOffset += 0x0400;
-			}
-
-			// Apply Y Scroll
-			uint8_t yTileScroll = m_yScroll / 8;
-			uint8_t yPixelScroll = m_yScroll % 8;
-
-			// Apply scroll within the pixel, if scrolling into the next tile, update the tile value
-			yPixel += yPixelScroll;
-			if (yPixel > 7)
+			if (m_curPixelColumn == 0 || m_bgPixelsLeft == 0)
 			{
-				// Scrolled into new tile
-				yTile += 1;
-				yPixel = yPixel % 8;
+				FetchBackgroundTile();
 			}
 
-			// Apply scroll of *tiles*, this may take us into a new nametable which will require update.
-			yTile += yTileScroll;
-			if (yTile > 29)
-			{
-				// Scrolled into new name table
-				yTile = yTile - 30;
-				nameTableOffset += 0x0800;
-			}
-
-			// Name Table lookup
-			uint8_t nameTableIndex = (m_Active_NameTableY << 1) | m_Active_NameTableX;
-			uint16_t nameTableRoot = 0x2000 + nameTableIndex * 0x0400 + nameTableOffset;
-
-			uint8_t val = m_NES->ReadPPUMemory(nameTableRoot + yTile * 32 + xTile);
-
-			// Pattern lookup
-			uint8_t tableId = GetPPUControlBackgroundPatternTable();
-			uint8_t l = m_NES->ReadPPUMemory(tableId * 0x1000 + val * 16 + yPixel);
-			uint8_t h = m_NES->ReadPPUMemory(tableId * 0x1000 + val * 16 + yPixel + 8);
-			uint8_t bitLow = (l >> (7 - xPixel)) & 0x01;
-			uint8_t bitHigh = (h >> (7 - xPixel)) & 0x01;
-
 			// This is a value between 0-3 where 0 is transparent
-			uint8_t pixelValue = (bitHigh << 1) | bitLow;
-
-			// Palette lookup
-			uint16_t attributeTableRoot = nameTableRoot + 0x03C0;
-			uint8_t attributeRegionX = xTile / 4; // 0 - 7
-			uint8_t attributeRegionY = yTile / 4; // 0 - 6
-			uint8_t palette = m_NES->ReadPPUMemory(attributeTableRoot + attributeRegionX + attributeRegionY * 8);
-
-			// Palette lookup is a byte of data containing the palettes for four 2x2 tiles
-			uint8_t paletteTL = palette & 0x03;
-			uint8_t paletteTR = (palette >> 2) & 0x03;
-			uint8_t paletteBL = (palette >> 4) & 0x03;
-			uint8_t paletteBR = (palette >> 6) & 0x03;
-
-			// Determine which region our tile is and use that palette
-			uint8_t paletteValue = 0;
-			uint8_t isRight = ((xTile / 2) % 2 == 1);
-			uint8_t isBottom = ((yTile / 2) % 2 == 1);
-			if (isRight and isBottom) { paletteValue = paletteBR; }
-			if (isRight and !isBottom) { paletteValue = paletteTR; }
-			if (!isRight and isBottom) { paletteValue = paletteBL; }
-			if (!isRight and !isBottom) { paletteValue = paletteTL; }
+			uint8_t pixelValue = m_bgPixels[8 - m_bgPixelsLeft];
+			m_bgPixelsLeft--;
 
 			if (pixelValue == 0x00)
 			{
 				uint8_t data = m_NES->ReadPPUMemory(0x3F00);
 
-				screen[m_curPixelRow * 256 + m_curPixelColumn] = nesColors[data];
+				screen[m_curPixelRow * 256 + m_curPixelColumn] = m_pixelBits | (data & kPixelColorMask);
 			}
 			else
 			{
-				uint8_t data = m_NES->ReadPPUMemory(0x3F00 + (paletteValue << 2) + pixelValue);
+				uint8_t data = m_NES->ReadPPUMemory(0x3F00 + (m_bgPalette << 2) + pixelValue);
 
-				screen[m_curPixelRow * 256 + m_curPixelColumn] = nesColors[data];
+				screen[m_curPixelRow * 256 + m_curPixelColumn] = m_pixelBits | (data & kPixelColorMask);
 			}
 
 			backgroundOpaque = pixelValue != 0x00;
@@ -365,46 +291,27 @@ void PPU::RenderPixel()
 
 				uint8_t spritePalette = GetActiveOAMSpritePalette(i);
 				uint8_t spritePriority = GetActiveOAMSpritePriority(i);
-				uint8_t spriteFlipHorizontally = GetActiveOAMSpriteFlipHorizontal(i);
-				uint8_t spriteFlipVertically = GetActiveOAMSpriteFlipVertical(i);
-				uint8_t spriteTileId = GetActiveOAMSpriteId(i);
 
-				if (GetPPUControlSpriteSize())
-				{
-					// 8x16 Sprite Mode
-					// TODO
-				}
-				else
+				// Both sprite sizes, evaluation already picked the row of the 8x8 or 8x16 sprite this line shows
+				if (m_curPixelColumn >= x && m_curPixelColumn - x < 8)
 				{
-					// 8x8 Sprite Mode
-					uint8_t tableId = GetPPUControlForegroundPatternTable();
+					// Render! The row was fetched already flipped
+					uint8_t pixelValue = OAMActiveSpritePixels[i][m_curPixelColumn - x];
 
-					if (m_curPixelColumn >= x && m_curPixelColumn - x < 8)
+					if (pixelValue != 0x00) // If not transparent
 					{
-						// Render!
-						uint8_t xPixel = spriteFlipHorizontally ? 7 - (m_curPixelColumn - x) : m_curPixelColumn - x; // 0 - 7
-
-						uint8_t l = OAMActiveSpriteLow[i];
-						uint8_t h = OAMActiveSpriteHigh[i];
-						uint8_t bitLow = (l >> (7 - xPixel)) & 0x01;
-						uint8_t bitHigh = (h >> (7 - xPixel)) & 0x01;
-						uint8_t pixelValue = (bitHigh << 1) | bitLow;
+						// Because the top text flickers after scrolling, it causes the sprite hit not to register sometimes (it's hitting a blank background)
+						if (backgroundOpaque && m_OAMActiveContainsSpriteZero && (i == 0))
+						{
+							SetStatusSpriteHit(true);
+						}
 
-						if (pixelValue != 0x00) // If not transparent
+						if (!spritePriority || !backgroundOpaque) // Otherwise, background has priority
 						{
-							// Because the top text flickers after scrolling, it causes the sprite hit not to register sometimes (it's hitting a blank background)
-							if (backgroundOpaque && m_OAMActiveContainsSpriteZero && (i == 0))
-							{
-								SetStatusSpriteHit(true);
-							}
-
-							if (!spritePriority || !backgroundOpaque) // Otherwise, background has priority
-							{
-								uint8_t data = m_NES->ReadPPUMemory(0x3F00 + (spritePalette << 2) + pixelValue);
-
-								screen[m_curPixelRow * 256 + m_curPixelColumn] = nesColors[data];
-								break;
-							}
+							uint8_t data = m_NES->ReadPPUMemory(0x3F00 + (spritePalette << 2) + pixelValue);
+
+							screen[m_curPixelRow * 256 + m_curPixelColumn] = m_pixelBits | (data & kPixelColorMask);
+							break;
 						}
 					}
 				}
@@ -413,113 +320,398 @@ void PPU::RenderPixel()
 	}
 }
 
-void PPU::Cycle()
+void PPU::UpdateSpriteZeroHit()
+{
+	if (m_curPixelColumn >= 256 || m_curPixelRow >= 240 || !m_OAMActiveContainsSpriteZero)
+		return;
+	if (!GetPPUMaskShowBackground() || !GetPPUMaskShowSprites())
+		return;
+
+	// Sprite 0 is always the first active sprite when it's on the line
+	int offset = m_curPixelColumn - GetActiveOAMSpriteX(0);
+	if (offset < 0 || offset >= 8 || OAMActiveSpritePixels[0][offset] == 0x00)
+		return;
+
+	// The fetch only depends on the column and state that invalidates it, so fetching just this dot gives the same
+	// background pixel RenderPixel would have got to by shifting
+	InvalidateBackgroundFetch();
+	FetchBackgroundTile();
+	if (m_bgPixels[8 - m_bgPixelsLeft] != 0x00)
+	{
+		SetStatusSpriteHit(true);
+	}
+}
+
+void PPU::RenderScanline()
 {
 	m_completeFrame = false;
 
-	// Pre render line, clear flags
-	if (m_curPixelRow == 261 && m_curPixelColumn == 1)
+	// The pre render line hands over to the first visible one on this dot, same as Cycle()
+	if (m_curPixelRow == 261)
 	{
-		SetStatusVerticalBlank(false);
-		SetStatusSpriteHit(false);
-		SetStatusOverflow(false);
+		SetRow(0);
+		m_curPixelColumn = 0;
 	}
 
-	// Pre render line, update active vertical name table each of these ticks
-	if (m_curPixelRow == 261 && m_curPixelColumn >= 280 && m_curPixelColumn <= 304)
+	// Only sprite 0's columns can change anything but the screen
+	if (m_headless)
 	{
-		if (GetPPUMaskShowBackground() || GetPPUMaskShowSprites())
+		if (m_OAMActiveContainsSpriteZero)
 		{
-			m_Active_NameTableY = m_Temp_NameTableY;
+			int x = GetActiveOAMSpriteX(0);
+			for (m_curPixelColumn = x; m_curPixelColumn < x + 8 && m_curPixelColumn < kScreenWidth; m_curPixelColumn++)
+			{
+				UpdateSpriteZeroHit();
+			}
 		}
+		m_curPixelColumn = kScreenWidth;
+		return;
 	}
 
-	// Now in first render line
-	if (m_curPixelRow == 261 && m_curPixelColumn == 339)
+	uint16_t* line = &screen[m_curPixelRow * kScreenWidth];
+
+	// The palette and mask can't change partway through, so look all of it up once
+	uint16_t colors[32];
+	for (int i = 0; i < 32; i++)
 	{
-		m_curPixelRow = 0;
-		m_curPixelColumn = 0;
+		colors[i] = m_pixelBits | (m_NES->ReadPPUMemory(0x3F00 + i) & kPixelColorMask);
 	}
 
-	// Update active horizontal name table
-	if (m_curPixelColumn == 257)
+	// Background Rendering, with the same tile fetches RenderPixel makes. Each fetch is copied 8 pixels at a time,
+	// the fine scroll may have already used up part of the tile.
+	bool showBackground = GetPPUMaskShowBackground();
+	uint8_t indices[kScreenWidth + 8]; // Palette RAM index of every pixel, the extra 8 let the last tile overrun
+	if (showBackground)
 	{
-		if (GetPPUMaskShowBackground() || GetPPUMaskShowSprites())
+		while (m_curPixelColumn < kScreenWidth)
 		{
-			m_Active_NameTableX = m_Temp_NameTableX;
+			if (m_curPixelColumn == 0 || m_bgPixelsLeft == 0)
+			{
+				FetchBackgroundTile();
+			}
+
+			const uint8_t* pixels = &m_bgPixels[8 - m_bgPixelsLeft];
+
+			// Transparent pixels show the backdrop color at $3F00
+			uint8_t* out = indices + m_curPixelColumn;
+			uint8_t palette = m_bgPalette << 2;
+			for (int i = 0; i < 8; i++)
+			{
+				out[i] = pixels[i] ? palette | pixels[i] : 0x00;
+			}
+
+			int count = std::min(m_bgPixelsLeft, kScreenWidth - m_curPixelColumn);
+			m_bgPixelsLeft -= count;
+			m_curPixelColumn += count;
 		}
 	}
+	m_curPixelColumn = kScreenWidth;
 
-	// Evaluate sprites for next line
-	// TODO: Timing is a bit off here, should happen at column 65 and set data for the next row
-	if ((m_curPixelRow <= 239 || m_curPixelRow == 261) && m_curPixelColumn == 340)
+	// Foreground Rendering. Per pixel the first active sprite that is opaque and not behind the background wins, so
+	// going sprite by sprite and skipping pixels an earlier one already drew gives the same result.
+	if (GetPPUMaskShowSprites())
 	{
-		// Clear and check sprites for OAM memory
-		for (int i = 0; i < 32; i++)
+		bool drawn[kScreenWidth] = {};
+		for (int i = 0; i < m_activeSprites; i++)
 		{
-			OAMActiveMemory[i] = 0x00;
+			int x = GetActiveOAMSpriteX(i);
+			uint8_t spritePalette = GetActiveOAMSpritePalette(i);
+			uint8_t spritePriority = GetActiveOAMSpritePriority(i);
+
+			const std::array<uint8_t, 8>& pixels = OAMActiveSpritePixels[i];
+
+			for (int column = x; column < x + 8 && column < kScreenWidth; column++)
+			{
+				uint8_t pixelValue = pixels[column - x];
+				if (drawn[column] || pixelValue == 0x00)
+					continue;
+
+				bool backgroundOpaque = showBackground && (indices[column] & 0x03) != 0x00;
+				if (backgroundOpaque && m_OAMActiveContainsSpriteZero && (i == 0))
+				{
+					SetStatusSpriteHit(true);
+				}
+
+				if (!spritePriority || !backgroundOpaque)
+				{
+					uint8_t index = (spritePalette << 2) + pixelValue;
+					if (showBackground)
+					{
+						indices[column] = index;
+					}
+					else
+					{
+						// Without the background only sprite pixels get drawn, the rest keep what was there
+						line[column] = colors[index];
+					}
+					drawn[column] = true;
+				}
+			}
 		}
-		for (int i = 0; i < 8; i++)
+	}
+
+	if (showBackground)
+	{
+		TileDecoder::ResolvePalette(indices, kScreenWidth, colors, line);
+	}
+}
+
+void PPU::DrawPatternTable(int table, uint8_t palette, uint16_t* out)
+{
+	uint16_t colors[32];
+	for (int i = 0; i < 32; i++)
+	{
+		colors[i] = m_NES->ReadPPUMemory(0x3F00 + i) & kPixelColorMask;
+	}
+
+	for (int tile = 0; tile < 256; tile++)
+	{
+		const uint8_t* decoded = m_NES->GetDecodedTile(table * 0x1000 + tile * 16, false);
+		uint8_t pixels[64];
+		for (int i = 0; i < 64; i++)
 		{
-			OAMActiveSpriteLow[i] = 0x00;
-			OAMActiveSpriteHigh[i] = 0x00;
+			pixels[i] = decoded[i] | ((palette & 0x07) << 2);
 		}
-		m_OAMActiveContainsSpriteZero = false;
-		m_activeSprites = 0;
 
-		for (int i = 0; i < 64; i++)
+		// Tiles go left to right, top to bottom
+		uint16_t* tileOut = out + (tile / 16) * 8 * kPatternTableSize + (tile % 16) * 8;
+		for (int row = 0; row < 8; row++)
 		{
-			if (m_activeSprites >= 8) break;
+			TileDecoder::ResolvePalette(pixels + row * 8, 8, colors, tileOut + row * kPatternTableSize);
+		}
+	}
+}
 
-			uint8_t y = GetOAMSpriteY(i)+1;
+void PPU::BuildSpriteBuckets()
+{
+	for (auto& count : m_spriteBucketCounts) count = 0;
 
-			if ((m_curPixelRow+1) >= y && (m_curPixelRow+1) - y < 8)
+	// OAM order, so each line keeps the same first 8 a scan of all 64 would find
+	int height = m_spriteBucketHeight;
+	for (int i = 0; i < 64; i++)
+	{
+		uint8_t y = GetOAMSpriteY(i) + 1;
+		for (int line = y; line < y + height && line < kSpriteLines; line++)
+		{
+			uint8_t& count = m_spriteBucketCounts[line];
+			if (count < 8)
 			{
-				int j = m_activeSprites * 4;
-				OAMActiveMemory[j] = y;
-				OAMActiveMemory[j + 1] = GetOAMSpriteId(i);
- 				OAMActiveMemory[j + 2] = GetOAMSpriteAttribute(i);
-				OAMActiveMemory[j + 3] = GetOAMSpriteX(i);
-
-				uint8_t yPixel = GetOAMSpriteFlipVertical(i) ? 7 - ((m_curPixelRow+1) - y) : (m_curPixelRow+1) - y; // 0 - 7
-				uint8_t tableId = GetPPUControlForegroundPatternTable();
-				uint8_t l = m_NES->ReadPPUMemory(tableId * 0x1000 + GetOAMSpriteId(i) * 16 + yPixel);
-				uint8_t h = m_NES->ReadPPUMemory(tableId * 0x1000 + GetOAMSpriteId(i) * 16 + yPixel + 8);
-				OAMActiveSpriteLow[m_activeSprites] = l;
-				OAMActiveSpriteHigh[m_activeSprites] = h;
-
-				m_activeSprites += 1;
-	
-				// Is sprite zero active? If it is we need to check for sprite 0 hits
-				if (i == 0)
-				{
-					m_OAMActiveContainsSpriteZero = true;
-				}
+				m_spriteBuckets[line][count++] = (uint8_t)i;
 			}
 		}
 	}
 
-	// Notify of vertical blank (end of visible frame)
-	if (m_curPixelRow == 241 && m_curPixelColumn == 1)
+	m_spriteBucketsDirty = false;
+}
+
+void PPU::EvaluateSprites()
+{
+	int height = GetPPUControlSpriteSize() ? 16 : 8;
+	if (m_spriteBucketsDirty || m_spriteBucketHeight != height)
+	{
+		m_spriteBucketHeight = height;
+		BuildSpriteBuckets();
+	}
+
+	int line = m_curPixelRow + 1;
+	m_OAMActiveContainsSpriteZero = false;
+	m_activeSprites = m_spriteBucketCounts[line];
+
+	for (int j = 0; j < m_activeSprites; j++)
+	{
+		int i = m_spriteBuckets[line][j];
+		uint8_t y = GetOAMSpriteY(i) + 1;
+		uint8_t id = GetOAMSpriteId(i);
+		OAMActiveMemory[j * 4] = y;
+		OAMActiveMemory[j * 4 + 1] = id;
+		OAMActiveMemory[j * 4 + 2] = GetOAMSpriteAttribute(i);
+		OAMActiveMemory[j * 4 + 3] = GetOAMSpriteX(i);
+
+		int yPixel = GetOAMSpriteFlipVertical(i) ? height - 1 - (line - y) : line - y; // 0 - 7, or 0 - 15 for 8x16
+
+		// 8x16 sprites pick their table with bit 0 of the id, the top half is the even tile and the bottom the odd one
+		uint16_t patternAddress;
+		if (height == 16)
+		{
+			patternAddress = (id & 0x01) * 0x1000 + ((id & 0xFE) + (yPixel >> 3)) * 16;
+		}
+		else
+		{
+			patternAddress = GetPPUControlForegroundPatternTable() * 0x1000 + id * 16;
+		}
+
+		const uint8_t* row = m_NES->GetDecodedTile(patternAddress, GetOAMSpriteFlipHorizontal(i)) + (yPixel & 0x07) * 8;
+		std::copy(row, row + 8, OAMActiveSpritePixels[j].begin());
+
+		// Is sprite zero active? If it is we need to check for sprite 0 hits
+		if (i == 0)
+		{
+			m_OAMActiveContainsSpriteZero = true;
+		}
+	}
+}
+
+/* Dot state machine */
+// What Cycle() does on a dot. Most dots are only kDotRender or nothing.
+enum DotAction : uint8_t
+{
+	kDotRender = 0x01, // Visible pixel
+	kDotClearFlags = 0x02, // Pre render line clears vertical blank, sprite 0 hit and overflow
+	kDotCopyY = 0x04, // Vertical nametable from the temporary one
+	kDotCopyX = 0x08, // Horizontal nametable from the temporary one
+	kDotEvaluateSprites = 0x10,
+	kDotScanlineClock = 0x20, // See NES::ClockScanlineCounter
+	kDotVerticalBlank = 0x40, // Start of vertical blank and the NMI
+	kDotFrameWrap = 0x80 // Pre render line hands over to line 0
+};
+
+// Every line is one of these, each with its own row of DotActions, one per column
+enum LineType
+{
+	kLineVisible, // 0 - 239
+	kLinePostRender, // 240
+	kLineVerticalBlankStart, // 241
+	kLineVerticalBlank, // 242 - 260
+	kLinePreRender, // 261
+	kLineTypeCount
+};
+
+struct DotTable
+{
+	uint8_t actions[kLineTypeCount][341];
+	uint8_t lineTypes[262];
+};
+
+static constexpr DotTable BuildDotTable()
+{
+	DotTable table = {};
+	for (int row = 0; row < 262; row++)
 	{
-		SetStatusVerticalBlank(true);
-		if (GetPPUControlNMIFlag())
+		if (row < 240) table.lineTypes[row] = kLineVisible;
+		else if (row == 240) table.lineTypes[row] = kLinePostRender;
+		else if (row == 241) table.lineTypes[row] = kLineVerticalBlankStart;
+		else if (row < 261) table.lineTypes[row] = kLineVerticalBlank;
+		else table.lineTypes[row] = kLinePreRender;
+	}
+
+	for (int type = 0; type < kLineTypeCount; type++)
+	{
+		uint8_t* actions = table.actions[type];
+		bool rendered = type == kLineVisible || type == kLinePreRender;
+
+		actions[257] |= kDotCopyX;
+		if (rendered)
 		{
-			m_NES->RequestNMI();
+			actions[260] |= kDotScanlineClock;
+			actions[340] |= kDotEvaluateSprites;
 		}
 	}
 
-	// Render the pixel if we are in the visible frame
-	if (!GetStatusVerticalBlank())
+	for (int column = 0; column < 256; column++)
+	{
+		table.actions[kLineVisible][column] |= kDotRender;
+	}
+
+	table.actions[kLineVerticalBlankStart][1] |= kDotVerticalBlank;
+
+	table.actions[kLinePreRender][1] |= kDotClearFlags;
+	for (int column = 280; column <= 304; column++)
+	{
+		table.actions[kLinePreRender][column] |= kDotCopyY;
+	}
+	table.actions[kLinePreRender][339] |= kDotFrameWrap;
+
+	return table;
+}
+
+static constexpr DotTable kDotTable = BuildDotTable();
+
+void PPU::SetRow(int row)
+{
+	m_curPixelRow = row;
+	m_dotActions = kDotTable.actions[kDotTable.lineTypes[row]];
+}
+
+void PPU::Cycle()
+{
+	m_completeFrame = false;
+
+	// The common case, a visible dot with nothing else on it. The column can't wrap before 341.
+	uint8_t actions = m_dotActions[m_curPixelColumn];
+	if (actions == kDotRender)
 	{
-		RenderPixel();
+		if (m_headless) UpdateSpriteZeroHit();
+		else RenderPixel();
+		m_curPixelColumn++;
+		return;
+	}
+
+	if (actions != 0)
+	{
+		// Pre render line, clear flags
+		if (actions & kDotClearFlags)
+		{
+			SetStatusVerticalBlank(false);
+			SetStatusSpriteHit(false);
+			SetStatusOverflow(false);
+		}
+
+		// Pre render line, update active vertical name table each of these ticks
+		if ((actions & kDotCopyY) && (GetPPUMaskShowBackground() || GetPPUMaskShowSprites()))
+		{
+			m_Active_NameTableY = m_Temp_NameTableY;
+		}
+
+		// Now in first render line, the rest of this dot is the first dot of line 0
+		if (actions & kDotFrameWrap)
+		{
+			SetRow(0);
+			m_curPixelColumn = 0;
+			actions = m_dotActions[0];
+		}
+
+		// Update active horizontal name table
+		if ((actions & kDotCopyX) && (GetPPUMaskShowBackground() || GetPPUMaskShowSprites()))
+		{
+			m_Active_NameTableX = m_Temp_NameTableX;
+		}
+
+		// Evaluate sprites for next line
+		// TODO: Timing is a bit off here, should happen at column 65 and set data for the next row
+		if (actions & kDotEvaluateSprites)
+		{
+			EvaluateSprites();
+		}
+
+		// Mapper scanline counters (MMC3) see the PPU switch to sprite pattern fetches around here on every rendered line
+		if ((actions & kDotScanlineClock) && (GetPPUMaskShowBackground() || GetPPUMaskShowSprites()))
+		{
+			m_NES->ClockScanlineCounter();
+		}
+
+		// Notify of vertical blank (end of visible frame)
+		if (actions & kDotVerticalBlank)
+		{
+			SetStatusVerticalBlank(true);
+			if (GetPPUControlNMIFlag())
+			{
+				m_NES->RequestNMI();
+			}
+		}
+
+		// Render the pixel if we are in the visible frame
+		if (actions & kDotRender)
+		{
+			if (m_headless) UpdateSpriteZeroHit();
+			else RenderPixel();
+		}
 	}
 
 	m_curPixelColumn++;
 	if (m_curPixelColumn >= 341)
 	{
 		m_curPixelColumn = 0;
-		m_curPixelRow++;
+		SetRow(m_curPixelRow + 1);
 		if (m_curPixelRow == 261)
 		{
 			// Just completed a frame, now in pre-render line
@@ -531,4 +723,77 @@ void PPU::Cycle()
 bool PPU::IsFrameComplete()
 {
 	return m_completeFrame;
+}
+
+// Dots in the order Cycle() visits them. The pre render line jumps back to the top of the frame at column 339.
+int PPU::GetDotIndex(int row, int column)
+{
+	if (row == 261 && column >= 339) return 0;
+	return row * 341 + column;
+}
+
+int PPU::GetDotsUntil(int row, int column)
+{
+	int now = GetDotIndex(m_curPixelRow, m_curPixelColumn);
+	return (GetDotIndex(row, column) - now + kDotsPerFrame) % kDotsPerFrame;
+}
+
+int PPU::GetDotsUntilNextEvent()
+{
+	// Vertical blank (and NMI) starts at 241,1. The frame completes on the last dot of 260.
+	int untilVerticalBlank = GetDotsUntil(241, 1);
+	int untilFrameComplete = GetDotsUntil(260, 340);
+
+	return untilVerticalBlank < untilFrameComplete ? untilVerticalBlank : untilFrameComplete;
+}
+
+int PPU::GetDotsUntilStatusChange()
+{
+	int dots = GetDotsUntilNextEvent();
+
+	// Pre render line clears the status flags
+	int untilFlagsClear = GetDotsUntil(261, 1);
+	if (untilFlagsClear < dots) dots = untilFlagsClear;
+
+	// Sprite zero can only hit on the rows it covers, don't look any closer than that
+	if (GetPPUMaskShowBackground() && GetPPUMaskShowSprites() && !GetStatusSpriteHit())
+	{
+		int firstRow = GetOAMSpriteY(0) + 1;
+		int lastRow = firstRow + (GetPPUControlSpriteSize() ? 15 : 7);
+
+		if (firstRow < 240)
+		{
+			if (m_curPixelRow >= firstRow && m_curPixelRow <= lastRow)
+			{
+				dots = 0;
+			}
+			else
+			{
+				int untilSpriteZero = GetDotsUntil(firstRow, 0);
+				if (untilSpriteZero < dots) dots = untilSpriteZero;
+			}
+		}
+	}
+
+	return dots;
+}
+
+int PPU::GetDotsUntilScanlineClock(int clocks)
+{
+	if (!GetPPUMaskShowBackground() && !GetPPUMaskShowSprites())
+		return kDotsPerFrame;
+
+	// One clock on each of the 240 visible rows and the pre render line
+	const int kClocksPerFrame = 241;
+	std::array<int, kClocksPerFrame> untilClock;
+	for (int row = 0; row < 240; row++)
+	{
+		untilClock[row] = GetDotsUntil(row, 260);
+	}
+	untilClock[240] = GetDotsUntil(261, 260);
+
+	int frames = (clocks - 1) / kClocksPerFrame;
+	int index = (clocks - 1) % kClocksPerFrame;
+	std::nth_element(untilClock.begin(), untilClock.begin() + index, untilClock.end());
+	return untilClock[index] + frames * kDotsPerFrame;
 }
\ No newline at end of file
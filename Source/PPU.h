@@ -1,27 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 #include <array>
 #include <map>
+#include <memory>
 #include <string>
 
 class NES;
 
-struct NesColor
-{
-	union
-	{
-		uint32_t n = 0;
-		struct { uint8_t r; uint8_t g; uint8_t b; uint8_t a; };
-	};
-
-	NesColor() {}
-	NesColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha = 0x00)
-	{
-		n = red | (green << 8) | (blue << 16) | (alpha << 24);
-	}
-};
-
 class PPU
 {
 public:
@@ -36,9 +23,12 @@ public:
 	uint8_t PeekRegister(uint16_t address);
 	uint8_t GetRegister(uint16_t address);
 
-	inline void WriteOAMMemory(uint8_t address, uint8_t data) { OAMMemory[address] = data; }
+	inline void WriteOAMMemory(uint8_t address, uint8_t data) { OAMMemory[address] = data; m_spriteBucketsDirty = true; }
 	inline uint8_t ReadOAMMemory(uint8_t address) { return OAMMemory[address]; }
 
+	// OAM DMA, a whole 256 byte page written through $2004 starting at the OAM address
+	void WriteOAMDma(const uint8_t* page);
+
 	inline uint8_t GetOAMSpriteY(int index) { return OAMMemory[index * 4]; }
 	inline uint8_t GetOAMSpriteId(int index) { return OAMMemory[index * 4 + 1]; }
 	inline uint8_t GetOAMSpriteAttribute(int index) { return OAMMemory[index * 4 + 2]; }
@@ -65,10 +55,74 @@ public:
 	uint16_t GetPPULatchAddress();
 
 	bool IsFrameComplete();
-	NesColor* GetScreenBuffer() { return screen; }
+
+	static constexpr int kScreenWidth = 256;
+	static constexpr int kScreenHeight = 240;
+
+	/* Framebuffer */
+	// One 16 bit pixel per dot, the NES color from palette RAM with the $2001 emphasis and grayscale bits it was drawn
+	// with. FrameConverter turns a frame of them into RGB.
+	static constexpr uint16_t kPixelColorMask = 0x003F;
+	static constexpr int kPixelEmphasisShift = 6; // Red, green, blue in bits 6 - 8
+	static constexpr uint16_t kPixelGrayscale = 0x0200;
+
+	const uint16_t* GetScreenBuffer() { return screen.get(); }
+
+	/* Headless */
+	// Keeps all the timing, registers, NMIs and sprite 0 hits but draws nothing, the framebuffer keeps the last frame
+	// drawn. Sprite 0 hits are worked out from sprite 0's row and the background pixels under it alone.
+	// Meant to be switched between frames, to only draw the ones that are needed.
+	void SetHeadless(bool headless) { m_headless = headless; InvalidateBackgroundFetch(); }
+	bool IsHeadless() { return m_headless; }
+
+	/* Debug views */
+	// Pattern table 0 or 1 as 16x16 tiles in a 128x128 image, colored with one of the 8 palettes. Same pixels as the
+	// framebuffer.
+	static constexpr int kPatternTableSize = 128;
+	void DrawPatternTable(int table, uint8_t palette, uint16_t* out);
+
+	/* Scanline rendering */
+	// At the first dot of a visible line, RenderScanline can stand in for the next kScreenWidth calls to Cycle().
+	// It draws the line in one go, so it's only valid when nothing writes PPU registers or switches banks on those
+	// dots. It produces exactly what the per dot path would.
+	inline bool CanRenderScanline()
+	{
+		bool lineStart = (m_curPixelColumn == 0 && m_curPixelRow < kScreenHeight) || (m_curPixelRow == 261 && m_curPixelColumn == 339);
+		return lineStart && !GetStatusVerticalBlank();
+	}
+	void RenderScanline();
+
+	// Makes the next background pixel fetch its tile again, for changes to pattern tables / nametables outside the PPU
+	void InvalidateBackgroundFetch() { m_bgPixelsLeft = 0; }
+
+	// How many more calls to Cycle() are guaranteed not to raise an NMI or complete the frame
+	int GetDotsUntilNextEvent();
+
+	// Same as GetDotsUntilNextEvent, but also guaranteed not to change what a read of $2002 returns.
+	// Only holds as long as the CPU doesn't write any PPU registers in the meantime.
+	int GetDotsUntilStatusChange();
+
+	// How many more calls to Cycle() come before the given number of scanline counter clocks (see NES::ClockScanlineCounter).
+	// Assumes rendering stays as it is.
+	int GetDotsUntilScanlineClock(int clocks);
 
 private:
+	static constexpr int kDotsPerFrame = 261 * 341 + 339;
+
+	/* Dot state machine */
+	// What Cycle() does on each dot of the current line, a row of the table in PPU.cpp for its line type
+	const uint8_t* m_dotActions = nullptr;
+	void SetRow(int row);
+
+	static int GetDotIndex(int row, int column);
+	int GetDotsUntil(int row, int column);
+
 	void RenderPixel();
+	void FetchBackgroundTile();
+
+	// What RenderPixel does to the status register, without drawing
+	void UpdateSpriteZeroHit();
+	bool m_headless = false;
 
 	/* $2000 Register - PPUCTRL */
 	// No idea what the master / slave bit does. Should usually be cleared though
@@ -85,15 +139,22 @@ private:
 
 	/* $2001 Register - PPU Mask */
 	uint8_t m_PPUMask = 0;
-	inline void HardSetPPUMask(uint8_t reg) { m_PPUMask = reg; }
-	inline bool GetPPUMaskGrayscale() { return (m_PPUMask & 0x01) != 0x00; } // Not yet implemented
+	inline void HardSetPPUMask(uint8_t reg)
+	{
+		m_PPUMask = reg;
+		m_pixelBits = ((reg & 0xE0) >> 5 << kPixelEmphasisShift) | ((reg & 0x01) ? kPixelGrayscale : 0x0000);
+	}
+	inline bool GetPPUMaskGrayscale() { return (m_PPUMask & 0x01) != 0x00; }
 	inline bool GetPPUMaskShowLeftBackground() { return (m_PPUMask & 0x02) != 0x00; } // Not yet implemented
 	inline bool GetPPUMaskShowLeftSprites() { return (m_PPUMask & 0x04) != 0x00; } // Not yet implemented
 	inline bool GetPPUMaskShowBackground() { return (m_PPUMask & 0x08) != 0x00; }
 	inline bool GetPPUMaskShowSprites() { return (m_PPUMask & 0x10) != 0x00; }
-	inline bool GetPPUMaskEmphasizeRed() { return (m_PPUMask & 0x20) != 0x00; } // Not yet implemented
-	inline bool GetPPUMaskEmphasizeGreen() { return (m_PPUMask & 0x40) != 0x00; } // Not yet implemented
-	inline bool GetPPUMaskEmphasizeBlue() { return (m_PPUMask & 0x80) != 0x00; } // Not yet implemented
+	inline bool GetPPUMaskEmphasizeRed() { return (m_PPUMask & 0x20) != 0x00; }
+	inline bool GetPPUMaskEmphasizeGreen() { return (m_PPUMask & 0x40) != 0x00; }
+	inline bool GetPPUMaskEmphasizeBlue() { return (m_PPUMask & 0x80) != 0x00; }
+
+	// Emphasis and grayscale in framebuffer pixel layout, or'd into every pixel drawn
+	uint16_t m_pixelBits = 0x0000;
 
 	/* $2002 Register - PPU Status */
 	uint8_t m_PPUStatus = 0;
@@ -111,11 +172,23 @@ private:
 	/* $2004 Register - OAM Data */
 	std::array<uint8_t, 256> OAMMemory;
 	std::array<uint8_t, 32> OAMActiveMemory;
-	std::array<uint8_t, 8> OAMActiveSpriteLow;
-	std::array<uint8_t, 8> OAMActiveSpriteHigh;
+	std::array<std::array<uint8_t, 8>, 8> OAMActiveSpritePixels; // The line's row of each active sprite, flipped already
 	bool m_OAMActiveContainsSpriteZero = false;
 	int m_activeSprites = 0;
 
+	/* Sprite evaluation */
+	// OAM sorted by the lines each sprite covers, the first 8 per line in OAM order. Rebuilt when OAM or the sprite
+	// size changes, which is usually once a frame after the OAM DMA, so evaluating a line is just a lookup.
+	// Indexed by the line being evaluated for, the pre render line evaluates for 262.
+	static constexpr int kSpriteLines = 263;
+	std::array<std::array<uint8_t, 8>, kSpriteLines> m_spriteBuckets;
+	std::array<uint8_t, kSpriteLines> m_spriteBucketCounts;
+	int m_spriteBucketHeight = 8;
+	bool m_spriteBucketsDirty = true;
+
+	void BuildSpriteBuckets();
+	void EvaluateSprites();
+
 	/* $2005 Register - Nametable scroll */
 	uint8_t m_xScroll;
 	uint8_t m_yScroll;
@@ -137,6 +210,15 @@ private:
 	uint8_t m_Active_NameTableX = 0;
 	uint8_t m_Active_NameTableY = 0;
 
-	NesColor nesColors[0x40];
-	NesColor screen[61440]; 
+	/* Background fetch */
+	// Like the hardware, the nametable, attribute and pattern row are fetched once per tile and the pixels are used
+	// up one per dot. The tile is fetched again at the next tile boundary, at the start of each line, or after
+	// anything invalidates it. Only the first 8 pixels are the row, the rest lets RenderScanline copy 8 at a time from
+	// any of them.
+	std::array<uint8_t, 16> m_bgPixels = {};
+	uint8_t m_bgPalette = 0;
+	int m_bgPixelsLeft = 0;
+
+	// Lives on the heap so the registers above stay packed together
+	std::unique_ptr<uint16_t[]> screen;
 };
@@ -0,0 +1,89 @@
+#include "RomFile.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+std::shared_ptr<const RomFile> RomFile::Open(const std::string& filePath)
+{
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	std::shared_ptr<RomFile> rom(new RomFile());
+	rom->m_data = static_cast<const uint8_t*>(data);
+	rom->m_size = (size_t)size.QuadPart;
+	rom->m_file = file;
+	rom->m_mapping = mapping;
+	return rom;
+}
+
+RomFile::~RomFile()
+{
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) CloseHandle(m_file);
+}
+
+#else
+
+std::shared_ptr<const RomFile> RomFile::Open(const std::string& filePath)
+{
+	int file = open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		close(file);
+		return nullptr;
+	}
+
+	// The mapping keeps its own reference to the file
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	std::shared_ptr<RomFile> rom(new RomFile());
+	rom->m_data = static_cast<const uint8_t*>(data);
+	rom->m_size = (size_t)info.st_size;
+	return rom;
+}
+
+RomFile::~RomFile()
+{
+	if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+/*
+	A ROM file mapped read only into memory. The OS shares the pages with its file cache, so every console loaded from
+	the same file reads the same physical memory and nothing is copied at load time. The mapping goes away when the
+	last GameCartridge / NES holding on to it does.
+*/
+class RomFile
+{
+public:
+	// Null if the file can't be opened or mapped
+	static std::shared_ptr<const RomFile> Open(const std::string& filePath);
+
+	~RomFile();
+
+	std::span<const uint8_t> GetData() const { return { m_data, m_size }; }
+
+private:
+	RomFile() {}
+	RomFile(const RomFile&) = delete;
+	RomFile& operator=(const RomFile&) = delete;
+
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+#if defined(_WIN32)
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
@@ -0,0 +1,214 @@
+#include "RomHash.h"
+
+#include <algorithm>
+#include <cstring>
+
+/* CRC-32 */
+// tables[0] is the classic byte at a time table, tables[n] advances a byte that sits n bytes further back
+struct Crc32Tables
+{
+	uint32_t tables[8][256];
+
+	Crc32Tables()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+			}
+			tables[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			for (int n = 1; n < 8; n++)
+			{
+				tables[n][i] = (tables[n - 1][i] >> 8) ^ tables[0][tables[n - 1][i] & 0xFF];
+			}
+		}
+	}
+};
+
+static const Crc32Tables kCrc32Tables;
+
+void Crc32::Update(std::span<const uint8_t> data)
+{
+	const uint32_t (&t)[8][256] = kCrc32Tables.tables;
+	const uint8_t* bytes = data.data();
+	size_t size = data.size();
+	uint32_t crc = m_crc;
+
+	// 8 table lookups per 8 bytes instead of 8 dependent shifts, the lookups don't depend on each other
+	while (size >= 8)
+	{
+		uint32_t low;
+		uint32_t high;
+		std::memcpy(&low, bytes, 4);
+		std::memcpy(&high, bytes + 4, 4);
+		low ^= crc;
+
+		crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+			t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+
+		bytes += 8;
+		size -= 8;
+	}
+
+	while (size > 0)
+	{
+		crc = (crc >> 8) ^ t[0][(crc ^ *bytes) & 0xFF];
+		bytes++;
+		size--;
+	}
+
+	m_crc = crc;
+}
+
+uint32_t Crc32::Compute(std::span<const uint8_t> data)
+{
+	Crc32 crc;
+	crc.Update(data);
+	return crc.GetValue();
+}
+
+/* SHA-1 */
+static inline uint32_t RotateLeft(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+void Sha1::Update(std::span<const uint8_t> data)
+{
+	m_length += data.size();
+
+	size_t offset = 0;
+	if (m_blockSize > 0)
+	{
+		size_t count = std::min(data.size(), m_block.size() - m_blockSize);
+		std::memcpy(m_block.data() + m_blockSize, data.data(), count);
+		m_blockSize += count;
+		offset = count;
+
+		if (m_blockSize < m_block.size())
+			return;
+
+		ProcessBlock(m_block.data());
+		m_blockSize = 0;
+	}
+
+	// Whole blocks straight from the input
+	for (; offset + 64 <= data.size(); offset += 64)
+	{
+		ProcessBlock(data.data() + offset);
+	}
+
+	m_blockSize = data.size() - offset;
+	std::memcpy(m_block.data(), data.data() + offset, m_blockSize);
+}
+
+Sha1Digest Sha1::Finish()
+{
+	uint64_t bitLength = m_length * 8;
+
+	// A 1 bit, zeros up to 8 bytes short of a block, then the length in bits
+	uint8_t padding[72] = { 0x80 };
+	size_t paddingSize = (m_blockSize < 56) ? 56 - m_blockSize : 120 - m_blockSize;
+	for (int i = 0; i < 8; i++)
+	{
+		padding[paddingSize + i] = (uint8_t)(bitLength >> (56 - i * 8));
+	}
+	Update({ padding, paddingSize + 8 });
+
+	Sha1Digest digest;
+	for (int i = 0; i < 5; i++)
+	{
+		digest[i * 4 + 0] = (uint8_t)(m_state[i] >> 24);
+		digest[i * 4 + 1] = (uint8_t)(m_state[i] >> 16);
+		digest[i * 4 + 2] = (uint8_t)(m_state[i] >> 8);
+		digest[i * 4 + 3] = (uint8_t)(m_state[i]);
+	}
+	return digest;
+}
+
+void Sha1::ProcessBlock(const uint8_t block[64])
+{
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 80; i++)
+	{
+		w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+
+	uint32_t a = m_state[0];
+	uint32_t b = m_state[1];
+	uint32_t c = m_state[2];
+	uint32_t d = m_state[3];
+	uint32_t e = m_state[4];
+
+	for (int i = 0; i < 80; i++)
+	{
+		uint32_t f;
+		uint32_t k;
+		if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+		else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+		else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+		else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+
+		uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = RotateLeft(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	m_state[0] += a;
+	m_state[1] += b;
+	m_state[2] += c;
+	m_state[3] += d;
+	m_state[4] += e;
+}
+
+Sha1Digest Sha1::Compute(std::span<const uint8_t> data)
+{
+	Sha1 sha1;
+	sha1.Update(data);
+	return sha1.Finish();
+}
+
+std::string Sha1::ToHex(const Sha1Digest& digest)
+{
+	const char* kDigits = "0123456789abcdef";
+	std::string hex;
+	for (uint8_t byte : digest)
+	{
+		hex += kDigits[byte >> 4];
+		hex += kDigits[byte & 0x0F];
+	}
+	return hex;
+}
+
+bool Sha1::FromHex(const std::string& hex, Sha1Digest& digest)
+{
+	if (hex.size() != digest.size() * 2)
+		return false;
+
+	for (size_t i = 0; i < hex.size(); i++)
+	{
+		char c = hex[i];
+		uint8_t digit;
+		if (c >= '0' && c <= '9') digit = c - '0';
+		else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+		else return false;
+
+		uint8_t& byte = digest[i / 2];
+		byte = (i % 2 == 0) ? (uint8_t)(digit << 4) : (uint8_t)(byte | digit);
+	}
+	return true;
+}
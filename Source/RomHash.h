@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+/*
+	Checksums used to identify ROM dumps, both over the PRG and CHR data without the iNES header, the same way
+	dump databases like No-Intro list them.
+*/
+
+// CRC-32 (zlib polynomial), table driven 8 bytes at a time
+// Reference: https://create.stephan-brumme.com/crc32/#slicing-by-8-overview
+class Crc32
+{
+public:
+	void Update(std::span<const uint8_t> data);
+	uint32_t GetValue() const { return ~m_crc; }
+
+	static uint32_t Compute(std::span<const uint8_t> data);
+
+private:
+	uint32_t m_crc = 0xFFFFFFFF;
+};
+
+typedef std::array<uint8_t, 20> Sha1Digest;
+
+// Reference: https://datatracker.ietf.org/doc/html/rfc3174
+class Sha1
+{
+public:
+	void Update(std::span<const uint8_t> data);
+
+	// Pads the message, no more updates after this
+	Sha1Digest Finish();
+
+	static Sha1Digest Compute(std::span<const uint8_t> data);
+	static std::string ToHex(const Sha1Digest& digest);
+	static bool FromHex(const std::string& hex, Sha1Digest& digest); // 40 hex digits, either case
+
+private:
+	void ProcessBlock(const uint8_t block[64]);
+
+	std::array<uint32_t, 5> m_state = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	std::array<uint8_t, 64> m_block = {};
+	size_t m_blockSize = 0;
+	uint64_t m_length = 0;
+};
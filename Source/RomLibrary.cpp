@@ -0,0 +1,292 @@
+#include "RomLibrary.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include "RomFile.h"
+
+size_t RomLibrary::Scan(const std::string& directory, int threadCount)
+{
+	std::vector<std::string> paths;
+	std::error_code error;
+	for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+	{
+		if (!it->is_regular_file(error))
+			continue;
+
+		std::string extension = it->path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		if (extension == ".nes")
+		{
+			paths.push_back(it->path().string());
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, std::max(1, (int)paths.size()));
+
+	// Workers pull the next file off a shared counter, each result has its own slot so the order stays sorted
+	std::vector<Entry> entries(paths.size());
+	std::vector<uint8_t> indexed(paths.size(), 0);
+	std::atomic<size_t> next = 0;
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < paths.size(); i = next++)
+		{
+			indexed[i] = IndexRom(paths[i], entries[i]);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	m_entries.clear();
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (indexed[i]) m_entries.push_back(std::move(entries[i]));
+	}
+	RebuildLookup();
+
+	return m_entries.size();
+}
+
+bool RomLibrary::IndexRom(const std::string& path, Entry& entry)
+{
+	std::shared_ptr<const RomFile> romFile = RomFile::Open(path);
+	if (!romFile || romFile->GetData().size() < entry.header.size())
+		return false;
+
+	std::span<const uint8_t> data = romFile->GetData();
+	if (std::memcmp(data.data(), "NES\x1A", 4) != 0)
+		return false;
+
+	entry.path = path;
+	entry.fileSize = data.size();
+	std::copy(data.begin(), data.begin() + entry.header.size(), entry.header.begin());
+	entry.fixups = FixHeader(entry.header);
+
+	// Hash what the console will actually see, through the same header it'll be loaded with
+	GameCartridge game;
+	game.LoadRomFromFile(path, entry.header);
+	if (!game.IsLoaded())
+		return false;
+
+	Crc32 crc32;
+	Sha1 sha1;
+	crc32.Update(game.GetPrgRom());
+	crc32.Update(game.GetChrRom());
+	sha1.Update(game.GetPrgRom());
+	sha1.Update(game.GetChrRom());
+	entry.crc32 = crc32.GetValue();
+	entry.sha1 = sha1.Finish();
+
+	return true;
+}
+
+uint8_t RomLibrary::FixHeader(std::array<uint8_t, 16>& header)
+{
+	// Reference: https://www.nesdev.org/wiki/INES#Variant_comparison
+	// Old dumping tools wrote their name over the unused end of iNES 1.0 headers. NES 2.0 headers use those bytes.
+	bool nes20 = (header[7] & 0x0C) == 0x08;
+	bool garbageTail = header[12] != 0 || header[13] != 0 || header[14] != 0 || header[15] != 0;
+	if (!nes20 && garbageTail)
+	{
+		std::fill(header.begin() + 7, header.end(), 0);
+		return kFixupGarbageTail;
+	}
+
+	return kFixupNone;
+}
+
+/* Index file */
+static void WriteBytes(std::vector<uint8_t>& out, const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	out.insert(out.end(), bytes, bytes + size);
+}
+
+static void WriteInt(std::vector<uint8_t>& out, uint64_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		out.push_back((uint8_t)(value >> (i * 8)));
+	}
+}
+
+// SHA-1, CRC-32, file size, header, fix-ups and path length, see the layout in RomLibrary.h
+static constexpr size_t kIndexEntryMinSize = 20 + 4 + 8 + 16 + 1 + 2;
+
+// Reads the index back, every read checks there's enough left so a truncated file just fails to load
+struct IndexReader
+{
+	const std::vector<uint8_t>& data;
+	size_t offset = 0;
+
+	bool ReadBytes(void* out, size_t size)
+	{
+		if (data.size() - offset < size) return false;
+		std::memcpy(out, data.data() + offset, size);
+		offset += size;
+		return true;
+	}
+
+	template<typename T>
+	bool ReadInt(T& value)
+	{
+		if (data.size() - offset < sizeof(T)) return false;
+		value = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+		{
+			value |= (T)data[offset + i] << (i * 8);
+		}
+		offset += sizeof(T);
+		return true;
+	}
+};
+
+bool RomLibrary::Save(const std::string& indexPath) const
+{
+	std::vector<uint8_t> out;
+	for (const Entry& entry : m_entries)
+	{
+		// The length is stored as a uint16, a longer path wouldn't come back the same
+		if (entry.path.size() > UINT16_MAX)
+			return false;
+	}
+
+	WriteBytes(out, "NXRI", 4);
+	WriteInt(out, kIndexVersion, 4);
+	WriteInt(out, m_entries.size(), 4);
+
+	for (const Entry& entry : m_entries)
+	{
+		WriteBytes(out, entry.sha1.data(), entry.sha1.size());
+		WriteInt(out, entry.crc32, 4);
+		WriteInt(out, entry.fileSize, 8);
+		WriteBytes(out, entry.header.data(), entry.header.size());
+		WriteInt(out, entry.fixups, 1);
+		WriteInt(out, entry.path.size(), 2);
+		WriteBytes(out, entry.path.data(), entry.path.size());
+	}
+
+	std::ofstream file(indexPath, std::ofstream::binary | std::ofstream::trunc);
+	file.write((const char*)out.data(), out.size());
+	return file.good();
+}
+
+bool RomLibrary::Load(const std::string& indexPath)
+{
+	std::ifstream file(indexPath, std::ifstream::binary);
+	if (!file.is_open())
+		return false;
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	IndexReader reader{ data };
+
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	if (!reader.ReadBytes(magic, 4) || std::memcmp(magic, "NXRI", 4) != 0 || !reader.ReadInt(version) ||
+		version != kIndexVersion || !reader.ReadInt(count))
+		return false;
+
+	// The count isn't trusted either, there has to be room left for that many entries with an empty path
+	if (count > (data.size() - reader.offset) / kIndexEntryMinSize)
+		return false;
+
+	std::vector<Entry> entries(count);
+	for (Entry& entry : entries)
+	{
+		uint16_t pathLength;
+		if (!reader.ReadBytes(entry.sha1.data(), entry.sha1.size()) || !reader.ReadInt(entry.crc32) ||
+			!reader.ReadInt(entry.fileSize) || !reader.ReadBytes(entry.header.data(), entry.header.size()) ||
+			!reader.ReadInt(entry.fixups) || !reader.ReadInt(pathLength))
+			return false;
+
+		entry.path.resize(pathLength);
+		if (!reader.ReadBytes(entry.path.data(), pathLength))
+			return false;
+	}
+
+	m_entries = std::move(entries);
+	RebuildLookup();
+	return true;
+}
+
+/* Lookup */
+size_t RomLibrary::Sha1DigestHash::operator()(const Sha1Digest& digest) const
+{
+	// Already uniformly distributed, any 8 bytes will do
+	size_t hash;
+	std::memcpy(&hash, digest.data(), sizeof(hash));
+	return hash;
+}
+
+void RomLibrary::RebuildLookup()
+{
+	m_bySha1.clear();
+	m_byCrc32.clear();
+	m_bySha1.reserve(m_entries.size());
+	m_byCrc32.reserve(m_entries.size());
+
+	// The same ROM under two names resolves to the first one
+	for (size_t i = 0; i < m_entries.size(); i++)
+	{
+		m_bySha1.emplace(m_entries[i].sha1, i);
+		m_byCrc32.emplace(m_entries[i].crc32, i);
+	}
+}
+
+const RomLibrary::Entry* RomLibrary::Find(const Sha1Digest& sha1) const
+{
+	auto it = m_bySha1.find(sha1);
+	return it != m_bySha1.end() ? &m_entries[it->second] : nullptr;
+}
+
+const RomLibrary::Entry* RomLibrary::FindByCrc32(uint32_t crc32) const
+{
+	auto it = m_byCrc32.find(crc32);
+	return it != m_byCrc32.end() ? &m_entries[it->second] : nullptr;
+}
+
+bool RomLibrary::SetHeader(const Sha1Digest& sha1, const std::array<uint8_t, 16>& header)
+{
+	auto it = m_bySha1.find(sha1);
+	if (it == m_bySha1.end())
+		return false;
+
+	// Every copy of the ROM, not just the one the lookup points at
+	for (Entry& entry : m_entries)
+	{
+		if (entry.sha1 == sha1)
+		{
+			entry.header = header;
+			entry.fixups |= kFixupOverride;
+		}
+	}
+	return true;
+}
+
+bool RomLibrary::LoadCartridge(const Entry& entry, GameCartridge& game) const
+{
+	game.LoadRomFromFile(entry.path, entry.header);
+	return game.IsLoaded() && game.GetRomFile()->GetData().size() == entry.fileSize;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GameCartridge.h"
+#include "RomHash.h"
+
+/*
+	An index over a directory of iNES ROMs. Scanning hashes every ROM once (CRC-32 and SHA-1 of PRG + CHR), fixes up
+	known bad headers and saves the result to a small index file. Launching a ROM after that is a hash lookup, and the
+	cartridge is loaded with the header from the index instead of the one in the file.
+
+	Index file layout, little endian:
+		"NXRI", uint32 version, uint32 entry count
+		Per entry: SHA-1 [20], CRC-32 uint32, file size uint64, header [16], fix-ups uint8, path length uint16, path
+*/
+class RomLibrary
+{
+public:
+	// What was changed in a header compared to the file, see Entry::fixups
+	enum HeaderFixup : uint8_t
+	{
+		kFixupNone = 0x00,
+		kFixupGarbageTail = 0x01, // Bytes 7 - 15 had junk like "DiskDude!" in them, so the mapper number was wrong
+		kFixupOverride = 0x02 // Replaced through SetHeader
+	};
+
+	struct Entry
+	{
+		std::string path;
+		uint64_t fileSize = 0;
+		std::array<uint8_t, 16> header = {};
+		uint8_t fixups = kFixupNone;
+		uint32_t crc32 = 0;
+		Sha1Digest sha1 = {};
+
+		uint8_t GetMapperId() const { return (header[6] >> 4) | (header[7] & 0xF0); }
+		size_t GetPrgSize() const { return header[4] * 16384; }
+		size_t GetChrSize() const { return header[5] * 8192; }
+	};
+
+	// Replaces the index with every .nes file under directory, hashed on threadCount threads (0 for one per core).
+	// Returns how many ROMs were indexed, files that aren't iNES ROMs are left out.
+	size_t Scan(const std::string& directory, int threadCount = 0);
+
+	bool Save(const std::string& indexPath) const;
+	bool Load(const std::string& indexPath);
+
+	// Null if the ROM isn't in the index
+	const Entry* Find(const Sha1Digest& sha1) const;
+	const Entry* FindByCrc32(uint32_t crc32) const;
+
+	// Header fix-ups from a dump database, kept in the index
+	bool SetHeader(const Sha1Digest& sha1, const std::array<uint8_t, 16>& header);
+
+	// Loads the entry's file with the entry's header, fails if the file changed size since it was indexed
+	bool LoadCartridge(const Entry& entry, GameCartridge& game) const;
+
+	const std::vector<Entry>& GetEntries() const { return m_entries; }
+
+private:
+	static constexpr uint32_t kIndexVersion = 1;
+
+	static bool IndexRom(const std::string& path, Entry& entry);
+	static uint8_t FixHeader(std::array<uint8_t, 16>& header);
+
+	void RebuildLookup();
+
+	struct Sha1DigestHash
+	{
+		size_t operator()(const Sha1Digest& digest) const;
+	};
+
+	std::vector<Entry> m_entries;
+	std::unordered_map<Sha1Digest, size_t, Sha1DigestHash> m_bySha1;
+	std::unordered_map<uint32_t, size_t> m_byCrc32;
+};
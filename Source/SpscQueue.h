@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/*
+	Lock free ring buffer for one producer thread and one consumer thread. Capacity has to be a power of 2.
+
+	Each side only writes its own index and keeps a copy of the other side's, which it only reloads when the queue
+	looks full / empty, so the two don't fight over a cache line on every push and pop.
+*/
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of 2");
+
+public:
+	/* Producer */
+	// False if the queue is full, the item is dropped then
+	bool Push(const T& item)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCopy == Capacity)
+		{
+			m_headCopy = m_head.load(std::memory_order_acquire);
+			if (tail - m_headCopy == Capacity)
+				return false;
+		}
+
+		m_items[tail & kIndexMask] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Consumer */
+	// The oldest item, null if the queue is empty. Stays valid until Pop.
+	const T* Front()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tailCopy)
+		{
+			m_tailCopy = m_tail.load(std::memory_order_acquire);
+			if (head == m_tailCopy)
+				return nullptr;
+		}
+
+		return &m_items[head & kIndexMask];
+	}
+
+	// Only after Front returned something
+	void Pop()
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	static constexpr size_t kIndexMask = Capacity - 1;
+
+	std::array<T, Capacity> m_items;
+
+	// Producer side
+	alignas(64) std::atomic<size_t> m_tail = 0;
+	size_t m_headCopy = 0;
+
+	// Consumer side
+	alignas(64) std::atomic<size_t> m_head = 0;
+	size_t m_tailCopy = 0;
+};
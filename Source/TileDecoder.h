@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// SSE2 is always there on x64, and on x86 when the compiler is allowed to use it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILE_DECODER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TILE_DECODER_SSE2 0
+#endif
+
+/*
+	Turns 2 bits per pixel pattern data into pixels, and pixels into framebuffer entries.
+
+	A tile row is two bytes, one per bit plane, with the leftmost pixel in bit 7. DecodeRow spreads both across
+	8 bytes at once with SSE2 and combines them into pixel values 0 - 3. ResolvePalette is a plain lookup of a span of
+	palette RAM indices, the framebuffer keeps NES colors so there is little left to do there. Turning those into host
+	colors several at a time is FrameConverter's job.
+	Reference: https://www.nesdev.org/wiki/PPU_pattern_tables
+*/
+class TileDecoder
+{
+public:
+	// 8 pixel values 0 - 3, leftmost first
+	static inline void DecodeRow(uint8_t low, uint8_t high, uint8_t pixels[8])
+	{
+#if TILE_DECODER_SSE2
+		// Each byte lane tests its own bit of the plane, a set bit compares to 0xFF
+		const __m128i bits = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0, 0, 0, 0, 0, 0, 0, 0);
+		__m128i lowSet = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)low), bits), bits);
+		__m128i highSet = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8((char)high), bits), bits);
+		__m128i value = _mm_or_si128(_mm_and_si128(lowSet, _mm_set1_epi8(0x01)), _mm_and_si128(highSet, _mm_set1_epi8(0x02)));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pixels), value);
+#else
+		for (int i = 0; i < 8; i++)
+		{
+			pixels[i] = (((high >> (7 - i)) & 0x01) << 1) | ((low >> (7 - i)) & 0x01);
+		}
+#endif
+	}
+
+	// Mirrored left to right, for sprites with the horizontal flip bit
+	static inline void DecodeRowFlipped(uint8_t low, uint8_t high, uint8_t pixels[8])
+	{
+		DecodeRow(kBitReverse[low], kBitReverse[high], pixels);
+	}
+
+	// A whole tile, 16 bytes of pattern data (8 low plane rows then 8 high plane rows) to 8x8 pixels
+	static void DecodeTile(const uint8_t pattern[16], uint8_t pixels[64]);
+
+	// Palette RAM indices (0 - 31) to framebuffer pixels, palette is the 32 pixels palette RAM currently selects
+	static void ResolvePalette(const uint8_t* indices, int count, const uint16_t palette[32], uint16_t* out);
+
+	static const uint8_t kBitReverse[256];
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/*
+	Lock free handoff of the newest T from one producer thread to one consumer thread.
+
+	Three buffers: the producer fills its back buffer and swaps it with the middle one, the consumer swaps its front
+	buffer with the middle one when there's something new in it. Neither side ever waits for the other, the producer
+	just overwrites a middle buffer the consumer didn't get to, so the consumer always gets the newest one.
+*/
+template<typename T>
+class TripleBuffer
+{
+public:
+	/* Producer */
+	T& GetBackBuffer() { return m_buffers[m_back]; }
+
+	void Publish()
+	{
+		uint8_t middle = m_middle.exchange(m_back | kFresh, std::memory_order_acq_rel);
+		m_back = middle & kIndexMask;
+	}
+
+	/* Consumer */
+	// True if something was published since the last call, GetFrontBuffer has it then
+	bool TakeNewest()
+	{
+		if ((m_middle.load(std::memory_order_relaxed) & kFresh) == 0)
+			return false;
+
+		uint8_t middle = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = middle & kIndexMask;
+		return true;
+	}
+
+	const T& GetFrontBuffer() const { return m_buffers[m_front]; }
+
+private:
+	static constexpr uint8_t kIndexMask = 0x03;
+	static constexpr uint8_t kFresh = 0x04; // The middle buffer hasn't been taken yet
+
+	std::array<T, 3> m_buffers;
+
+	// Each side's index on its own cache line, the middle one is the only one both touch
+	alignas(64) uint8_t m_back = 0;
+	alignas(64) std::atomic<uint8_t> m_middle = 1;
+	alignas(64) uint8_t m_front = 2;
+};
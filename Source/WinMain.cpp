@@ -1,4 +1,5 @@
 #pragma comment(lib,"d3d11.lib")
+#pragma comment(lib,"winmm.lib")
 
 #include "WindowsWrapper.h"
 
@@ -8,12 +9,16 @@
 #include <d3d11.h>
 #include <memory>
 #include <chrono>
+#include <cstring>
 
 #include "WindowsMessageMap.h"
 #include "Window.h"
 #include "InputState.h"
 #include "DebugListener.h"
+#include "ConsoleChecks.h"
 #include "DirectXManager.h"
+#include "EmulationThread.h"
+#include "FrameConverter.h"
 #include "NES.h"
 
 #include "../resource.h"
@@ -25,7 +30,140 @@ INT WindowWidth;
 
 HICON hIcon;
 
-int CALLBACK WinMain(HINSTANCE, HINSTANCE, LPSTR, INT)
+/*
+Runs the same frames under each NES scheduler as fast as it can and reports frames per second.
+Start with -benchmark on the command line.
+*/
+std::string RunSchedulerBenchmark(GameCartridge& game, int frames)
+{
+	std::ostringstream result;
+	const NES::Scheduler schedulers[] = { NES::Scheduler::Lockstep, NES::Scheduler::CatchUp };
+	const char* names[] = { "Lockstep", "Catch up" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		std::unique_ptr<NES> nes(new NES());
+		nes->PowerOn();
+		nes->LoadGameCartridge(game);
+		nes->CPU.Reset();
+		nes->SetScheduler(schedulers[i]);
+
+		std::chrono::steady_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++)
+		{
+			nes->ClockFullFrame();
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		result << names[i] << ": " << frames / seconds << " fps\n";
+	}
+
+	return result.str();
+}
+
+/*
+Runs the same frames drawing every frame, headless, and headless drawing only every 60th frame, and reports frames per
+second. Start with -headless-benchmark on the command line.
+*/
+std::string RunHeadlessBenchmark(GameCartridge& game, int frames)
+{
+	std::ostringstream result;
+	const int drawEvery[] = { 1, 0, 60 };
+	const char* names[] = { "Full rendering", "Headless", "Headless, every 60th frame drawn" };
+
+	for (int i = 0; i < 3; i++)
+	{
+		std::unique_ptr<NES> nes(new NES());
+		nes->PowerOn();
+		nes->LoadGameCartridge(game);
+		nes->CPU.Reset();
+
+		std::chrono::steady_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < frames; frame++)
+		{
+			nes->PPU.SetHeadless(drawEvery[i] == 0 || frame % drawEvery[i] != 0);
+			nes->ClockFullFrame();
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		result << names[i] << ": " << frames / seconds << " fps\n";
+	}
+
+	return result.str();
+}
+
+/*
+Runs the game for a moment to get something on screen, then clocks only the PPU and reports dots per second.
+Start with -ppu-benchmark on the command line.
+*/
+std::string RunPpuBenchmark(GameCartridge& game, int frames)
+{
+	std::unique_ptr<NES> nes(new NES());
+	nes->PowerOn();
+	nes->LoadGameCartridge(game);
+	nes->CPU.Reset();
+
+	const int kWarmUpFrames = 120;
+	for (int frame = 0; frame < kWarmUpFrames; frame++)
+	{
+		nes->ClockFullFrame();
+	}
+
+	// The CPU is frozen, so whatever the game left in VRAM, OAM and the registers gets drawn over and over
+	const long long kDotsPerFrame = 262 * 341;
+	long long dots = frames * kDotsPerFrame;
+
+	// Thread cycles come from the processor's cycle counter, so they don't depend on the clock speed it happens to run at
+	ULONG64 startCycles = 0;
+	ULONG64 endCycles = 0;
+	QueryThreadCycleTime(GetCurrentThread(), &startCycles);
+	std::chrono::steady_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (long long dot = 0; dot < dots; dot++)
+	{
+		nes->PPU.Cycle();
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::high_resolution_clock::now();
+	QueryThreadCycleTime(GetCurrentThread(), &endCycles);
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	std::ostringstream result;
+	result << "PPU: " << dots / seconds / 1000000.0 << " M dots/s (" << dots / seconds / kDotsPerFrame << " fps), "
+		<< (double)(endCycles - startCycles) / dots << " cycles per dot\n";
+
+	const ChrCache::Stats& chrStats = nes->GetChrCache().GetStats();
+	size_t chrRomBytes = nes->GetChrCache().GetRomCache() ? nes->GetChrCache().GetRomCache()->GetMemoryUsage() : 0;
+	result << "CHR cache: " << nes->GetChrCache().GetMemoryUsage() << " bytes (" << chrRomBytes << " shared), "
+		<< chrStats.bankBuilds << " banks and " << chrStats.tileDecodes << " tiles decoded, " << chrStats.dirtyTiles << " dirtied\n";
+	return result.str();
+}
+
+/*
+Lists what one console instance holds in memory. Start with -memory-report on the command line.
+*/
+std::string FormatMemoryReport(NES& nes)
+{
+	std::ostringstream result;
+	size_t instanceBytes = 0;
+	size_t sharedBytes = 0;
+	for (const NES::MemoryReportEntry& entry : nes.GetMemoryReport())
+	{
+		result << entry.name << ": " << entry.bytes << " bytes" << (entry.shared ? " (shared)" : "") << "\n";
+
+		// Indented entries are already part of the one above
+		if (entry.name[0] == ' ') continue;
+
+		if (entry.shared) sharedBytes += entry.bytes;
+		else instanceBytes += entry.bytes;
+	}
+	result << "Per instance: " << instanceBytes << " bytes\n";
+	result << "Shared by every instance running the cartridge: " << sharedBytes << " bytes\n";
+
+	return result.str();
+}
+
+int CALLBACK WinMain(HINSTANCE, HINSTANCE, LPSTR commandLine, INT)
 {
 	/*
 	Set up application window 
@@ -64,27 +202,76 @@ int CALLBACK WinMain(HINSTANCE, HINSTANCE, LPSTR, INT)
 	game->LoadRomFromFile("Q:/Coding/ROMs/ebike.nes");
 	nes.LoadGameCartridge(*game);
 
+	if (strstr(commandLine, "-ppu-benchmark") != nullptr)
+	{
+		std::string result = RunPpuBenchmark(*game, 600);
+		OutputDebugStringA(result.c_str());
+		MessageBoxA(nullptr, result.c_str(), "PPU benchmark", MB_OK);
+		return 0;
+	}
+
+	if (strstr(commandLine, "-headless-benchmark") != nullptr)
+	{
+		std::string result = RunHeadlessBenchmark(*game, 1200);
+		OutputDebugStringA(result.c_str());
+		MessageBoxA(nullptr, result.c_str(), "Headless benchmark", MB_OK);
+		return 0;
+	}
+
+	// After the other benchmarks, their names contain this one
+	if (strstr(commandLine, "-benchmark") != nullptr)
+	{
+		std::string result = RunSchedulerBenchmark(*game, 1200);
+		OutputDebugStringA(result.c_str());
+		MessageBoxA(nullptr, result.c_str(), "Scheduler benchmark", MB_OK);
+		return 0;
+	}
+
+	if (strstr(commandLine, "-renderer-check") != nullptr)
+	{
+		// See ConsoleChecks.h, nesx-batch -renderer-check runs the same thing
+		std::string result;
+		RunRendererCheck(*game, 1200, result);
+		OutputDebugStringA(result.c_str());
+		MessageBoxA(nullptr, result.c_str(), "Renderer check", MB_OK);
+		return 0;
+	}
+
+	if (strstr(commandLine, "-memory-report") != nullptr)
+	{
+		std::string result = FormatMemoryReport(nes);
+		OutputDebugStringA(result.c_str());
+		MessageBoxA(nullptr, result.c_str(), "Memory report", MB_OK);
+		return 0;
+	}
+
 	nes.CPU.Reset();
 
+	// The swap chain texture is R8G8B8A8
+	FrameConverter frameConverter(FrameConverter::PixelFormat::RGBA8);
+	std::vector<uint32_t> frame(PPU::kScreenWidth * PPU::kScreenHeight);
+
 
 	/*
 	Application Loop
 	*/
-	std::chrono::steady_clock::time_point m_prevFrameStart;
+	// Emulation runs on its own thread and paces itself, this one just keeps the window going: pump messages, send
+	// controller changes over, present the newest frame. A slow Present never holds up emulation.
+	timeBeginPeriod(1); // The emulation thread sleeps between frames, the default timer is too coarse for that
+	std::unique_ptr<EmulationThread> emulation(new EmulationThread(nes));
+	emulation->Start();
+
+	uint8_t sentInput = 0x00;
 	while (true)
 	{
-		std::chrono::steady_clock::time_point curTime = std::chrono::high_resolution_clock::now();
-		long long duration = std::chrono::duration_cast<std::chrono::milliseconds>(curTime - m_prevFrameStart).count();
-		if (duration < 16.66) continue; // Throttle for next frame to ensure 60 fps
-
-		m_prevFrameStart = std::chrono::high_resolution_clock::now();
-
 		// Flush out all window messages / get input
 		MSG msg = { 0 };
 		while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
 		{
 			if (msg.message == WM_QUIT)
 			{
+				emulation->Stop();
+				timeEndPeriod(1);
 				return msg.wParam;
 			}
 
@@ -102,17 +289,25 @@ int CALLBACK WinMain(HINSTANCE, HINSTANCE, LPSTR, INT)
 		if (inputState->IsSelectButtonDown()) { input |= 0x20; } // Select
 		if (inputState->IsBButtonDown()) { input |= 0x40; } // B
 		if (inputState->IsAButtonDown()) { input |= 0x80; } // A
-		nes.SetFirstControllerState(input);
-		
-		// TODO: Handle second player input
-		// nes.SetSecondControllerState(0x00);
 
-		// Run a frame of emulation
-		nes.ClockFullFrame();
+		// Only changes go over, one that didn't fit gets sent again next time around
+		// TODO: Handle second player input
+		if (input != sentInput && emulation->PushInput(input, 0x00))
+		{
+			sentInput = input;
+		}
 
-		// Spit out to result to our graphics manager and render the frame
-		NesColor* screen = nes.PPU.GetScreenBuffer();
-		graphicsManager->RenderFrame(reinterpret_cast<uint32_t*>(screen));
+		// Spit out the newest frame to our graphics manager and render it, Present waits for vsync
+		if (const EmulationThread::Frame* newest = emulation->TakeNewestFrame())
+		{
+			frameConverter.Convert(newest->pixels.data(), (int)frame.size(), frame.data());
+			graphicsManager->RenderFrame(frame.data());
+		}
+		else
+		{
+			// Nothing new yet, wait for a message or a millisecond instead of spinning
+			MsgWaitForMultipleObjects(0, nullptr, FALSE, 1, QS_ALLINPUT);
+		}
 	}
 
 	return 0;